@@ -1,11 +1,39 @@
 #!/bin/bash
 
+# --fail-fast: every gadget checks its output against result.outs while it
+#              runs and exits at the first line no expected output can match
+# --json=<file>, --junit=<file>: also write the results, with the matched
+#              out.N, the exit code and per-phase timing of every test
+# --kcov:      collect host kernel coverage of every test into
+#              tests/<name>/kcov (needs CONFIG_KCOV and debugfs) and print
+#              the PCs each test covers and how many only it covers
+fail_fast=false
+kcov=false
+json_file=""
+junit_file=""
+for arg in "$@"; do
+    case "$arg" in
+    --fail-fast) fail_fast=true ;;
+    --json=*) json_file="$(readlink -m "${arg#--json=}")" ;;
+    --junit=*) junit_file="$(readlink -m "${arg#--junit=}")" ;;
+    --kcov) kcov=true ;;
+    *)
+        echo "Usage: $0 [--fail-fast] [--json=<file>] [--junit=<file>] [--kcov]"
+        exit 1
+        ;;
+    esac
+done
+
 pushd $(dirname "$(readlink -e "$0")") >/dev/null
 
+# Waits for a path to appear after modprobe (built by make)
+wait_ready=src/wait-ready/wait-ready
+
 # Check if /dev/raw-gadget exists, otherwise load raw_gadget module
 if [[ ! -e /dev/raw-gadget ]]; then
     modprobe raw_gadget
-    sleep 1  # Give some time for the device to appear
+    # Give some time for the device to appear
+    "$wait_ready" /dev/raw-gadget || sleep 1
     if [[ ! -e /dev/raw-gadget ]]; then
         echo "Error: /dev/raw-gadget is missing after loading raw_gadget module."
         exit 1
@@ -16,47 +44,256 @@ fi
 EXPECTED_UDC="USB_UDC_NAME=dummy_udc"
 if [[ "$(cat /sys/class/udc/dummy_udc.0/uevent 2>/dev/null)" != "$EXPECTED_UDC" ]]; then
     modprobe dummy_hcd
-    sleep 1  # Allow the module to initialize
+    # Allow the module to initialize
+    "$wait_ready" /sys/class/udc/dummy_udc.0 || sleep 1
     if [[ "$(cat /sys/class/udc/dummy_udc.0/uevent 2>/dev/null)" != "$EXPECTED_UDC" ]]; then
         echo "Error: dummy_hcd module did not initialize correctly."
         exit 1
     fi
 fi
 
+# One "name|status|exit code|matched out.N|start|end|phases" entry per test,
+# phases being "phase=start" pairs separated by spaces
+results=()
+
+now() {
+    date +%s.%N
+}
+
+# record <status> [matched out.N]
+record() {
+    local phases=""
+    if [[ -f "$phases_file" ]]; then
+        phases="$(awk '{ printf "%s%s=%s", (NR > 1 ? " " : ""), $1, $2 }' "$phases_file")"
+    fi
+    results+=("$test_name|$1|$exit_code|$2|$start|$(now)|$phases")
+}
+
+# elapsed <from> <to>
+elapsed() {
+    awk -v a="$1" -v b="$2" 'BEGIN { printf "%.6f", b - a }'
+}
+
+# Prints "phase start duration" lines for the phases of a result entry;
+# a phase lasts until the next one starts or the test ends.
+phase_times() {
+    local phases=$1 end=$2
+    local -a list=($phases)
+    for ((i = 0; i < ${#list[@]}; i++)); do
+        local name=${list[i]%%=*} from=${list[i]#*=} to=$end
+        if ((i + 1 < ${#list[@]})); then
+            to=${list[i + 1]#*=}
+        fi
+        echo "$name $from $(elapsed "$from" "$to")"
+    done
+}
+
+# Test names and messages come from tests/list.txt and the results, so
+# they are escaped before they go into the JSON and JUnit files.
+
+# json_escape <string>: the string as the inside of a JSON string
+json_escape() {
+    local s=$1 out="" c i
+    for ((i = 0; i < ${#s}; i++)); do
+        c=${s:i:1}
+        case "$c" in
+        '"') out+='\"' ;;
+        '\') out+='\\' ;;
+        [[:cntrl:]]) out+=$(printf '\\u%04x' "'$c") ;;
+        *) out+=$c ;;
+        esac
+    done
+    printf '%s' "$out"
+}
+
+# xml_escape <string>: the string as an XML attribute value; control
+# characters XML 1.0 can't carry become '?'
+xml_escape() {
+    local s=$1 out="" c i
+    for ((i = 0; i < ${#s}; i++)); do
+        c=${s:i:1}
+        case "$c" in
+        '&') out+='&amp;' ;;
+        '<') out+='&lt;' ;;
+        '>') out+='&gt;' ;;
+        '"') out+='&quot;' ;;
+        "'") out+='&apos;' ;;
+        $'\t') out+='&#9;' ;;
+        $'\n') out+='&#10;' ;;
+        $'\r') out+='&#13;' ;;
+        [[:cntrl:]]) out+='?' ;;
+        *) out+=$c ;;
+        esac
+    done
+    printf '%s' "$out"
+}
+
+write_json() {
+    local first=true
+    {
+        echo "{"
+        echo "  \"start\": $suite_start,"
+        echo "  \"duration\": $(elapsed "$suite_start" "$suite_end"),"
+        echo "  \"tests\": ["
+        for entry in "${results[@]}"; do
+            IFS='|' read -r name status code matched start end phases <<< "$entry"
+            $first || echo "    },"
+            first=false
+            echo "    {"
+            echo "      \"name\": \"$(json_escape "$name")\","
+            echo "      \"status\": \"$status\","
+            echo "      \"exit_code\": ${code:-null},"
+            if [[ -n "$matched" ]]; then
+                echo "      \"matched\": \"$(json_escape "$matched")\","
+            else
+                echo "      \"matched\": null,"
+            fi
+            echo "      \"start\": $start,"
+            echo "      \"duration\": $(elapsed "$start" "$end"),"
+            echo -n "      \"phases\": ["
+            local sep=""
+            while read -r phase from duration; do
+                [[ -n "$phase" ]] || continue
+                echo -n "$sep"
+                echo -ne "\n        { \"name\": \"$(json_escape "$phase")\", \"start\": $from, \"duration\": $duration }"
+                sep=","
+            done <<< "$(phase_times "$phases" "$end")"
+            [[ -n "$sep" ]] && echo -ne "\n      "
+            echo "]"
+        done
+        $first || echo "    }"
+        echo "  ]"
+        echo "}"
+    } > "$json_file"
+}
+
+write_junit() {
+    local failures=0 skipped=0
+    for entry in "${results[@]}"; do
+        IFS='|' read -r name status _ <<< "$entry"
+        case "$status" in
+        failed|timeout) ((failures++)) ;;
+        skip) ((skipped++)) ;;
+        esac
+    done
+
+    {
+        echo '<?xml version="1.0" encoding="UTF-8"?>'
+        echo "<testsuite name=\"usb-gadget-tests\" tests=\"${#results[@]}\" failures=\"$failures\" skipped=\"$skipped\" time=\"$(elapsed "$suite_start" "$suite_end")\">"
+        for entry in "${results[@]}"; do
+            IFS='|' read -r name status code matched start end phases <<< "$entry"
+            echo "  <testcase classname=\"usb-gadget-tests\" name=\"$(xml_escape "$name")\" time=\"$(elapsed "$start" "$end")\">"
+            echo "    <properties>"
+            echo "      <property name=\"exit_code\" value=\"$code\"/>"
+            echo "      <property name=\"matched\" value=\"$(xml_escape "$matched")\"/>"
+            while read -r phase from duration; do
+                [[ -n "$phase" ]] || continue
+                echo "      <property name=\"phase.$(xml_escape "$phase")\" value=\"$duration\"/>"
+            done <<< "$(phase_times "$phases" "$end")"
+            echo "    </properties>"
+            case "$status" in
+            failed) echo "    <failure message=\"$(xml_escape "output does not match result.outs")\"/>" ;;
+            timeout) echo "    <failure message=\"$(xml_escape "timeout")\"/>" ;;
+            skip) echo "    <skipped/>" ;;
+            esac
+            echo "  </testcase>"
+        done
+        echo "</testsuite>"
+    } > "$junit_file"
+}
+
+# Per test: covered PCs, and PCs no other test covers. A test with
+# nothing of its own is redundant as far as host coverage goes.
+kcov_report() {
+    local files=()
+    for entry in "${results[@]}"; do
+        local name=${entry%%|*}
+        [[ -f "tests/$name/kcov" ]] && files+=("tests/$name/kcov")
+    done
+    [[ ${#files[@]} -gt 0 ]] || return
+
+    echo "Host coverage (unique PCs):"
+    awk '
+        /^#/ { note[FILENAME] = substr($0, 3); next }
+        FNR == 1 { order[n++] = FILENAME }
+        { pcs[FILENAME]++; owner[$1] = owner[$1] == "" ? FILENAME : "-" }
+        END {
+            for (pc in owner) {
+                total++
+                if (owner[pc] != "-")
+                    own[owner[pc]]++
+            }
+            for (f in note)
+                if (!(f in pcs))
+                    order[n++] = f
+            for (i = 0; i < n; i++) {
+                f = order[i]; name = f
+                sub(/^tests\//, "", name); sub(/\/kcov$/, "", name)
+                printf "  %-40s %8d covered %8d only here%s\n", name,
+                    pcs[f], own[f], (f in note ? "  (" note[f] ")" : "")
+            }
+            printf "  %-40s %8d covered\n", "total", total
+        }' "${files[@]}"
+}
+
+suite_start=$(now)
+
 # Run each test listed in tests/list.txt
 while IFS= read -r test_name; do
     test_dir="tests/$test_name"
     test_script="$test_dir/run.sh"
     result_file="$test_dir/result"
     result_outs_dir="$test_dir/result.outs"
+    phases_file=""
+    kcov_file=""
+    exit_code=""
+    start=$(now)
+    rm -f "$test_dir/phases" "$test_dir/kcov"
+    # Phase timing only goes into the JSON and JUnit results
+    if [[ -n "$json_file" || -n "$junit_file" ]]; then
+        phases_file="$PWD/$test_dir/phases"
+    fi
+    if [[ "$kcov" == true ]]; then
+        kcov_file="$PWD/$test_dir/kcov"
+    fi
 
     if [[ ! -x "$test_script" ]]; then
         echo "Skipping $test_name: $test_script is not executable or missing."
+        record skip
         continue
     fi
 
     # Check if result.outs directory exists and contains at least out.1
     if [[ ! -d "$result_outs_dir" || ! -f "$result_outs_dir/out.1" ]]; then
         echo "Skipping $test_name: $result_outs_dir/out.1 is missing."
+        record skip
         continue
     fi
 
     echo "Running test: $test_name"
-    timeout 60 "$test_script"
+    expect_dir=""
+    if [[ "$fail_fast" == true ]]; then
+        expect_dir="$PWD/$result_outs_dir"
+    fi
+    USB_GADGET_EXPECT="$expect_dir" USB_GADGET_PHASES="$phases_file" \
+        USB_GADGET_KCOV="$kcov_file" timeout 60 "$test_script"
     exit_code=$?
 
     if [[ $exit_code -eq 70 ]]; then
         echo -e "$test_name \e[36m[Skip]\e[0m"
+        record skip
         continue
     fi
 
     if [[ $exit_code -eq 124 ]]; then
         echo -e "$test_name \e[31m[Timeout]\e[0m"
+        record timeout
         continue
     fi
 
     if [[ ! -f "$result_file" ]]; then
         echo -e "$test_name \e[31m[Failed]\e[0m (No result file)"
+        record failed
         continue
     fi
 
@@ -71,10 +308,18 @@ while IFS= read -r test_name; do
 
     if [[ "$match_found" == true ]]; then
         echo -e "$test_name \e[32m[Ok]\e[0m"
+        record ok "$(basename "$expected_result")"
     else
         echo -e "$test_name \e[31m[Failed]\e[0m"
         diff "$result_outs_dir/out.1" "$result_file"
+        record failed
     fi
 done < tests/list.txt
 
+suite_end=$(now)
+
+[[ -n "$json_file" ]] && write_json
+[[ -n "$junit_file" ]] && write_junit
+[[ "$kcov" == true ]] && kcov_report
+
 popd >/dev/null
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Emulates a composite USB device (VID: 0x1d6b, PID: 0x0104, the Linux
+// multifunction composite gadget IDs) built from the functions listed
+// with --functions=<name>[,<name>...] (keyboard,mouse by default):
+//
+//   keyboard - HID boot keyboard, one interrupt IN endpoint, 'x' keypresses
+//   mouse    - HID boot mouse, one interrupt IN endpoint, clicks and moves
+//   printer  - bidirectional printer, bulk OUT and IN, GET_DEVICE_ID
+//
+// Each function becomes one interface of a single configuration, and the
+// endpoint addresses are assigned across all of them, so usbhid, usblp
+// and the other class drivers probe their interfaces concurrently from
+// one enumeration. The functions come from usb_functions.c, with the
+// descriptors of the standalone keyboard, mouse and printer gadgets. ep0
+// is served by usb_composite_ep0_loop() from the common library. The
+// gadget exits once every function has seen its class driver's last
+// probe request (the HID report descriptor, the printer's device ID).
+
+#include "../usb_functions.h"
+
+/*----------------------------------------------------------------------*/
+
+void log_control_request(struct usb_ctrlrequest *ctrl) {
+	printf("  bRequestType: 0x%x (%s), bRequest: 0x%x, wValue: 0x%x,"
+		" wIndex: 0x%x, wLength: %d\n", ctrl->bRequestType,
+		(ctrl->bRequestType & USB_DIR_IN) ? "IN" : "OUT",
+		ctrl->bRequest, ctrl->wValue, ctrl->wIndex, ctrl->wLength);
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		printf("  type = USB_TYPE_STANDARD\n");
+		break;
+	case USB_TYPE_CLASS:
+		printf("  type = USB_TYPE_CLASS\n");
+		break;
+	case USB_TYPE_VENDOR:
+		printf("  type = USB_TYPE_VENDOR\n");
+		break;
+	default:
+		printf("  type = unknown = %d\n", (int)ctrl->bRequestType);
+		break;
+	}
+
+	switch (ctrl->bRequestType & USB_RECIP_MASK) {
+	case USB_RECIP_DEVICE:
+		printf("  recipient = device\n");
+		break;
+	case USB_RECIP_INTERFACE:
+		printf("  recipient = interface %d\n", ctrl->wIndex & 0xff);
+		break;
+	case USB_RECIP_ENDPOINT:
+		printf("  recipient = endpoint 0x%x\n", ctrl->wIndex & 0xff);
+		break;
+	default:
+		printf("  recipient = other\n");
+		break;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+#define BCD_USB		0x0200
+
+#define USB_VENDOR	0x1d6b
+#define USB_PRODUCT	0x0104
+
+#define STRING_ID_MANUFACTURER	0
+#define STRING_ID_PRODUCT	1
+#define STRING_ID_SERIAL	2
+#define STRING_ID_CONFIG	3
+
+#define EP_MAX_PACKET_CONTROL	64
+
+struct usb_composite composite = {
+	.device = {
+		.bLength =		USB_DT_DEVICE_SIZE,
+		.bDescriptorType =	USB_DT_DEVICE,
+		.bcdUSB =		__constant_cpu_to_le16(BCD_USB),
+		.bDeviceClass =		0,
+		.bDeviceSubClass =	0,
+		.bDeviceProtocol =	0,
+		.bMaxPacketSize0 =	EP_MAX_PACKET_CONTROL,
+		.idVendor =		__constant_cpu_to_le16(USB_VENDOR),
+		.idProduct =		__constant_cpu_to_le16(USB_PRODUCT),
+		.bcdDevice =		0,
+		.iManufacturer =	STRING_ID_MANUFACTURER,
+		.iProduct =		STRING_ID_PRODUCT,
+		.iSerialNumber =	STRING_ID_SERIAL,
+		.bNumConfigurations =	1,
+	},
+	.config = {
+		.bLength =		USB_DT_CONFIG_SIZE,
+		.bDescriptorType =	USB_DT_CONFIG,
+		.wTotalLength =		0,  // computed later
+		.bNumInterfaces =	0,  // computed later
+		.bConfigurationValue =	1,
+		.iConfiguration =	STRING_ID_CONFIG,
+		.bmAttributes =		USB_CONFIG_ATT_ONE |
+					USB_CONFIG_ATT_SELFPOWER,
+		.bMaxPower =		0x32,
+	},
+};
+
+/*----------------------------------------------------------------------*/
+
+static struct usb_function *functions[] = {
+	&keyboard_function,
+	&mouse_function,
+	&printer_function,
+};
+
+#define FUNCTIONS_NUM (sizeof(functions) / sizeof(functions[0]))
+
+static void add_functions(const char *list) {
+	char *copy = strdup(list);
+	char *save = NULL;
+
+	for (char *name = strtok_r(copy, ",", &save); name;
+					name = strtok_r(NULL, ",", &save)) {
+		size_t i;
+		for (i = 0; i < FUNCTIONS_NUM; i++)
+			if (!strcmp(functions[i]->name, name))
+				break;
+		if (i == FUNCTIONS_NUM) {
+			printf("unknown function: %s (available:", name);
+			for (i = 0; i < FUNCTIONS_NUM; i++)
+				printf(" %s", functions[i]->name);
+			printf(")\n");
+			exit(EXIT_FAILURE);
+		}
+		for (int j = 0; j < composite.functions_num; j++) {
+			if (composite.functions[j] == functions[i]) {
+				printf("duplicate function: %s\n", name);
+				exit(EXIT_FAILURE);
+			}
+		}
+		usb_composite_add(&composite, functions[i]);
+		printf("composite: interface %d: %s\n",
+			functions[i]->interface.bInterfaceNumber, name);
+	}
+	free(copy);
+}
+
+int main(int argc, char **argv) {
+	const char *device = "dummy_udc.0";
+	const char *driver = "dummy_udc";
+	const char *list = "keyboard,mouse";
+	int arg = 1;
+
+	usb_gadget_parse_args(&argc, argv);
+	if (argc > arg && !strncmp(argv[arg], "--functions=", 12))
+		list = argv[arg++] + 12;
+	if (argc > arg)
+		device = argv[arg++];
+	if (argc > arg)
+		driver = argv[arg++];
+
+	add_functions(list);
+
+	int fd = usb_raw_open();
+	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
+	usb_raw_run(fd);
+
+	usb_composite_ep0_loop(fd, &composite);
+	// Let the functions' threads send their first reports.
+	sleep(1);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	close(fd);
+
+	return 0;
+}
@@ -588,6 +588,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2)
 		device = argv[1];
 	if (argc >= 3)
@@ -598,6 +600,7 @@ int main(int argc, char **argv) {
 	usb_raw_run(fd);
 
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
 
 	close(fd);
 
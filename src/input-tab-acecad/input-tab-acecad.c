@@ -265,6 +265,29 @@ int ep_int_in_send_packet(int fd, struct usb_raw_int_io* io) {
 	return rv;
 }
 
+void pen_encode(const struct pen_sample *s, uint8_t *report) {
+	report[0] = 0x04 | (s->tip ? 0x01 : 0);	// prox, touch
+	report[1] = s->x;
+	report[2] = s->x >> 8;
+	report[3] = s->y;
+	report[4] = s->y >> 8;
+	report[5] = s->pressure;
+	report[6] = s->pressure >> 8;
+}
+
+// Ranges of the 302 as set up by the driver.
+const struct pen_device pen_device = {
+	.vendor		= USB_VENDOR,
+	.product	= USB_PRODUCT,
+	.x_max		= 3000,
+	.y_max		= 2250,
+	.pressure_max	= 512,
+	.tilt_x_max	= 0,
+	.tilt_y_max	= 0,
+	.report_len	= EP_MAX_PACKET_INT,
+	.encode		= pen_encode,
+};
+
 void *ep_int_in_loop(void *arg) {
 	int fd = (int)(long)arg;
 
@@ -294,6 +317,11 @@ void *ep_int_in_loop(void *arg) {
 
 
 exit:
+	if (usb_gadget_opts.stroke_sec) {
+		pen_stroke_run(fd, ep_int_in, &pen_device);
+		return NULL;
+	}
+
 	// Wait exit
 	sleep(10);
 
@@ -338,6 +366,7 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			break;
 		case USB_REQ_SET_CONFIGURATION:
 			ep_int_in = usb_raw_ep_enable(fd, &usb_endpoint);
+			input_latency_track_ep(ep_int_in);
 			int rv = pthread_create(&ep_int_in_thread, 0,
 					ep_int_in_loop, (void *)(long)fd);
 			if (rv != 0) {
@@ -421,6 +450,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2) {
 		if (!strcmp(argv[1], "--invalid_ep_int_len")) {
 			// Enable set invalid length for testing OOB
@@ -433,7 +464,14 @@ int main(int argc, char **argv) {
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
+	if (usb_gadget_opts.input_latency)
+		input_latency_start(USB_VENDOR, USB_PRODUCT);
+
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	pen_stroke_wait();
+	input_latency_report();
 
 	close(fd);
 
@@ -278,6 +278,41 @@ int ep_int_in_send_packet(int fd, struct usb_raw_int_io* io) {
 	return rv;
 }
 
+// Art Master HD tool data packet, the inverse of hanwang_parse_packet():
+// be16 x/y in bytes 2-5, pressure (data[7] >> 6) | (data[6] << 2) (the
+// 11-bit layout with data[1] bit 0 is Art Master III only), tilt X in
+// data[7] & 0x3f and tilt Y in data[8] & 0x7f.
+void pen_encode(const struct pen_sample *s, uint8_t *report) {
+	report[0] = 0x02;
+	report[1] = 0xe0;	// tool data packet
+	report[2] = s->x >> 8;
+	report[3] = s->x;
+	report[4] = s->y >> 8;
+	report[5] = s->y;
+	report[6] = s->pressure >> 2;
+	report[7] = ((s->pressure & 0x03) << 6) | (s->tilt_x & 0x3f);
+	report[8] = s->tilt_y & 0x7f;
+}
+
+const uint8_t pen_prologue[EP_MAX_PACKET_INT] = {
+	0x02, 0xc2, 0x00, 0x30,	// tool prox in, STYLUS BTN_TOOL_PEN
+};
+
+// Ranges of the Art Master HD 5012 entry in hanwang_features[].
+const struct pen_device pen_device = {
+	.vendor		= USB_VENDOR,
+	.product	= USB_PRODUCT,
+	.x_max		= 0x678e,
+	.y_max		= 0x4150,
+	.pressure_max	= 1023,	// 1024 in the table, 10 bits on the wire
+	.tilt_x_max	= 0x3f,
+	.tilt_y_max	= 0x7f,
+	.report_len	= EP_MAX_PACKET_INT,
+	.prologue	= pen_prologue,
+	.prologue_len	= EP_MAX_PACKET_INT,
+	.encode		= pen_encode,
+};
+
 void *ep_int_in_loop(void *arg) {
 	int fd = (int)(long)arg;
 
@@ -321,6 +356,11 @@ void *ep_int_in_loop(void *arg) {
 	io.inner.data[0] = 0x0c;
 	ep_int_in_send_packet(fd,&io);
 
+	if (usb_gadget_opts.stroke_sec) {
+		pen_stroke_run(fd, ep_int_in, &pen_device);
+		return NULL;
+	}
+
 	// Wait exit
 	sleep(10);
 
@@ -365,6 +405,7 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			break;
 		case USB_REQ_SET_CONFIGURATION:
 			ep_int_in = usb_raw_ep_enable(fd, &usb_endpoint);
+			input_latency_track_ep(ep_int_in);
 			int rv = pthread_create(&ep_int_in_thread, 0,
 					ep_int_in_loop, (void *)(long)fd);
 			if (rv != 0) {
@@ -448,6 +489,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2) {
 		if (!strcmp(argv[1], "--invalid_ep_int_type")) {
 			// Enable bogus int_in endpoint (xfer int -> bulk)
@@ -460,7 +503,14 @@ int main(int argc, char **argv) {
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
+	if (usb_gadget_opts.input_latency)
+		input_latency_start(USB_VENDOR, USB_PRODUCT);
+
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	pen_stroke_wait();
+	input_latency_report();
 
 	close(fd);
 
@@ -288,6 +288,33 @@ int ep_int_in_send_packet(int fd, struct usb_raw_int_io* io) {
 	return rv;
 }
 
+// The NoteTaker reports a signed x centered on the receiver; an all-zero
+// position is a pen-up event, which the stroke never hits.
+void pen_encode(const struct pen_sample *s, uint8_t *report) {
+	int16_t x = (int16_t)s->x - 1500;
+	uint16_t y = s->y + 1600;
+
+	report[0] = BATTERY_GOOD;
+	report[1] = s->tip ? PEN_TIP : 0;
+	report[2] = x;
+	report[3] = (uint16_t)x >> 8;
+	report[4] = y;
+	report[5] = y >> 8;
+}
+
+// ABS_X -1500..1500, ABS_Y 1600..3000 as set up by the driver.
+const struct pen_device pen_device = {
+	.vendor		= USB_VENDOR,
+	.product	= USB_PRODUCT,
+	.x_max		= 3000,
+	.y_max		= 1400,
+	.pressure_max	= 1,
+	.tilt_x_max	= 0,
+	.tilt_y_max	= 0,
+	.report_len	= EP_MAX_PACKET_INT,
+	.encode		= pen_encode,
+};
+
 void *ep_int_in_loop(void *arg) {
 	int fd = (int)(long)arg;
 
@@ -325,6 +352,11 @@ void *ep_int_in_loop(void *arg) {
 	ep_int_in_send_packet(fd,&io);
 
 exit:
+	if (usb_gadget_opts.stroke_sec) {
+		pen_stroke_run(fd, ep_int_in, &pen_device);
+		return NULL;
+	}
+
 	// Wait exit
 	sleep(10);
 
@@ -369,6 +401,7 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			break;
 		case USB_REQ_SET_CONFIGURATION:
 			ep_int_in = usb_raw_ep_enable(fd, &usb_endpoint);
+			input_latency_track_ep(ep_int_in);
 			int rv = pthread_create(&ep_int_in_thread, 0,
 					ep_int_in_loop, (void *)(long)fd);
 			if (rv != 0) {
@@ -461,6 +494,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2) {
 		if (!strcmp(argv[1], "--invalid_ep_int_len")) {
 			// Enable set invalid length for testing OOB
@@ -473,7 +508,14 @@ int main(int argc, char **argv) {
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
+	if (usb_gadget_opts.input_latency)
+		input_latency_start(USB_VENDOR, USB_PRODUCT);
+
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	pen_stroke_wait();
+	input_latency_report();
 
 	close(fd);
 
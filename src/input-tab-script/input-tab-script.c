@@ -0,0 +1,791 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Generic data-driven input tablet. The device identity (VID/PID,
+// interface class triple), the interrupt IN endpoint layout, an optional
+// HID report descriptor and the packet stream are all loaded from a
+// text script, so the same binary can stand in for any of the
+// input-tab-* emulators (see src/input-tab-script/scripts/).
+// It uses a USB 2.0 protocol over a HS connection.
+// One interrupt IN endpoint is configured.
+// Handles standard USB control requests (e.g., GET_DESCRIPTOR,
+// SET_CONFIGURATION) and acknowledges any class or vendor request.
+//
+// Usage: input-tab-script <script.tab>
+//
+// Script syntax, one directive per line, '#' starts a comment:
+//   vendor <id>                 idVendor
+//   product <id>                idProduct
+//   bcd_device <bcd>            bcdDevice
+//   interface <cls> <sub> <pr>  bInterfaceClass/SubClass/Protocol
+//   endpoint <maxpacket> <int>  wMaxPacketSize and bInterval
+//   hid_report <hex bytes...>   HID report descriptor (lines append)
+//   packet <hex bytes...>       one report, zero-padded to maxpacket
+//   ramp <n> <hex bytes...> @<off>:<u8|le16|be16>=<from>..<to> ...
+//                               n reports, fields linearly interpolated
+//   delay <ms>                  pause before the next packet
+//   loop <n>                    replay the stream n times (0: forever)
+//   timeout <seconds>           exit even if the stream did not finish
+//
+// Packets are written back to back, so the stream runs at the polling
+// rate of the host driver's interrupt URB. Most tablet drivers only
+// submit that URB while their input device is open, so the gadget keeps
+// the host's event nodes open while it streams.
+
+#include "../usb_gadget_tests.h"
+
+/*----------------------------------------------------------------------*/
+
+#include <linux/hid.h>
+
+struct hid_class_descriptor {
+	__u8  bDescriptorType;
+	__le16 wDescriptorLength;
+} __attribute__ ((packed));
+
+struct hid_descriptor {
+	__u8  bLength;
+	__u8  bDescriptorType;
+	__le16 bcdHID;
+	__u8  bCountryCode;
+	__u8  bNumDescriptors;
+
+	struct hid_class_descriptor desc[1];
+} __attribute__ ((packed));
+
+/*----------------------------------------------------------------------*/
+
+#define SCRIPT_PACKET_MAX	64
+#define SCRIPT_HID_REPORT_MAX	1024
+#define SCRIPT_LINE_MAX		4096
+#define SCRIPT_NODES_MAX	4
+#define SCRIPT_NODES_WAIT_MS	5000
+
+struct script_packet {
+	uint32_t delay_us;	// sleep before sending
+	uint8_t data[SCRIPT_PACKET_MAX];
+};
+
+struct tablet_script {
+	uint16_t vendor;
+	uint16_t product;
+	uint16_t bcd_device;
+	uint8_t if_class;
+	uint8_t if_subclass;
+	uint8_t if_protocol;
+	uint16_t maxpacket;
+	uint8_t interval;
+
+	uint8_t hid_report[SCRIPT_HID_REPORT_MAX];
+	int hid_report_len;
+
+	struct script_packet *packets;
+	size_t npackets;
+	size_t cap;
+
+	unsigned loops;
+	unsigned timeout_sec;
+};
+
+struct tablet_script script = {
+	.bcd_device = 0x100,
+	.maxpacket = 8,
+	.interval = 10,
+	.loops = 1,
+	.timeout_sec = 10,
+};
+
+static void script_error(const char *path, int line, const char *msg) {
+	printf("%s:%d: %s\n", path, line, msg);
+	exit(EXIT_FAILURE);
+}
+
+static struct script_packet *script_add_packet(void) {
+	if (script.npackets == script.cap) {
+		script.cap = script.cap ? script.cap * 2 : 256;
+		script.packets = realloc(script.packets,
+				script.cap * sizeof(*script.packets));
+		if (!script.packets) {
+			perror("realloc()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	struct script_packet *pkt = &script.packets[script.npackets++];
+	memset(pkt, 0, sizeof(*pkt));
+	return pkt;
+}
+
+#define SCRIPT_TOKENS_MAX	(SCRIPT_HID_REPORT_MAX + 16)
+
+// Parse hex bytes from tok[*idx] on, stopping at an '@' field spec.
+// Returns the number of bytes stored, or -1 on malformed input.
+static int parse_hex_bytes(char **tok, int ntok, int *idx,
+					uint8_t *out, int max) {
+	int n = 0;
+
+	for (; *idx < ntok && tok[*idx][0] != '@'; (*idx)++) {
+		char *end;
+		unsigned long v = strtoul(tok[*idx], &end, 16);
+		if (*end || v > 0xff || n >= max)
+			return -1;
+		out[n++] = v;
+	}
+	return n;
+}
+
+struct ramp_field {
+	unsigned offset;
+	int width;		// 1 or 2
+	bool big_endian;
+	long from;
+	long to;
+};
+
+static bool parse_ramp_field(const char *tok, struct ramp_field *f) {
+	char type[8];
+
+	if (sscanf(tok, "@%u:%7[a-z0-9]=%li..%li",
+			&f->offset, type, &f->from, &f->to) != 4)
+		return false;
+	if (!strcmp(type, "u8")) {
+		f->width = 1;
+		f->big_endian = false;
+	} else if (!strcmp(type, "le16")) {
+		f->width = 2;
+		f->big_endian = false;
+	} else if (!strcmp(type, "be16")) {
+		f->width = 2;
+		f->big_endian = true;
+	} else
+		return false;
+	return f->offset + f->width <= script.maxpacket;
+}
+
+static void ramp_store(uint8_t *data, struct ramp_field *f, long v) {
+	if (f->width == 1) {
+		data[f->offset] = v;
+	} else if (f->big_endian) {
+		data[f->offset] = v >> 8;
+		data[f->offset + 1] = v;
+	} else {
+		data[f->offset] = v;
+		data[f->offset + 1] = v >> 8;
+	}
+}
+
+static void script_add_ramp(const char *path, int lineno,
+				char **tok, int ntok) {
+	uint8_t base[SCRIPT_PACKET_MAX] = {0};
+	struct ramp_field fields[8];
+	int nfields = 0;
+	int idx = 2;
+
+	long count = ntok > 1 ? strtol(tok[1], NULL, 0) : 0;
+	if (count <= 0)
+		script_error(path, lineno, "bad ramp count");
+	if (parse_hex_bytes(tok, ntok, &idx, base, script.maxpacket) <= 0)
+		script_error(path, lineno, "bad ramp packet");
+	for (; idx < ntok; idx++) {
+		if (nfields == 8 || !parse_ramp_field(tok[idx], &fields[nfields]))
+			script_error(path, lineno, "bad ramp field");
+		nfields++;
+	}
+
+	for (long i = 0; i < count; i++) {
+		struct script_packet *pkt = script_add_packet();
+		memcpy(pkt->data, base, sizeof(base));
+		for (int j = 0; j < nfields; j++) {
+			struct ramp_field *rf = &fields[j];
+			long v = rf->from;
+			if (count > 1)
+				v += (rf->to - rf->from) * i / (count - 1);
+			ramp_store(pkt->data, rf, v);
+		}
+	}
+}
+
+void script_load(const char *path) {
+	static char line[SCRIPT_LINE_MAX];
+	static char *tok[SCRIPT_TOKENS_MAX];
+	uint32_t pending_delay_us = 0;
+	int lineno = 0;
+
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror("fopen(script)");
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *comment = strchr(line, '#');
+		char *cursor = NULL;
+		int ntok = 0;
+		lineno++;
+
+		if (comment)
+			*comment = '\0';
+		for (char *t = strtok_r(line, " \t\r\n", &cursor); t;
+				t = strtok_r(NULL, " \t\r\n", &cursor)) {
+			if (ntok == SCRIPT_TOKENS_MAX)
+				script_error(path, lineno, "line too long");
+			tok[ntok++] = t;
+		}
+		if (ntok == 0)
+			continue;
+
+		const char *cmd = tok[0];
+		int idx = 1;
+		size_t first_new = script.npackets;
+
+		if (!strcmp(cmd, "vendor") && ntok == 2) {
+			script.vendor = strtoul(tok[1], NULL, 0);
+		} else if (!strcmp(cmd, "product") && ntok == 2) {
+			script.product = strtoul(tok[1], NULL, 0);
+		} else if (!strcmp(cmd, "bcd_device") && ntok == 2) {
+			script.bcd_device = strtoul(tok[1], NULL, 0);
+		} else if (!strcmp(cmd, "interface") && ntok == 4) {
+			script.if_class = strtoul(tok[1], NULL, 0);
+			script.if_subclass = strtoul(tok[2], NULL, 0);
+			script.if_protocol = strtoul(tok[3], NULL, 0);
+		} else if (!strcmp(cmd, "endpoint") && ntok == 3) {
+			unsigned long mp = strtoul(tok[1], NULL, 0);
+			unsigned long interval = strtoul(tok[2], NULL, 0);
+			if (mp == 0 || mp > SCRIPT_PACKET_MAX ||
+					interval == 0 || interval > 16)
+				script_error(path, lineno, "bad endpoint");
+			if (script.npackets)
+				script_error(path, lineno,
+					"endpoint must precede packets");
+			script.maxpacket = mp;
+			script.interval = interval;
+		} else if (!strcmp(cmd, "hid_report")) {
+			int n = parse_hex_bytes(tok, ntok, &idx,
+				&script.hid_report[script.hid_report_len],
+				SCRIPT_HID_REPORT_MAX - script.hid_report_len);
+			if (n < 0 || idx != ntok)
+				script_error(path, lineno, "bad hid_report");
+			script.hid_report_len += n;
+		} else if (!strcmp(cmd, "packet")) {
+			struct script_packet *pkt = script_add_packet();
+			int n = parse_hex_bytes(tok, ntok, &idx, pkt->data,
+							script.maxpacket);
+			if (n <= 0 || idx != ntok)
+				script_error(path, lineno, "bad packet");
+		} else if (!strcmp(cmd, "ramp")) {
+			script_add_ramp(path, lineno, tok, ntok);
+		} else if (!strcmp(cmd, "delay") && ntok == 2) {
+			pending_delay_us += strtoul(tok[1], NULL, 0) * 1000;
+		} else if (!strcmp(cmd, "loop") && ntok == 2) {
+			script.loops = strtoul(tok[1], NULL, 0);
+		} else if (!strcmp(cmd, "timeout") && ntok == 2) {
+			script.timeout_sec = strtoul(tok[1], NULL, 0);
+		} else {
+			script_error(path, lineno, "unknown directive");
+		}
+
+		// A pending delay applies to the first packet that follows.
+		if (script.npackets > first_new) {
+			script.packets[first_new].delay_us = pending_delay_us;
+			pending_delay_us = 0;
+		}
+	}
+	fclose(f);
+
+	if (!script.vendor && !script.product)
+		script_error(path, lineno, "vendor/product not set");
+	if (!script.npackets)
+		script_error(path, lineno, "no packets");
+
+	printf("[script] %s: %04x:%04x, maxpacket %u, bInterval %u, "
+		"%zu packets\n", path, script.vendor, script.product,
+		script.maxpacket, script.interval, script.npackets);
+}
+
+/*----------------------------------------------------------------------*/
+
+void log_control_request(struct usb_ctrlrequest *ctrl) {
+	printf("  bRequestType: 0x%x (%s), bRequest: 0x%x, wValue: 0x%x,"
+		" wIndex: 0x%x, wLength: %d\n", ctrl->bRequestType,
+		(ctrl->bRequestType & USB_DIR_IN) ? "IN" : "OUT",
+		ctrl->bRequest, ctrl->wValue, ctrl->wIndex, ctrl->wLength);
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		printf("  type = USB_TYPE_STANDARD\n");
+		break;
+	case USB_TYPE_CLASS:
+		printf("  type = USB_TYPE_CLASS\n");
+		break;
+	case USB_TYPE_VENDOR:
+		printf("  type = USB_TYPE_VENDOR\n");
+		break;
+	default:
+		printf("  type = unknown = %d\n", (int)ctrl->bRequestType);
+		break;
+	}
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		switch (ctrl->bRequest) {
+		case USB_REQ_GET_DESCRIPTOR:
+			printf("  req = USB_REQ_GET_DESCRIPTOR\n");
+			switch (ctrl->wValue >> 8) {
+			case USB_DT_DEVICE:
+				printf("  desc = USB_DT_DEVICE\n");
+				break;
+			case USB_DT_CONFIG:
+				printf("  desc = USB_DT_CONFIG\n");
+				break;
+			case USB_DT_STRING:
+				printf("  desc = USB_DT_STRING\n");
+				break;
+			case HID_DT_REPORT:
+				printf("  descriptor = HID_DT_REPORT\n");
+				break;
+			default:
+				printf("  desc = unknown = 0x%x\n",
+							ctrl->wValue >> 8);
+				break;
+			}
+			break;
+		case USB_REQ_SET_CONFIGURATION:
+			printf("  req = USB_REQ_SET_CONFIGURATION\n");
+			break;
+		default:
+			printf("  req = unknown = 0x%x\n", ctrl->bRequest);
+			break;
+		}
+		break;
+	default:
+		printf("  req = 0x%x\n", ctrl->bRequest);
+		break;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+#define BCD_USB		0x0200
+
+#define STRING_ID_MANUFACTURER	0
+#define STRING_ID_PRODUCT	1
+#define STRING_ID_SERIAL	2
+#define STRING_ID_CONFIG	3
+#define STRING_ID_INTERFACE	4
+
+#define EP_MAX_PACKET_CONTROL	64
+
+// Assigned dynamically.
+#define EP_NUM_INT_IN	0x0
+
+struct usb_device_descriptor usb_device = {
+	.bLength =		USB_DT_DEVICE_SIZE,
+	.bDescriptorType =	USB_DT_DEVICE,
+	.bcdUSB =		__constant_cpu_to_le16(BCD_USB),
+	.bDeviceClass =		0,
+	.bDeviceSubClass =	0,
+	.bDeviceProtocol =	0,
+	.bMaxPacketSize0 =	EP_MAX_PACKET_CONTROL,
+	.idVendor =		0,  // from script
+	.idProduct =		0,  // from script
+	.bcdDevice =		0,  // from script
+	.iManufacturer =	STRING_ID_MANUFACTURER,
+	.iProduct =		STRING_ID_PRODUCT,
+	.iSerialNumber =	STRING_ID_SERIAL,
+	.bNumConfigurations =	1,
+};
+
+struct usb_config_descriptor usb_config = {
+	.bLength =		USB_DT_CONFIG_SIZE,
+	.bDescriptorType =	USB_DT_CONFIG,
+	.wTotalLength =		0,  // computed later
+	.bNumInterfaces =	1,
+	.bConfigurationValue =	1,
+	.iConfiguration = 	STRING_ID_CONFIG,
+	.bmAttributes =		USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_SELFPOWER,
+	.bMaxPower =		0x32,
+};
+
+struct usb_interface_descriptor usb_interface = {
+	.bLength =		USB_DT_INTERFACE_SIZE,
+	.bDescriptorType =	USB_DT_INTERFACE,
+	.bInterfaceNumber =	0,
+	.bAlternateSetting =	0,
+	.bNumEndpoints =	1,
+	.bInterfaceClass =	0,  // from script
+	.bInterfaceSubClass =	0,  // from script
+	.bInterfaceProtocol =	0,  // from script
+	.iInterface =		STRING_ID_INTERFACE,
+};
+
+struct usb_endpoint_descriptor usb_endpoint = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+	.bEndpointAddress =	USB_DIR_IN | EP_NUM_INT_IN,
+	.bmAttributes =		USB_ENDPOINT_XFER_INT,
+	.wMaxPacketSize =	0,  // from script
+	.bInterval =		0,  // from script
+};
+
+struct hid_descriptor usb_hid = {
+	.bLength =		9,
+	.bDescriptorType =	HID_DT_HID,
+	.bcdHID =		__constant_cpu_to_le16(0x0110),
+	.bCountryCode =		0,
+	.bNumDescriptors =	1,
+	.desc =			{
+		{
+			.bDescriptorType =	HID_DT_REPORT,
+			.wDescriptorLength =	0,  // from script
+		}
+	},
+};
+
+void apply_script_descriptors(void) {
+	usb_device.idVendor = __cpu_to_le16(script.vendor);
+	usb_device.idProduct = __cpu_to_le16(script.product);
+	usb_device.bcdDevice = __cpu_to_le16(script.bcd_device);
+
+	usb_interface.bInterfaceClass = script.if_class;
+	usb_interface.bInterfaceSubClass = script.if_subclass;
+	usb_interface.bInterfaceProtocol = script.if_protocol;
+
+	usb_endpoint.wMaxPacketSize = __cpu_to_le16(script.maxpacket);
+	usb_endpoint.bInterval = script.interval;
+
+	usb_hid.desc[0].wDescriptorLength =
+				__cpu_to_le16(script.hid_report_len);
+}
+
+int build_config(char *data, int length, bool other_speed) {
+	struct usb_config_descriptor *config =
+		(struct usb_config_descriptor *)data;
+	int total_length = 0;
+
+	assert(length >= sizeof(usb_config));
+	memcpy(data, &usb_config, sizeof(usb_config));
+	data += sizeof(usb_config);
+	length -= sizeof(usb_config);
+	total_length += sizeof(usb_config);
+
+	assert(length >= sizeof(usb_interface));
+	memcpy(data, &usb_interface, sizeof(usb_interface));
+	data += sizeof(usb_interface);
+	length -= sizeof(usb_interface);
+	total_length += sizeof(usb_interface);
+
+	if (script.hid_report_len) {
+		assert(length >= sizeof(usb_hid));
+		memcpy(data, &usb_hid, sizeof(usb_hid));
+		data += sizeof(usb_hid);
+		length -= sizeof(usb_hid);
+		total_length += sizeof(usb_hid);
+	}
+
+	assert(length >= USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &usb_endpoint, USB_DT_ENDPOINT_SIZE);
+	data += USB_DT_ENDPOINT_SIZE;
+	length -= USB_DT_ENDPOINT_SIZE;
+	total_length += USB_DT_ENDPOINT_SIZE;
+
+	config->wTotalLength = __cpu_to_le16(total_length);
+	printf("config->wTotalLength: %d\n", total_length);
+
+	if (other_speed)
+		config->bDescriptorType = USB_DT_OTHER_SPEED_CONFIG;
+
+	return total_length;
+}
+
+/*----------------------------------------------------------------------*/
+
+bool assign_ep_address(struct usb_raw_ep_info *info,
+				struct usb_endpoint_descriptor *ep) {
+	if (usb_endpoint_num(ep) != 0)
+		return false;  // Already assigned.
+	if (usb_endpoint_dir_in(ep) && !info->caps.dir_in)
+		return false;
+	if (usb_endpoint_dir_out(ep) && !info->caps.dir_out)
+		return false;
+	if (usb_endpoint_maxp(ep) > info->limits.maxpacket_limit)
+		return false;
+	switch (usb_endpoint_type(ep)) {
+	case USB_ENDPOINT_XFER_INT:
+		if (!info->caps.type_int)
+			return false;
+		break;
+	default:
+		assert(false);
+	}
+	if (info->addr == USB_RAW_EP_ADDR_ANY) {
+		static int addr = 1;
+		ep->bEndpointAddress |= addr++;
+	} else
+		ep->bEndpointAddress |= info->addr;
+	return true;
+}
+
+void process_eps_info(int fd) {
+	struct usb_raw_eps_info info;
+	memset(&info, 0, sizeof(info));
+
+	int num = usb_raw_eps_info(fd, &info);
+
+	for (int i = 0; i < num; i++) {
+		if (assign_ep_address(&info.eps[i], &usb_endpoint))
+			continue;
+	}
+
+	int ep_int_in_addr = usb_endpoint_num(&usb_endpoint);
+	assert(ep_int_in_addr != 0);
+}
+
+/*----------------------------------------------------------------------*/
+
+#define EP0_MAX_DATA	(SCRIPT_HID_REPORT_MAX + 64)
+
+struct usb_raw_control_event {
+	struct usb_raw_event		inner;
+	struct usb_ctrlrequest		ctrl;
+};
+
+struct usb_raw_control_io {
+	struct usb_raw_ep_io		inner;
+	char				data[EP0_MAX_DATA];
+};
+
+struct usb_raw_int_io {
+	struct usb_raw_ep_io		inner;
+	char				data[SCRIPT_PACKET_MAX];
+};
+
+int ep_int_in = -1;
+pthread_t ep_int_in_thread;
+
+atomic_bool ep_int_in_en = ATOMIC_VAR_INIT(false);
+atomic_bool stream_done = ATOMIC_VAR_INIT(false);
+
+void *ep_int_in_loop(void *arg) {
+	int fd = (int)(long)arg;
+	uint64_t sent = 0;
+	bool shutdown = false;
+
+	struct usb_raw_int_io io;
+	io.inner.ep = ep_int_in;
+	io.inner.flags = 0;
+	io.inner.length = script.maxpacket;
+
+	while (!atomic_load(&ep_int_in_en));
+
+	// --latency opens the nodes itself.
+	int fds[SCRIPT_NODES_MAX];
+	char paths[SCRIPT_NODES_MAX][INPUT_NODE_PATH_MAX];
+	int nfds = 0;
+	if (!usb_gadget_opts.input_latency) {
+		nfds = input_event_wait_open(script.vendor, script.product,
+				fds, paths, SCRIPT_NODES_MAX,
+				SCRIPT_NODES_WAIT_MS);
+		if (nfds == 0)
+			printf("[script] no input device %04x:%04x appeared\n",
+				script.vendor, script.product);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned loop = 0; !shutdown &&
+			(script.loops == 0 || loop < script.loops); loop++) {
+		for (size_t i = 0; i < script.npackets; i++) {
+			struct script_packet *pkt = &script.packets[i];
+
+			if (pkt->delay_us)
+				usleep(pkt->delay_us);
+			memcpy(&io.inner.data[0], pkt->data, script.maxpacket);
+
+			int rv = usb_raw_ep_write_may_fail(fd,
+						(struct usb_raw_ep_io *)&io);
+			if (rv < 0 && errno == ESHUTDOWN) {
+				printf("ep_int_in: device was likely reset, "
+							"exiting\n");
+				shutdown = true;
+				break;
+			} else if (rv < 0) {
+				perror("usb_raw_ep_write_may_fail()");
+				exit(EXIT_FAILURE);
+			}
+			sent++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	for (int n = 0; n < nfds; n++)
+		close(fds[n]);
+	double elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("[script] sent %llu packets in %.3f s (%.0f packets/s)\n",
+		(unsigned long long)sent, elapsed,
+		elapsed > 0 ? sent / elapsed : 0.0);
+
+	atomic_store(&stream_done, true);
+	return NULL;
+}
+
+bool ep0_request(int fd, struct usb_raw_control_event *event,
+				struct usb_raw_control_io *io) {
+	switch (event->ctrl.bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		switch (event->ctrl.bRequest) {
+		case USB_REQ_GET_DESCRIPTOR:
+			switch (event->ctrl.wValue >> 8) {
+			case USB_DT_DEVICE:
+				memcpy(&io->data[0], &usb_device,
+							sizeof(usb_device));
+				io->inner.length = sizeof(usb_device);
+				return true;
+			case USB_DT_CONFIG:
+				io->inner.length =
+					build_config(&io->data[0],
+						sizeof(io->data), false);
+				return true;
+			case USB_DT_STRING:
+				io->data[0] = 4;
+				io->data[1] = USB_DT_STRING;
+				if ((event->ctrl.wValue & 0xff) == 0) {
+					io->data[2] = 0x09;
+					io->data[3] = 0x04;
+				} else {
+					io->data[2] = 'T';
+					io->data[3] = 0x00;
+				}
+				io->inner.length = 4;
+				return true;
+			case HID_DT_REPORT:
+				if (!script.hid_report_len)
+					return false;
+				memcpy(&io->data[0], &script.hid_report[0],
+							script.hid_report_len);
+				io->inner.length = script.hid_report_len;
+				return true;
+			default:
+				return false;
+			}
+			break;
+		case USB_REQ_SET_CONFIGURATION:
+			ep_int_in = usb_raw_ep_enable(fd, &usb_endpoint);
+			input_latency_track_ep(ep_int_in);
+			int rv = pthread_create(&ep_int_in_thread, 0,
+					ep_int_in_loop, (void *)(long)fd);
+			if (rv != 0) {
+				perror("pthread_create(ep_int_in)");
+				exit(EXIT_FAILURE);
+			}
+			usb_raw_vbus_draw(fd, usb_config.bMaxPower);
+			usb_raw_configure(fd);
+			io->inner.length = 0;
+
+			atomic_store(&ep_int_in_en, true);
+			return true;
+		default:
+			return false;
+		}
+		break;
+	case USB_TYPE_CLASS:
+	case USB_TYPE_VENDOR:
+		// Tablet drivers program the device with SET_REPORT or
+		// vendor requests during probe; accept them all.
+		if (event->ctrl.wLength > sizeof(io->data))
+			return false;
+		memset(&io->data[0], 0, event->ctrl.wLength);
+		io->inner.length = event->ctrl.wLength;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Runs in its own thread: tablet drivers keep issuing control requests
+// after SET_CONFIGURATION, while the main thread waits for the stream.
+void *ep0_loop(void *arg) {
+	int fd = (int)(long)arg;
+
+	while (true) {
+		struct usb_raw_control_event event;
+		event.inner.type = 0;
+		event.inner.length = sizeof(event.ctrl);
+		usb_raw_event_fetch(fd, (struct usb_raw_event *)&event);
+		log_event((struct usb_raw_event *)&event);
+
+		if (event.inner.type == USB_RAW_EVENT_CONNECT) {
+			process_eps_info(fd);
+			continue;
+		}
+
+		if (event.inner.type != USB_RAW_EVENT_CONTROL)
+			continue;
+
+		struct usb_raw_control_io io;
+		io.inner.ep = 0;
+		io.inner.flags = 0;
+		io.inner.length = 0;
+
+		bool reply = ep0_request(fd, &event, &io);
+		if (!reply) {
+			printf("ep0: stalling\n");
+			usb_raw_ep0_stall(fd);
+			continue;
+		}
+
+		if (event.ctrl.wLength < io.inner.length)
+			io.inner.length = event.ctrl.wLength;
+
+		if (event.ctrl.bRequestType & USB_DIR_IN) {
+			int rv = usb_raw_ep0_write(fd, (struct usb_raw_ep_io *)&io);
+			printf("ep0: transferred %d bytes (in)\n", rv);
+		} else {
+			int rv = usb_raw_ep0_read(fd, (struct usb_raw_ep_io *)&io);
+			printf("ep0: transferred %d bytes (out)\n", rv);
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	const char *device = "dummy_udc.0";
+	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
+	if (argc < 2) {
+		printf("usage: %s [--latency] <script.tab>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	script_load(argv[1]);
+	apply_script_descriptors();
+
+	int fd = usb_raw_open();
+	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
+	usb_raw_run(fd);
+
+	if (usb_gadget_opts.input_latency)
+		input_latency_start(script.vendor, script.product);
+
+	pthread_t ep0_thread;
+	int rv = pthread_create(&ep0_thread, 0, ep0_loop, (void *)(long)fd);
+	if (rv != 0) {
+		perror("pthread_create(ep0)");
+		exit(EXIT_FAILURE);
+	}
+
+	time_t start_time = time(NULL);
+	while (!atomic_load(&stream_done) &&
+			difftime(time(NULL), start_time) < script.timeout_sec)
+		usleep(10000); // 10 ms
+	if (!atomic_load(&stream_done))
+		printf("[script] timeout after %u s\n", script.timeout_sec);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	input_latency_report();
+
+	close(fd);
+
+	return 0;
+}
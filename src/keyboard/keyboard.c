@@ -15,26 +15,7 @@
 //
 // Vasiliy Kovalev <kovalev@altlinux.org>
 
-#include "../usb_gadget_tests.h"
-
-/*----------------------------------------------------------------------*/
-
-#include <linux/hid.h>
-
-struct hid_class_descriptor {
-	__u8  bDescriptorType;
-	__le16 wDescriptorLength;
-} __attribute__ ((packed));
-
-struct hid_descriptor {
-	__u8  bLength;
-	__u8  bDescriptorType;
-	__le16 bcdHID;
-	__u8  bCountryCode;
-	__u8  bNumDescriptors;
-
-	struct hid_class_descriptor desc[1];
-} __attribute__ ((packed));
+#include "../usb_functions.h"
 
 /*----------------------------------------------------------------------*/
 
@@ -120,9 +101,6 @@ void log_control_request(struct usb_ctrlrequest *ctrl) {
 #define EP_MAX_PACKET_CONTROL	64
 #define EP_MAX_PACKET_INT	8
 
-// Assigned dynamically.
-#define EP_NUM_INT_IN	0x0
-
 struct usb_device_descriptor usb_device = {
 	.bLength =		USB_DT_DEVICE_SIZE,
 	.bDescriptorType =	USB_DT_DEVICE,
@@ -151,76 +129,6 @@ struct usb_config_descriptor usb_config = {
 	.bMaxPower =		0x32,
 };
 
-struct usb_interface_descriptor usb_interface = {
-	.bLength =		USB_DT_INTERFACE_SIZE,
-	.bDescriptorType =	USB_DT_INTERFACE,
-	.bInterfaceNumber =	0,
-	.bAlternateSetting =	0,
-	.bNumEndpoints =	1,
-	.bInterfaceClass =	USB_CLASS_HID,
-	.bInterfaceSubClass =	1,
-	.bInterfaceProtocol =	1,
-	.iInterface =		STRING_ID_INTERFACE,
-};
-
-struct usb_endpoint_descriptor usb_endpoint = {
-	.bLength =		USB_DT_ENDPOINT_SIZE,
-	.bDescriptorType =	USB_DT_ENDPOINT,
-	.bEndpointAddress =	USB_DIR_IN | EP_NUM_INT_IN,
-	.bmAttributes =		USB_ENDPOINT_XFER_INT,
-	.wMaxPacketSize =	EP_MAX_PACKET_INT,
-	.bInterval =		5,
-};
-
-char usb_hid_report[] = {
-	0x05, 0x01,                    // Usage Page (Generic Desktop)        0
-	0x09, 0x06,                    // Usage (Keyboard)                    2
-	0xa1, 0x01,                    // Collection (Application)            4
-	0x05, 0x07,                    //  Usage Page (Keyboard)              6
-	0x19, 0xe0,                    //  Usage Minimum (224)                8
-	0x29, 0xe7,                    //  Usage Maximum (231)                10
-	0x15, 0x00,                    //  Logical Minimum (0)                12
-	0x25, 0x01,                    //  Logical Maximum (1)                14
-	0x75, 0x01,                    //  Report Size (1)                    16
-	0x95, 0x08,                    //  Report Count (8)                   18
-	0x81, 0x02,                    //  Input (Data,Var,Abs)               20
-	0x95, 0x01,                    //  Report Count (1)                   22
-	0x75, 0x08,                    //  Report Size (8)                    24
-	0x81, 0x01,                    //  Input (Cnst,Arr,Abs)               26
-	0x95, 0x03,                    //  Report Count (3)                   28
-	0x75, 0x01,                    //  Report Size (1)                    30
-	0x05, 0x08,                    //  Usage Page (LEDs)                  32
-	0x19, 0x01,                    //  Usage Minimum (1)                  34
-	0x29, 0x03,                    //  Usage Maximum (3)                  36
-	0x91, 0x02,                    //  Output (Data,Var,Abs)              38
-	0x95, 0x05,                    //  Report Count (5)                   40
-	0x75, 0x01,                    //  Report Size (1)                    42
-	0x91, 0x01,                    //  Output (Cnst,Arr,Abs)              44
-	0x95, 0x06,                    //  Report Count (6)                   46
-	0x75, 0x08,                    //  Report Size (8)                    48
-	0x15, 0x00,                    //  Logical Minimum (0)                50
-	0x26, 0xff, 0x00,              //  Logical Maximum (255)              52
-	0x05, 0x07,                    //  Usage Page (Keyboard)              55
-	0x19, 0x00,                    //  Usage Minimum (0)                  57
-	0x2a, 0xff, 0x00,              //  Usage Maximum (255)                59
-	0x81, 0x00,                    //  Input (Data,Arr,Abs)               62
-	0xc0,                          // End Collection                      64
-};
-
-struct hid_descriptor usb_hid = {
-	.bLength =		9,
-	.bDescriptorType =	HID_DT_HID,
-	.bcdHID =		__constant_cpu_to_le16(0x0110),
-	.bCountryCode =		0,
-	.bNumDescriptors =	1,
-	.desc =			{
-		{
-			.bDescriptorType =	HID_DT_REPORT,
-			.wDescriptorLength =	sizeof(usb_hid_report),
-		}
-	},
-};
-
 int build_config(char *data, int length, bool other_speed) {
 	struct usb_config_descriptor *config =
 		(struct usb_config_descriptor *)data;
@@ -232,20 +140,22 @@ int build_config(char *data, int length, bool other_speed) {
 	length -= sizeof(usb_config);
 	total_length += sizeof(usb_config);
 
-	assert(length >= sizeof(usb_interface));
-	memcpy(data, &usb_interface, sizeof(usb_interface));
-	data += sizeof(usb_interface);
-	length -= sizeof(usb_interface);
-	total_length += sizeof(usb_interface);
+	assert(length >= sizeof(keyboard_function.interface));
+	memcpy(data, &keyboard_function.interface,
+					sizeof(keyboard_function.interface));
+	data += sizeof(keyboard_function.interface);
+	length -= sizeof(keyboard_function.interface);
+	total_length += sizeof(keyboard_function.interface);
 
-	assert(length >= sizeof(usb_hid));
-	memcpy(data, &usb_hid, sizeof(usb_hid));
-	data += sizeof(usb_hid);
-	length -= sizeof(usb_hid);
-	total_length += sizeof(usb_hid);
+	assert(length >= keyboard_function.class_desc_len);
+	memcpy(data, keyboard_function.class_desc,
+					keyboard_function.class_desc_len);
+	data += keyboard_function.class_desc_len;
+	length -= keyboard_function.class_desc_len;
+	total_length += keyboard_function.class_desc_len;
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &keyboard_function.eps[0], USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
@@ -316,11 +226,11 @@ void process_eps_info(int fd) {
 
 */
 	for (int i = 0; i < num; i++) {
-		if (assign_ep_address(&info.eps[i], &usb_endpoint))
+		if (assign_ep_address(&info.eps[i], &keyboard_function.eps[0]))
 			continue;
 	}
 
-	int ep_int_in_addr = usb_endpoint_num(&usb_endpoint);
+	int ep_int_in_addr = usb_endpoint_num(&keyboard_function.eps[0]);
 	assert(ep_int_in_addr != 0);
 //	printf("ep_int_in: addr = %u\n", ep_int_in_addr);
 }
@@ -360,8 +270,8 @@ void *ep_int_in_loop(void *arg) {
 
 	while (!atomic_load(&key_en));
 	while (true) {
-		memcpy(&io.inner.data[0],
-				"\x00\x00\x1b\x00\x00\x00\x00\x00", 8);
+		// 'x' down
+		memcpy(&io.inner.data[0], keyboard_hid.reports[0], 8);
 		int rv = usb_raw_ep_write_may_fail(fd,
 						(struct usb_raw_ep_io *)&io);
 		if (rv < 0 && errno == ESHUTDOWN) {
@@ -373,8 +283,8 @@ void *ep_int_in_loop(void *arg) {
 		}
 		// printf("ep_int_in: key down: %d\n", rv);
 
-		memcpy(&io.inner.data[0],
-				"\x00\x00\x00\x00\x00\x00\x00\x00", 8);
+		// All keys up
+		memcpy(&io.inner.data[0], keyboard_hid.reports[1], 8);
 		rv = usb_raw_ep_write_may_fail(fd, (struct usb_raw_ep_io *)&io);
 		if (rv < 0 && errno == ESHUTDOWN) {
 			printf("ep_int_in: device was likely reset, exiting\n");
@@ -423,9 +333,9 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 				io->inner.length = 4;
 				return true;
 			case HID_DT_REPORT:
-				memcpy(&io->data[0], &usb_hid_report[0],
-							sizeof(usb_hid_report));
-				io->inner.length = sizeof(usb_hid_report);
+				memcpy(&io->data[0], keyboard_hid.report_desc,
+						keyboard_hid.report_desc_len);
+				io->inner.length = keyboard_hid.report_desc_len;
 				// Last request
 				if (event->ctrl.wValue == 0x2200)
 					atomic_store(&ep0_request_end, true);
@@ -436,7 +346,9 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			}
 			break;
 		case USB_REQ_SET_CONFIGURATION:
-			ep_int_in = usb_raw_ep_enable(fd, &usb_endpoint);
+			ep_int_in = usb_raw_ep_enable(fd,
+						&keyboard_function.eps[0]);
+			input_latency_track_ep(ep_int_in);
 			printf("ep0: ep_int_in enabled: %d\n", ep_int_in);
 			int rv = pthread_create(&ep_int_in_thread, 0,
 					ep_int_in_loop, (void *)(long)fd);
@@ -543,6 +455,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2)
 		device = argv[1];
 	if (argc >= 3)
@@ -552,7 +466,13 @@ int main(int argc, char **argv) {
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
+	if (usb_gadget_opts.input_latency)
+		input_latency_start(USB_VENDOR, USB_PRODUCT);
+
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	input_latency_report();
 
 	close(fd);
 
@@ -11,26 +11,7 @@
 //
 // Vasiliy Kovalev <kovalev@altlinux.org>
 
-#include "../usb_gadget_tests.h"
-
-/*----------------------------------------------------------------------*/
-
-#include <linux/hid.h>
-
-struct hid_class_descriptor {
-	__u8  bDescriptorType;
-	__le16 wDescriptorLength;
-} __attribute__ ((packed));
-
-struct hid_descriptor {
-	__u8  bLength;
-	__u8  bDescriptorType;
-	__le16 bcdHID;
-	__u8  bCountryCode;
-	__u8  bNumDescriptors;
-
-	struct hid_class_descriptor desc[1];
-} __attribute__ ((packed));
+#include "../usb_functions.h"
 
 /*----------------------------------------------------------------------*/
 
@@ -116,9 +97,6 @@ void log_control_request(struct usb_ctrlrequest *ctrl) {
 #define EP_MAX_PACKET_CONTROL	8
 #define EP_MAX_PACKET_INT	4
 
-// Assigned dynamically.
-#define EP_NUM_INT_IN	0x0
-
 struct usb_device_descriptor usb_device = {
 	.bLength =		USB_DT_DEVICE_SIZE,
 	.bDescriptorType =	USB_DT_DEVICE,
@@ -147,71 +125,6 @@ struct usb_config_descriptor usb_config = {
 	.bMaxPower =		0x32,
 };
 
-struct usb_interface_descriptor usb_interface = {
-	.bLength =		USB_DT_INTERFACE_SIZE,
-	.bDescriptorType =	USB_DT_INTERFACE,
-	.bInterfaceNumber =	0,
-	.bAlternateSetting =	0,
-	.bNumEndpoints =	1,
-	.bInterfaceClass =	USB_CLASS_HID,
-	.bInterfaceSubClass =	1,
-	.bInterfaceProtocol =	2,	// Mouse
-	.iInterface =		STRING_ID_INTERFACE,
-};
-
-struct usb_endpoint_descriptor usb_endpoint = {
-	.bLength =		USB_DT_ENDPOINT_SIZE,
-	.bDescriptorType =	USB_DT_ENDPOINT,
-	.bEndpointAddress =	USB_DIR_IN | EP_NUM_INT_IN,
-	.bmAttributes =		USB_ENDPOINT_XFER_INT,
-	.wMaxPacketSize =	EP_MAX_PACKET_INT,
-	.bInterval =		10,
-};
-
-char usb_hid_report[] = {
-	0x05, 0x01,                    // Usage Page (Generic Desktop)		0
-	0x09, 0x02,                    // Usage (Mouse)				2
-	0xa1, 0x01,                    // Collection (Application)		4
-	0x09, 0x01,                    //  Usage (Pointer)			6
-	0xa1, 0x00,                    //    Collection (Physical)		8
-	0x05, 0x09,                    //      Usage Page (Buttons)		10
-	0x19, 0x01,                    //      Usage Minimum (1)		12
-	0x29, 0x03,                    //      Usage Maximum (3)		14
-	0x15, 0x00,                    //      Logical Minimum (0)		16
-	0x25, 0x01,                    //      Logical Maximum (1)		18
-	0x75, 0x01,                    //      Report Size (1)			20
-	0x95, 0x03,                    //      Report Count (3)			22
-	0x81, 0x02,                    //      Input (Data,Var,Abs)		24
-	0x75, 0x05,                    //      Report Size (5)			26
-	0x95, 0x01,                    //      Report Count (1)			28
-	0x81, 0x01,                    //      Input (Cnst,Arr,Abs)		30
-	0x05, 0x01,                    //      Usage Page (Generic Desktop)	32
-	0x09, 0x30,                    //      Usage (X)			34
-	0x09, 0x31,                    //      Usage (Y)			36
-	0x09, 0x38,                    //      Usage (Wheel)			38
-	0x15, 0x81,                    //      Logical Minimum (-127)		40
-	0x25, 0x7f,                    //      Logical Maximum (127)		42
-	0x75, 0x08,                    //      Report Size (8)			44
-	0x95, 0x03,                    //      Report Count (3)			46
-	0x81, 0x06,                    //      Input (Data,Var,Rel)		48
-	0xc0,                          //    End Collection			50
-	0xc0,                          // End Collection			51
-};
-
-struct hid_descriptor usb_hid = {
-	.bLength =		9,
-	.bDescriptorType =	HID_DT_HID,
-	.bcdHID =		__constant_cpu_to_le16(0x0111), // bcdHID = 1.11 -> 0x0111
-	.bCountryCode =		0,
-	.bNumDescriptors =	1,
-	.desc =			{
-		{
-			.bDescriptorType =	HID_DT_REPORT,
-			.wDescriptorLength =	sizeof(usb_hid_report),
-		}
-	},
-};
-
 int build_config(char *data, int length, bool other_speed) {
 	struct usb_config_descriptor *config =
 		(struct usb_config_descriptor *)data;
@@ -223,20 +136,22 @@ int build_config(char *data, int length, bool other_speed) {
 	length -= sizeof(usb_config);
 	total_length += sizeof(usb_config);
 
-	assert(length >= sizeof(usb_interface));
-	memcpy(data, &usb_interface, sizeof(usb_interface));
-	data += sizeof(usb_interface);
-	length -= sizeof(usb_interface);
-	total_length += sizeof(usb_interface);
+	assert(length >= sizeof(mouse_function.interface));
+	memcpy(data, &mouse_function.interface,
+					sizeof(mouse_function.interface));
+	data += sizeof(mouse_function.interface);
+	length -= sizeof(mouse_function.interface);
+	total_length += sizeof(mouse_function.interface);
 
-	assert(length >= sizeof(usb_hid));
-	memcpy(data, &usb_hid, sizeof(usb_hid));
-	data += sizeof(usb_hid);
-	length -= sizeof(usb_hid);
-	total_length += sizeof(usb_hid);
+	assert(length >= mouse_function.class_desc_len);
+	memcpy(data, mouse_function.class_desc,
+					mouse_function.class_desc_len);
+	data += mouse_function.class_desc_len;
+	length -= mouse_function.class_desc_len;
+	total_length += mouse_function.class_desc_len;
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &mouse_function.eps[0], USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
@@ -307,11 +222,11 @@ void process_eps_info(int fd) {
 
 */
 	for (int i = 0; i < num; i++) {
-		if (assign_ep_address(&info.eps[i], &usb_endpoint))
+		if (assign_ep_address(&info.eps[i], &mouse_function.eps[0]))
 			continue;
 	}
 
-	int ep_int_in_addr = usb_endpoint_num(&usb_endpoint);
+	int ep_int_in_addr = usb_endpoint_num(&mouse_function.eps[0]);
 	assert(ep_int_in_addr != 0);
 //	printf("ep_int_in: addr = %u\n", ep_int_in_addr);
 }
@@ -462,9 +377,9 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 				io->inner.length = 4;
 				return true;
 			case HID_DT_REPORT:
-				memcpy(&io->data[0], &usb_hid_report[0],
-							sizeof(usb_hid_report));
-				io->inner.length = sizeof(usb_hid_report);
+				memcpy(&io->data[0], mouse_hid.report_desc,
+						mouse_hid.report_desc_len);
+				io->inner.length = mouse_hid.report_desc_len;
 				// Last request
 				if (event->ctrl.wValue == 0x2200)
 					atomic_store(&ep0_request_end, true);
@@ -475,7 +390,9 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			}
 			break;
 		case USB_REQ_SET_CONFIGURATION:
-			ep_int_in = usb_raw_ep_enable(fd, &usb_endpoint);
+			ep_int_in = usb_raw_ep_enable(fd,
+							&mouse_function.eps[0]);
+			input_latency_track_ep(ep_int_in);
 			printf("ep0: ep_int_in enabled: %d\n", ep_int_in);
 			int rv = pthread_create(&ep_int_in_thread, 0,
 					ep_int_in_loop, (void *)(long)fd);
@@ -582,6 +499,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2)
 		device = argv[1];
 	if (argc >= 3)
@@ -591,7 +510,13 @@ int main(int argc, char **argv) {
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
+	if (usb_gadget_opts.input_latency)
+		input_latency_start(USB_VENDOR, USB_PRODUCT);
+
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	input_latency_report();
 
 	close(fd);
 
@@ -17,12 +17,10 @@
 //
 // Vasiliy Kovalev <kovalev@altlinux.org>
 
-#include "../usb_gadget_tests.h"
+#include "../usb_functions.h"
 
 /*----------------------------------------------------------------------*/
 
-#define GET_DEVICE_ID		0
-
 void log_control_request(struct usb_ctrlrequest *ctrl) {
 	printf("  bRequestType: 0x%x (%s), bRequest: 0x%x, wValue: 0x%x,"
 		" wIndex: 0x%x, wLength: %d\n", ctrl->bRequestType,
@@ -103,10 +101,6 @@ void log_control_request(struct usb_ctrlrequest *ctrl) {
 #define EP_MAX_PACKET_CONTROL	64
 #define EP_MAX_PACKET_BULK	512
 
-// Assigned dynamically.
-#define EP_NUM_BULK_OUT	0x0
-#define EP_NUM_BULK_IN	0x0
-
 struct usb_device_descriptor usb_device = {
 	.bLength =		USB_DT_DEVICE_SIZE,
 	.bDescriptorType =	USB_DT_DEVICE,
@@ -135,34 +129,6 @@ struct usb_config_descriptor usb_config = {
 	.bMaxPower =		0x32,
 };
 
-struct usb_interface_descriptor usb_interface = {
-	.bLength =		USB_DT_INTERFACE_SIZE,
-	.bDescriptorType =	USB_DT_INTERFACE,
-	.bInterfaceNumber =	0,
-	.bAlternateSetting =	0,
-	.bNumEndpoints =	2,
-	.bInterfaceClass =	USB_CLASS_PRINTER,
-	.bInterfaceSubClass =	1,
-	.bInterfaceProtocol =	2,
-	.iInterface =		STRING_ID_INTERFACE,
-};
-
-struct usb_endpoint_descriptor usb_endpoint_bulk_out = {
-	.bLength =		USB_DT_ENDPOINT_SIZE,
-	.bDescriptorType =	USB_DT_ENDPOINT,
-	.bEndpointAddress =	USB_DIR_OUT | EP_NUM_BULK_OUT,
-	.bmAttributes =		USB_ENDPOINT_XFER_BULK,
-	.wMaxPacketSize =	EP_MAX_PACKET_BULK,
-};
-
-struct usb_endpoint_descriptor usb_endpoint_bulk_in = {
-	.bLength =		USB_DT_ENDPOINT_SIZE,
-	.bDescriptorType =	USB_DT_ENDPOINT,
-	.bEndpointAddress =	USB_DIR_IN | EP_NUM_BULK_IN,
-	.bmAttributes =		USB_ENDPOINT_XFER_BULK,
-	.wMaxPacketSize =	EP_MAX_PACKET_BULK,
-};
-
 int build_config(char *data, int length, bool other_speed) {
 	struct usb_config_descriptor *config =
 		(struct usb_config_descriptor *)data;
@@ -174,20 +140,21 @@ int build_config(char *data, int length, bool other_speed) {
 	length -= sizeof(usb_config);
 	total_length += sizeof(usb_config);
 
-	assert(length >= sizeof(usb_interface));
-	memcpy(data, &usb_interface, sizeof(usb_interface));
-	data += sizeof(usb_interface);
-	length -= sizeof(usb_interface);
-	total_length += sizeof(usb_interface);
+	assert(length >= sizeof(printer_function.interface));
+	memcpy(data, &printer_function.interface,
+					sizeof(printer_function.interface));
+	data += sizeof(printer_function.interface);
+	length -= sizeof(printer_function.interface);
+	total_length += sizeof(printer_function.interface);
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint_bulk_out, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &printer_function.eps[0], USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint_bulk_in, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &printer_function.eps[1], USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
@@ -255,17 +222,17 @@ void process_eps_info(int fd) {
 
 */
 	for (int i = 0; i < num; i++) {
-		if (assign_ep_address(&info.eps[i], &usb_endpoint_bulk_out))
+		if (assign_ep_address(&info.eps[i], &printer_function.eps[0]))
 			continue;
-		if (assign_ep_address(&info.eps[i], &usb_endpoint_bulk_in))
+		if (assign_ep_address(&info.eps[i], &printer_function.eps[1]))
 			continue;
 	}
 
-	int bulk_out_addr = usb_endpoint_num(&usb_endpoint_bulk_out);
+	int bulk_out_addr = usb_endpoint_num(&printer_function.eps[0]);
 	assert(bulk_out_addr != 0);
 //	printf("bulk_out: addr = %u\n", bulk_out_addr);
 
-	int bulk_in_addr = usb_endpoint_num(&usb_endpoint_bulk_in);
+	int bulk_in_addr = usb_endpoint_num(&printer_function.eps[1]);
 	assert(bulk_in_addr != 0);
 //	printf("bulk_in: addr = %u\n", bulk_in_addr);
 }
@@ -379,12 +346,12 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			// create threads twice.
 			if (ep_bulk_out == -1) {
 				ep_bulk_out = usb_raw_ep_enable(fd,
-							&usb_endpoint_bulk_out);
+						&printer_function.eps[0]);
 				printf("bulk_out: ep = #%d\n", ep_bulk_out);
 			}
 			if (ep_bulk_in == -1) {
 				ep_bulk_in = usb_raw_ep_enable(fd,
-							&usb_endpoint_bulk_in);
+						&printer_function.eps[1]);
 				printf("bulk_in: ep = #%d\n", ep_bulk_in);
 			}
 			if (!ep_bulk_out_thread)
@@ -406,10 +373,8 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 		switch (event->ctrl.bRequest) {
 		case GET_DEVICE_ID:
 		{
-			// Copy from linux/drivers/usb/gadget/legacy/printer.c
-			static char *pnp_string = "MFG:linux;MDL:g_printer;CLS:PRINTER;SN:1;";
-			int value = strlen(pnp_string);
-			memcpy(&io->data[0] + 2, pnp_string, value);
+			int value = strlen(printer_pnp_string);
+			memcpy(&io->data[0] + 2, printer_pnp_string, value);
 			value += 2;
 			io->data[0] = (value >> 8) & 0xFF;
 			io->data[1] = value & 0xFF;
@@ -484,6 +449,8 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2)
 		device = argv[1];
 	if (argc >= 3)
@@ -494,6 +461,7 @@ int main(int argc, char **argv) {
 	usb_raw_run(fd);
 
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
 
 	close(fd);
 
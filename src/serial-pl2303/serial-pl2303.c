@@ -7,6 +7,9 @@
 // Handles standard USB control requests (e.g., GET_DESCRIPTOR,
 // SET_CONFIGURATION) and PL2303-specific vendor (e.g., READ_REQUEST,
 // WRITE_REQUEST).
+// All per-device state lives in struct pl2303_instance, so with
+// --instances=N one process emulates N adapters on dummy_udc.0 ..
+// dummy_udc.N-1 (dummy_hcd loaded with num=N), one ep0 thread each.
 //
 // Vasiliy Kovalev <kovalev@altlinux.org>
 
@@ -200,7 +203,32 @@ struct usb_endpoint_descriptor usb_endpoint_int_in = {
 	.bInterval =		10,
 };
 
-int build_config(char *data, int length, bool other_speed) {
+struct pl2303_instance {
+	int fd;
+	char device[UDC_NAME_LENGTH_MAX];
+	pthread_t thread;
+
+	// Copies of the templates above with the addresses assigned to
+	// this instance.
+	struct usb_endpoint_descriptor endpoint_bulk_in;
+	struct usb_endpoint_descriptor endpoint_bulk_out;
+	struct usb_endpoint_descriptor endpoint_int_in;
+	int ep_addr_any;	// next number for USB_RAW_EP_ADDR_ANY
+
+	int ep_bulk_out;
+	int ep_bulk_in;
+	pthread_t ep_bulk_out_thread;
+	pthread_t ep_bulk_in_thread;
+	atomic_bool ep_bulk_out_en;
+	atomic_bool ep_bulk_in_en;
+	int ep_int_in;
+	pthread_t ep_int_in_thread;
+	atomic_bool ep_int_in_en;
+	atomic_bool ep0_request_end;
+};
+
+int build_config(struct pl2303_instance *inst, char *data, int length,
+			bool other_speed) {
 	struct usb_config_descriptor *config =
 		(struct usb_config_descriptor *)data;
 	int total_length = 0;
@@ -218,19 +246,19 @@ int build_config(char *data, int length, bool other_speed) {
 	total_length += sizeof(usb_interface);
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint_bulk_out, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &inst->endpoint_bulk_out, USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint_bulk_in, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &inst->endpoint_bulk_in, USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
 
 	assert(length >= USB_DT_ENDPOINT_SIZE);
-	memcpy(data, &usb_endpoint_int_in, USB_DT_ENDPOINT_SIZE);
+	memcpy(data, &inst->endpoint_int_in, USB_DT_ENDPOINT_SIZE);
 	data += USB_DT_ENDPOINT_SIZE;
 	length -= USB_DT_ENDPOINT_SIZE;
 	total_length += USB_DT_ENDPOINT_SIZE;
@@ -243,7 +271,8 @@ int build_config(char *data, int length, bool other_speed) {
 
 /*----------------------------------------------------------------------*/
 
-bool assign_ep_address(struct usb_raw_ep_info *info,
+bool assign_ep_address(struct pl2303_instance *inst,
+				struct usb_raw_ep_info *info,
 				struct usb_endpoint_descriptor *ep) {
 	if (usb_endpoint_num(ep) != 0)
 		return false;  // Already assigned.
@@ -265,36 +294,38 @@ bool assign_ep_address(struct usb_raw_ep_info *info,
 	default:
 		assert(false);
 	}
-	if (info->addr == USB_RAW_EP_ADDR_ANY) {
-		static int addr = 1;
-		ep->bEndpointAddress |= addr++;
-	} else
+	if (info->addr == USB_RAW_EP_ADDR_ANY)
+		ep->bEndpointAddress |= inst->ep_addr_any++;
+	else
 		ep->bEndpointAddress |= info->addr;
 	return true;
 }
 
-void process_eps_info(int fd) {
+void process_eps_info(struct pl2303_instance *inst) {
 	struct usb_raw_eps_info info;
 	memset(&info, 0, sizeof(info));
 
-	int num = usb_raw_eps_info(fd, &info);
+	int num = usb_raw_eps_info(inst->fd, &info);
 
 	for (int i = 0; i < num; i++) {
-		if (assign_ep_address(&info.eps[i], &usb_endpoint_bulk_out))
+		if (assign_ep_address(inst, &info.eps[i],
+					&inst->endpoint_bulk_out))
 			continue;
-		if (assign_ep_address(&info.eps[i], &usb_endpoint_bulk_in))
+		if (assign_ep_address(inst, &info.eps[i],
+					&inst->endpoint_bulk_in))
 			continue;
-		if (assign_ep_address(&info.eps[i], &usb_endpoint_int_in))
+		if (assign_ep_address(inst, &info.eps[i],
+					&inst->endpoint_int_in))
 			continue;
 	}
 
-	int bulk_out_addr = usb_endpoint_num(&usb_endpoint_bulk_out);
+	int bulk_out_addr = usb_endpoint_num(&inst->endpoint_bulk_out);
 	assert(bulk_out_addr != 0);
 
-	int bulk_in_addr = usb_endpoint_num(&usb_endpoint_bulk_in);
+	int bulk_in_addr = usb_endpoint_num(&inst->endpoint_bulk_in);
 	assert(bulk_in_addr != 0);
 
-	int ep_int_in_addr = usb_endpoint_num(&usb_endpoint_int_in);
+	int ep_int_in_addr = usb_endpoint_num(&inst->endpoint_int_in);
 	assert(ep_int_in_addr != 0);
 }
 
@@ -321,27 +352,18 @@ struct usb_raw_int_io {
 	char				data[EP_MAX_PACKET_INT];
 };
 
-int ep_bulk_out = -1;
-int ep_bulk_in  = -1;
-
-pthread_t ep_bulk_out_thread;
-pthread_t ep_bulk_in_thread;
-
-atomic_bool ep_bulk_out_en = ATOMIC_VAR_INIT(false);
-atomic_bool ep_bulk_in_en = ATOMIC_VAR_INIT(false);
-
 void *ep_bulk_out_loop(void *arg) {
-	int fd = (int)(long)arg;
+	struct pl2303_instance *inst = arg;
 	struct usb_raw_bulk_io io;
 
-	while (!atomic_load(&ep_bulk_out_en));
+	while (!atomic_load(&inst->ep_bulk_out_en));
 	while (true) {
-		assert(ep_bulk_out != -1);
-		io.inner.ep = ep_bulk_out;
+		assert(inst->ep_bulk_out != -1);
+		io.inner.ep = inst->ep_bulk_out;
 		io.inner.flags = 0;
 		io.inner.length = sizeof(io.data);
 
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
+		int rv = usb_raw_ep_read(inst->fd, (struct usb_raw_ep_io *)&io);
 		(void) rv; // printf("bulk_out: read %d bytes\n", rv);
 	}
 
@@ -349,20 +371,20 @@ void *ep_bulk_out_loop(void *arg) {
 }
 
 void *ep_bulk_in_loop(void *arg) {
-	int fd = (int)(long)arg;
+	struct pl2303_instance *inst = arg;
 	struct usb_raw_bulk_io io;
 
-	while (!atomic_load(&ep_bulk_in_en));
+	while (!atomic_load(&inst->ep_bulk_in_en));
 	while (true) {
-		assert(ep_bulk_in != -1);
-		io.inner.ep = ep_bulk_in;
+		assert(inst->ep_bulk_in != -1);
+		io.inner.ep = inst->ep_bulk_in;
 		io.inner.flags = 0;
 		io.inner.length = sizeof(io.data);
 
 		for (int i = 0; i < sizeof(io.data); i++)
 			io.data[i] = (i % EP_MAX_PACKET_BULK) % 63;
 
-		int rv = usb_raw_ep_write(fd, (struct usb_raw_ep_io *)&io);
+		int rv = usb_raw_ep_write(inst->fd, (struct usb_raw_ep_io *)&io);
 		(void) rv; // printf("bulk_in: wrote %d bytes\n", rv);
 
 		sleep(1);
@@ -371,11 +393,6 @@ void *ep_bulk_in_loop(void *arg) {
 	return NULL;
 }
 
-int ep_int_in = -1;
-pthread_t ep_int_in_thread;
-
-atomic_bool ep_int_in_en = ATOMIC_VAR_INIT(false);
-
 int ep_int_in_send_packet(int fd, struct usb_raw_int_io* io) {
 	int rv;
 
@@ -395,25 +412,26 @@ int ep_int_in_send_packet(int fd, struct usb_raw_int_io* io) {
 }
 
 void *ep_int_in_loop(void *arg) {
-	int fd = (int)(long)arg;
+	struct pl2303_instance *inst = arg;
 
 	struct usb_raw_int_io io;
-	io.inner.ep = ep_int_in;
+	io.inner.ep = inst->ep_int_in;
 	io.inner.flags = 0;
 	io.inner.length = EP_MAX_PACKET_INT;
 
-	while (!atomic_load(&ep_int_in_en));
+	while (!atomic_load(&inst->ep_int_in_en));
 	while(true){
 		sleep(1);
 		memcpy(&io.inner.data[0], "\x22\x10", 2);
-		ep_int_in_send_packet(fd,&io);
+		ep_int_in_send_packet(inst->fd, &io);
 	}
 }
 
-atomic_bool ep0_request_end = ATOMIC_VAR_INIT(false);
-
-bool ep0_request(int fd, struct usb_raw_control_event *event,
+bool ep0_request(struct pl2303_instance *inst,
+				struct usb_raw_control_event *event,
 				struct usb_raw_control_io *io) {
+	int fd = inst->fd;
+
 	switch (event->ctrl.bRequestType & USB_TYPE_MASK) {
 	case USB_TYPE_STANDARD:
 		switch (event->ctrl.bRequest) {
@@ -426,7 +444,7 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 				return true;
 			case USB_DT_CONFIG:
 				io->inner.length =
-					build_config(&io->data[0],
+					build_config(inst, &io->data[0],
 						sizeof(io->data), false);
 				return true;
 			case USB_DT_STRING:
@@ -447,27 +465,27 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			}
 			break;
 		case USB_REQ_SET_CONFIGURATION:
-			if (ep_bulk_out == -1) {
-				ep_bulk_out = usb_raw_ep_enable(fd,
-							&usb_endpoint_bulk_out);
+			if (inst->ep_bulk_out == -1) {
+				inst->ep_bulk_out = usb_raw_ep_enable(fd,
+						&inst->endpoint_bulk_out);
 			}
-			if (ep_bulk_in == -1) {
-				ep_bulk_in = usb_raw_ep_enable(fd,
-							&usb_endpoint_bulk_in);
+			if (inst->ep_bulk_in == -1) {
+				inst->ep_bulk_in = usb_raw_ep_enable(fd,
+						&inst->endpoint_bulk_in);
 			}
-			if (ep_int_in == -1) {
-				ep_int_in = usb_raw_ep_enable(fd,
-							&usb_endpoint_int_in);
+			if (inst->ep_int_in == -1) {
+				inst->ep_int_in = usb_raw_ep_enable(fd,
+						&inst->endpoint_int_in);
 			}
-			if (!ep_bulk_out_thread)
-				pthread_create(&ep_bulk_out_thread, 0,
-					       ep_bulk_out_loop, (void *)(long)fd);
-			if (!ep_bulk_in_thread)
-				pthread_create(&ep_bulk_in_thread, 0,
-					       ep_bulk_in_loop, (void *)(long)fd);
-			if (!ep_int_in_thread)
-				pthread_create(&ep_int_in_thread, 0,
-					       ep_int_in_loop, (void *)(long)fd);
+			if (!inst->ep_bulk_out_thread)
+				pthread_create(&inst->ep_bulk_out_thread, 0,
+					       ep_bulk_out_loop, inst);
+			if (!inst->ep_bulk_in_thread)
+				pthread_create(&inst->ep_bulk_in_thread, 0,
+					       ep_bulk_in_loop, inst);
+			if (!inst->ep_int_in_thread)
+				pthread_create(&inst->ep_int_in_thread, 0,
+					       ep_int_in_loop, inst);
 			usb_raw_vbus_draw(fd, usb_config.bMaxPower);
 			usb_raw_configure(fd);
 			io->inner.length = 0;
@@ -492,7 +510,7 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			switch (event->ctrl.wValue) {
 			case 0x2:
 				// Last request
-				atomic_store(&ep0_request_end, true);
+				atomic_store(&inst->ep0_request_end, true);
 			case 0x0404:
 			case 0x0:
 			case 0x1:
@@ -532,13 +550,15 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 	return false;
 }
 
-void ep0_loop(int fd) {
+void ep0_loop(struct pl2303_instance *inst) {
+	int fd = inst->fd;
+
 	while (true) {
-		if (atomic_load(&ep0_request_end)) {
+		if (atomic_load(&inst->ep0_request_end)) {
 			// Prep for later
-			// atomic_store(&ep_bulk_out_en, true);
-			// atomic_store(&ep_bulk_in_en, true);
-			// atomic_store(&ep_int_in_en, true);
+			// atomic_store(&inst->ep_bulk_out_en, true);
+			// atomic_store(&inst->ep_bulk_in_en, true);
+			// atomic_store(&inst->ep_int_in_en, true);
 
 			sleep(1);
 			// Exit
@@ -550,7 +570,7 @@ void ep0_loop(int fd) {
 		usb_raw_event_fetch(fd, (struct usb_raw_event *)&event);
 		log_event((struct usb_raw_event *)&event);
 		if (event.inner.type == USB_RAW_EVENT_CONNECT) {
-			process_eps_info(fd);
+			process_eps_info(inst);
 			continue;
 		}
 
@@ -561,7 +581,7 @@ void ep0_loop(int fd) {
 		io.inner.ep = 0;
 		io.inner.flags = 0;
 		io.inner.length = 0;
-		bool reply = ep0_request(fd, &event, &io);
+		bool reply = ep0_request(inst, &event, &io);
 		if (!reply) {
 			printf("ep0: stalling\n");
 			usb_raw_ep0_stall(fd);
@@ -580,17 +600,58 @@ void ep0_loop(int fd) {
 	}
 }
 
+void *ep0_thread(void *arg) {
+	ep0_loop(arg);
+	return NULL;
+}
+
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
 
-	int fd = usb_raw_open();
-	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
-	usb_raw_run(fd);
-
-	ep0_loop(fd);
+	usb_gadget_parse_args(&argc, argv);
+
+	int n = usb_gadget_instances();
+
+	struct pl2303_instance *insts = calloc(n, sizeof(*insts));
+	assert(insts);
+
+	// Bring the UDCs up one by one, then serve ep0 of each instance
+	// in its own thread (the first one in the main thread).
+	for (int i = 0; i < n; i++) {
+		struct pl2303_instance *inst = &insts[i];
+		inst->endpoint_bulk_in = usb_endpoint_bulk_in;
+		inst->endpoint_bulk_out = usb_endpoint_bulk_out;
+		inst->endpoint_int_in = usb_endpoint_int_in;
+		inst->ep_addr_any = 1;
+		inst->ep_bulk_out = -1;
+		inst->ep_bulk_in = -1;
+		inst->ep_int_in = -1;
+		usb_gadget_udc_name(device, i, inst->device,
+						sizeof(inst->device));
+		if (n > 1)
+			printf("instance %d: %s\n", i, inst->device);
+
+		inst->fd = usb_raw_open();
+		usb_raw_init(inst->fd, USB_SPEED_HIGH, driver, inst->device);
+		usb_raw_run(inst->fd);
+	}
 
-	close(fd);
+	for (int i = 1; i < n; i++) {
+		if (pthread_create(&insts[i].thread, 0, ep0_thread,
+							&insts[i]) != 0) {
+			perror("pthread_create(ep0)");
+			exit(EXIT_FAILURE);
+		}
+	}
+	ep0_loop(&insts[0]);
+	for (int i = 1; i < n; i++)
+		pthread_join(insts[i].thread, NULL);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	for (int i = 0; i < n; i++)
+		close(insts[i].fd);
+	free(insts);
 
 	return 0;
 }
@@ -25,328 +25,39 @@
 //
 // Vasiliy Kovalev <kovalev@altlinux.org>
 
-#include "../usb_gadget_tests.h"
+#include "../sisusbvga_emu.h"
 
-#include <dirent.h>
 
 /*----------------------------------------------------------------------*/
 
 static bool verbose = false;
 
-#define VLOG(...) do { if (verbose) printf(__VA_ARGS__); } while(0)
-
-static volatile bool keep_running = true;
-static volatile bool main_running = true;
 static volatile bool device_init = false;
 
-static bool strict_bounds_check = false;
-
 /*----------------------------------------------------------------------*/
 
-#define SISUSB_TYPE_MEM		0
-#define SISUSB_TYPE_IO		1
-
-#define SISUSB_PCI_IOPORTBASE	0x0000d000
-#define SISUSB_PCI_MEMBASE	0xd0000000
-
-#define PCI_CONFIG_SIZE		128
-#define PCI_BRIDGE_REG_SIZE	1024
-#define GFX_REG_SIZE		128
-
 #define VRAM_SIZE		8 * (1024 * 1024)		// 8 Mb
 
-#define RAM_TYPE_SDR		0x1
-#define RAM_TYPE_DDR		0x3
-#define RAM_TYPE		RAM_TYPE_SDR
-
-static uint32_t pci_config[PCI_CONFIG_SIZE]	= {0};
-static uint32_t bridge_reg[PCI_BRIDGE_REG_SIZE]	= {0};
-static uint32_t gfx_reg[GFX_REG_SIZE]		= {0};
-static uint8_t *vram = NULL;
-
-struct sisusb_packet {
-	unsigned short header;
-	uint32_t address;
-	uint32_t data;
-} __attribute__ ((__packed__));
-
-
-// SISSR 0x14 bits 2-3 (RAM Topology)
-#define SISUSB_RAM_1CH_1R	0x00 // 1 channel / 1 rank (1x)
-#define SISUSB_RAM_1CH_2R	0x01 // 1 channel / 2 rank (2x)
-#define SISUSB_RAM_ASYM		0x02 // Asymmetric (1.5x)
-#define SISUSB_RAM_2CH		0x03 // 2 channel (2x)
-#define SISUSB_RAM_CONFIG	SISUSB_RAM_1CH_1R
-
-uint8_t get_vram_config_reg(uint32_t size_bytes, uint8_t mode)
-{
-	uint32_t mb = size_bytes / (1024 * 1024);
-	uint8_t power = 0;
-
-	if (mb <= 0) return 0;
-
-	// Adjust base MB depending on topology mode
-	if (mode == SISUSB_RAM_ASYM) {
-		mb = (mb * 2) / 3; // Reverse 1.5x
-	} else if (mode == SISUSB_RAM_1CH_2R || mode == SISUSB_RAM_2CH) {
-		mb >>= 1; // Reverse 2x
-	}
-
-	// Find log2 of base MB
-	while (mb > 1) {
-		mb >>= 1;
-		power++;
-	}
-
-	// Bit 7-4: base size, Bit 3-2: mode, Bit 1-0: bus index
-	return (power << 4) | (mode << 2);
-}
-
-/*----------------------------------------------------------------------*/
-static struct {
-	uint32_t address;	// Target VRAM address
-	uint32_t length;	// Transfer length
-	uint32_t flags;		// Transfer flags
-	bool configured;	// Whether bulk transfer is configured
-} bulk_state = {0};
-
-void init_vram(void) {
-	vram = malloc(VRAM_SIZE);
-	if (!vram) {
-		printf("[ERROR] Failed to allocate VRAM!\n");
-		exit(1);
-	}
-	memset(vram, 0, VRAM_SIZE);
-	printf("[VRAM] Allocated %d MB of emulated VRAM\n", VRAM_SIZE / (1024*1024));
-}
-
-// Bulk write to VRAM - for SMALL bulk transfers (ep 0x01)
-void vram_bulk_write(uint32_t address, const uint8_t *data, uint32_t length) {
-	uint32_t base_addr = address - SISUSB_PCI_MEMBASE;
-	if (base_addr + length > VRAM_SIZE) {
-		VLOG("[WARNING] Bulk write would exceed VRAM bounds, truncating\n");
-		length = 0;
-	}
-
-	if (length > 0) {
-		memcpy(&vram[base_addr], data, length);
-		VLOG("  BULK WRITE VRAM[0x%08x] length=%u bytes\n", address, length);
-	}
-}
-
-uint32_t process_packet_bridge(struct sisusb_packet *pkt, bool is_read) {
-	uint16_t header = __le16_to_cpu(pkt->header);
-	uint32_t address = __le32_to_cpu(pkt->address);
-	uint32_t data = __le32_to_cpu(pkt->data);
-	uint32_t result = 0;
-	uint32_t reg_offset = address / 4;
-
-	VLOG("[BRIDGE] header=0x%04x, addr=0x%08x, data=0x%08x, %s\n",
-	     header, address, data, is_read ? "READ" : "WRITE");
-
-	// Bridge packets typically have header 0x001f
-	if (header != 0x001f && header != 0x000f) {
-		printf("[WARNING] Unexpected bridge packet header: 0x%04x\n", header);
-	}
-
-	if (reg_offset >= PCI_BRIDGE_REG_SIZE) {
-		printf("[WARNING] Bridge register offset 0x%x out of bounds\n", reg_offset);
-		return 0;
-	}
-
-	if (is_read) {
-		result = bridge_reg[reg_offset];
-		VLOG("  READ BRIDGE[0x%03x] = 0x%08x\n", address, result);
-	} else {
-		bridge_reg[reg_offset] = data;
-		VLOG("  WRITE BRIDGE[0x%03x] = 0x%08x\n", address, data);
-
-		// Handle bulk transfer configuration registers
-		switch (address) {
-		case 0x194:	// Small bulk: address register
-		case 0x1d4:	// Large bulk: address register
-			bulk_state.address = data;
-			VLOG("  [BULK CONFIG] Address = 0x%08x\n", data);
-			break;
-
-		case 0x190:	// Small bulk: length register
-		case 0x1d0:	// Large bulk: length register
-			bulk_state.length = data;
-			VLOG("  [BULK CONFIG] Length = %u bytes\n", data);
-			break;
-
-		case 0x180:	// Small bulk: flags/command register
-		case 0x1c0:	// Large bulk: flags/command register
-			bulk_state.flags = data;
-			bulk_state.configured = true;
-			VLOG("  [BULK CONFIG] Flags = 0x%08x, ready for transfer\n", data);
-			break;
-		}
-	}
-
-	return result;
-}
-
-uint32_t process_packet_gfx(struct sisusb_packet *pkt, bool is_read) {
-	uint16_t header = __le16_to_cpu(pkt->header);
-	uint32_t address = __le32_to_cpu(pkt->address);
-	uint32_t data = __le32_to_cpu(pkt->data);
-
-	uint32_t result = 0;
-
-	if (header == 0x008f) {
-		address = address & (PCI_CONFIG_SIZE - 1);
-		if (is_read) {
-			// sisusb_read_pci_config
-			result = pci_config[address];
-			VLOG("  READ PCI[0x%02x] = 0x%08x\n", address, result);
-		} else {
-			// sisusb_write_pci_config
-			pci_config[address] = data;
-			VLOG("  WRITE PCI[0x%02x] = 0x%08x\n", address, data);
-		}
-
-		return result;
-	}
-
-	// Initialize the graphics core
-	// https://elixir.bootlin.com/linux/v6.12.66/source/drivers/usb/misc/sisusbvga/sisusbvga.c#L2185
-
-	int type = (header >> 6) & 0x03;
-
-	if (type == SISUSB_TYPE_IO) {
-		uint32_t offset;
-		uint8_t low_bits = header & 0x0F;
-		static bool ramtype_req = false;
-		static bool vramsize_req = false;
-
-		if (low_bits == 8) offset = 3;
-		else if (low_bits == 4) offset = 2;
-		else if (low_bits == 2) offset = 1;
-		else offset = 0;
-
-		address = address & ~SISUSB_PCI_IOPORTBASE;
-		address = address + offset;
-
-		data = (data >> ((address & 3) << 3)) & 0xFF;
-
-		if (address < GFX_REG_SIZE) {
-			if (is_read) {
-				result = gfx_reg[address];
-				VLOG("  READ GFX REG IO[0x%02x] = 0x%08x\n", address, result);
-			} else {
-				gfx_reg[address] = data;
-				VLOG("  WRITE GFX REG IO[0x%02x] = 0x%08x\n", address, data);
-			}
-
-			// https://elixir.bootlin.com/linux/v6.12.66/source/drivers/usb/misc/sisusbvga/sisusbvga.c#L1894
-			if (ramtype_req) {
-				result = RAM_TYPE;
-				ramtype_req = false;
-			}
-
-			// https://elixir.bootlin.com/linux/v6.12.66/source/drivers/usb/misc/sisusbvga/sisusbvga.c#L2035
-			if (vramsize_req) {
-				result = get_vram_config_reg(VRAM_SIZE, SISUSB_RAM_CONFIG);
-				vramsize_req = false;
-			}
-
-			if (address == 0x44) {
-				if (data == 0x3a) {
-					ramtype_req = true;
-
-				} else if (data == 0x14) {
-					vramsize_req = true;
-				}
-			}
-
-			result = result << ((address & 3) << 3);
-		}
-	} else if (type == SISUSB_TYPE_MEM) {
-		uint8_t be_mask = header & 0x0F;
-		uint32_t base_addr = address - SISUSB_PCI_MEMBASE;
-		uint32_t vram_mask = VRAM_SIZE - 1;
-
-		if (is_read) {
-			result = 0;
-			for (int i = 0; i < 4; i++) {
-				if (be_mask & (1 << i)) {
-					uint32_t curr_addr = base_addr + i;
-
-					if (!strict_bounds_check)
-						 curr_addr &= vram_mask;
-
-					if (curr_addr < VRAM_SIZE) {
-						result |= (uint32_t)vram[curr_addr] << (i * 8);
-					} else {
-						printf("READ VRAM: Address [0x%08x] out of bounds\n", address);
-					}
-				}
-			}
-			VLOG("  READ VRAM[0x%08x] Mask[0x%x] = 0x%08x\n", address, be_mask, result);
-		} else {
-			for (int i = 0; i < 4; i++) {
-				if (be_mask & (1 << i)) {
-					uint32_t curr_addr = base_addr + i;
-
-					if (!strict_bounds_check)
-						 curr_addr &= vram_mask;
-
-					if (curr_addr < VRAM_SIZE) {
-						vram[curr_addr] = (uint8_t)(data >> (i * 8));
-					} else {
-						printf("WRITE VRAM: Address [0x%08x] out of bounds\n", address);
-					}
-				}
-			}
-			VLOG("  WRITE VRAM[0x%08x] Mask[0x%x] = 0x%08x\n", address, be_mask, data);
-
-			// Corner: (479*640*2) + (639*2) = 0x95FFE.
-			// Logic address 0x95FFE is packet 0x95FFC with mask 0xC.
-			// Triggers twice: horizontal and vertical line loops.
-			if (address == 0xd0095ffc && data == 0xf1000000) {
-				static int corner_hits = 0;
-				corner_hits++;
-
-				if (corner_hits == 1) {
-					printf("[Setup screen] Bottom-Horizontal Line Done\n");
-				}
-				else if (corner_hits == 2) {
-					printf("[Setup screen] Right-Vertical Line Done (Frame Complete)\n");
-					main_running = false;
-				}
-			}
-		}
-	} else {
-		printf("[ERROR] GFX: Unknown SISUSB_TYPE\n");
-	}
-
-	return result;
-}
+static const struct sisusb_emu_config sisusb_config = {
+	.vram_size =		VRAM_SIZE,
+	.ram_type =		RAM_TYPE_SDR,
+	.ram_topology =		SISUSB_RAM_1CH_1R,
+	.small_bulk =		true,
+	.large_bulk =		true,
+	.bulk_packet_reads =	true,
+	.bulk_drop_oob =	true,
+};
 
 /*----------------------------------------------------------------------*/
 /* Device File Operations Test */
 /*----------------------------------------------------------------------*/
 
-#define SISUSB_PCI_PSEUDO_MEMBASE	0x10000000
-#define SISUSB_PCI_PSEUDO_MMIOBASE	0x20000000
-#define SISUSB_PCI_PSEUDO_IOPORTBASE	0x0000d000
-#define SISUSB_PCI_PSEUDO_PCIBASE	0x00010000
+#define FIND_DEVICE_WAIT_MS	3000
 
+// The sisusbvga node (usbmisc class) of our device
 static int find_device(char *devpath, size_t maxlen) {
-	DIR *dir = opendir("/dev");
-	if (!dir) return -1;
-
-	struct dirent *entry;
-	while ((entry = readdir(dir)) != NULL) {
-		if (strncmp(entry->d_name, "sisusbvga", 9) == 0) {
-			snprintf(devpath, maxlen, "/dev/%s", entry->d_name);
-			closedir(dir);
-			return 0;
-		}
-	}
-	closedir(dir);
-	return -1;
+	return usb_dev_node_wait("usbmisc", "sisusbvga", devpath, maxlen,
+							FIND_DEVICE_WAIT_MS);
 }
 
 void test_static_analyzer_warning(void) {
@@ -614,7 +325,7 @@ void process_eps_info(int fd) {
 }
 
 /*----------------------------------------------------------------------*/
-/* Endpoint threads */
+/* Control endpoint */
 /*----------------------------------------------------------------------*/
 
 struct usb_raw_control_event {
@@ -627,187 +338,6 @@ struct usb_raw_control_io {
 	char				data[EP_MAX_PACKET_CONTROL];
 };
 
-struct usb_raw_bulk_io {
-	struct usb_raw_ep_io		inner;
-	char				data[EP_MAX_PACKET_BULK];
-};
-
-int ep_gfx_out = -1;
-int ep_gfx_in = -1;
-int ep_gfx_bulk_out = -1;
-int ep_gfx_lbulk_out = -1;
-int ep_bridge_out = -1;
-int ep_bridge_in = -1;
-
-pthread_t ep_bridge_thread;
-pthread_t ep_gfx_thread;
-pthread_t ep_bulk_thread;
-pthread_t ep_lbulk_thread;
-
-void *ep_bridge_loop(void *arg) {
-	int fd = (int)(long)arg;
-	struct usb_raw_bulk_io io;
-
-	VLOG("[THREAD] Bridge endpoint thread started\n");
-
-	while (keep_running) {
-		assert(ep_bridge_out != -1);
-		io.inner.ep = ep_bridge_out;
-		io.inner.flags = 0;
-		io.inner.length = sizeof(io.data);
-
-		VLOG("[BRIDGE] Waiting for data on ep#%d...\n", ep_bridge_out);
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
-		if (rv < 0) {
-			if (!keep_running) break;
-			VLOG("[BRIDGE] Read error: %d, errno=%d\n", rv, errno);
-			continue;
-		}
-
-		bool is_read = (rv == 6);
-
-		VLOG("[BRIDGE] *** RECEIVED %d bytes ***\n", rv);
-		if (rv >= 6) {
-			struct sisusb_packet *pkt = (struct sisusb_packet *)io.inner.data;
-			uint32_t result = process_packet_bridge(pkt, is_read);
-
-			if (is_read && ep_bridge_in != -1) {
-				io.inner.ep = ep_bridge_in;
-				io.inner.length = sizeof(struct sisusb_packet);
-
-				// write response data
-				*(int *)(io.inner.data) = result;
-				usb_raw_ep_write(fd, (struct usb_raw_ep_io *)&io);
-			}
-		}
-	}
-
-	VLOG("[THREAD] Bridge endpoint thread exiting\n");
-	return NULL;
-}
-
-void *ep_gfx_loop(void *arg) {
-	int fd = (int)(long)arg;
-	struct usb_raw_bulk_io io;
-
-	VLOG("[THREAD] GFX endpoint thread started\n");
-
-	while (keep_running) {
-		assert(ep_gfx_out != -1);
-		io.inner.ep = ep_gfx_out;
-		io.inner.flags = 0;
-		io.inner.length = sizeof(io.data);
-
-		VLOG("[GFX] Waiting for data on ep#%d...\n", ep_gfx_out);
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
-		if (rv < 0) {
-			if (!keep_running) break;
-			VLOG("[GFX] Read error: %d, errno=%d\n", rv, errno);
-			continue;
-		}
-
-		bool is_read = (rv == 6);
-
-		VLOG("[GFX] *** RECEIVED %d bytes ***\n", rv);
-		if (rv >= 6) {
-			struct sisusb_packet *pkt = (struct sisusb_packet *)io.inner.data;
-			uint32_t result = process_packet_gfx(pkt, is_read);
-
-			if (is_read && ep_gfx_in != -1) {
-				io.inner.ep = ep_gfx_in;
-				io.inner.length = sizeof(struct sisusb_packet);
-
-				// write response data
-				*(int *)(io.inner.data) = result;
-				usb_raw_ep_write(fd, (struct usb_raw_ep_io *)&io);
-			}
-		}
-	}
-
-	VLOG("[THREAD] GFX endpoint thread exiting\n");
-	return NULL;
-}
-
-void *ep_bulk_loop(void *arg) {
-	int fd = (int)(long)arg;
-	struct usb_raw_bulk_io io;
-
-	VLOG("[THREAD] Bulk endpoint (ep#%d) thread started\n", ep_gfx_bulk_out);
-
-	while (keep_running) {
-		assert(ep_gfx_bulk_out != -1);
-		io.inner.ep = ep_gfx_bulk_out;
-		io.inner.flags = 0;
-		io.inner.length = sizeof(io.data);
-
-		VLOG("[BULK] Waiting for data on ep#%d...\n", ep_gfx_bulk_out);
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
-		if (rv < 0) {
-			if (!keep_running) break;
-			printf("[BULK] Read error: %d, errno=%d\n", rv, errno);
-			continue;
-		}
-
-		// Write data to VRAM
-		vram_bulk_write(bulk_state.address, (uint8_t *)io.inner.data, rv);
-
-		// Update bulk state
-		bulk_state.address += rv;
-		bulk_state.length -= rv;
-
-		// Reset bulk state
-		if (bulk_state.configured && bulk_state.length == 0) {
-			bulk_state.configured = false;
-			bulk_state.address = 0;
-			bulk_state.flags = 0;
-			VLOG("   [BULK] Write data to VRAM OK\n");
-		}
-	}
-
-	VLOG("[THREAD] Bulk endpoint thread exiting\n");
-	return NULL;
-}
-
-void *ep_lbulk_loop(void *arg) {
-	int fd = (int)(long)arg;
-	struct usb_raw_bulk_io io;
-
-	VLOG("[THREAD] LBulk endpoint (ep#%d) thread started\n", ep_gfx_lbulk_out);
-
-	while (keep_running) {
-		assert(ep_gfx_lbulk_out != -1);
-		io.inner.ep = ep_gfx_lbulk_out;
-		io.inner.flags = 0;
-		io.inner.length = sizeof(io.data);
-
-		VLOG("[LBULK] Waiting for data on ep#%d...\n", ep_gfx_lbulk_out);
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
-		if (rv < 0) {
-			if (!keep_running) break;
-			printf("[LBULK] Read error: %d, errno=%d\n", rv, errno);
-			continue;
-		}
-
-		// Write data to VRAM
-		vram_bulk_write(bulk_state.address, (uint8_t *)io.inner.data, rv);
-
-		// Update bulk state
-		bulk_state.address += rv;
-		bulk_state.length -= rv;
-
-		// Reset bulk state
-		if (bulk_state.configured && bulk_state.length == 0) {
-			bulk_state.configured = false;
-			bulk_state.address = 0;
-			bulk_state.flags = 0;
-			VLOG("   [LBULK] Write data to VRAM OK\n");
-		}
-	}
-
-	VLOG("[THREAD] LBulk endpoint thread exiting\n");
-	return NULL;
-}
-
 bool ep0_request(int fd, struct usb_raw_control_event *event,
 				struct usb_raw_control_io *io) {
 	switch (event->ctrl.bRequestType & USB_TYPE_MASK) {
@@ -845,45 +375,38 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			}
 			break;
 		case USB_REQ_SET_CONFIGURATION:
-			if (ep_gfx_out == -1) {
-				ep_gfx_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_out == -1) {
+				sisusb_emu.ep.gfx_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_out);
-				printf("ep0: gfx_out = ep#%d\n", ep_gfx_out);
+				printf("ep0: gfx_out = ep#%d\n", sisusb_emu.ep.gfx_out);
 			}
-			if (ep_gfx_in == -1) {
-				ep_gfx_in = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_in == -1) {
+				sisusb_emu.ep.gfx_in = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_in);
-				printf("ep0: gfx_in = ep#%d\n", ep_gfx_in);
+				printf("ep0: gfx_in = ep#%d\n", sisusb_emu.ep.gfx_in);
 			}
-			if (ep_gfx_bulk_out == -1) {
-				ep_gfx_bulk_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_bulk_out == -1) {
+				sisusb_emu.ep.gfx_bulk_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_bulk_out);
-				printf("ep0: gfx_bulk_out = ep#%d\n", ep_gfx_bulk_out);
+				printf("ep0: gfx_bulk_out = ep#%d\n", sisusb_emu.ep.gfx_bulk_out);
 			}
-			if (ep_gfx_lbulk_out == -1) {
-				ep_gfx_lbulk_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_lbulk_out == -1) {
+				sisusb_emu.ep.gfx_lbulk_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_lbulk_out);
-				printf("ep0: gfx_lbulk_out = ep#%d\n", ep_gfx_lbulk_out);
+				printf("ep0: gfx_lbulk_out = ep#%d\n", sisusb_emu.ep.gfx_lbulk_out);
 			}
-			if (ep_bridge_out == -1) {
-				ep_bridge_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.bridge_out == -1) {
+				sisusb_emu.ep.bridge_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_bridge_out);
-				printf("ep0: bridge_out = ep#%d\n", ep_bridge_out);
+				printf("ep0: bridge_out = ep#%d\n", sisusb_emu.ep.bridge_out);
 			}
-			if (ep_bridge_in == -1) {
-				ep_bridge_in = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.bridge_in == -1) {
+				sisusb_emu.ep.bridge_in = usb_raw_ep_enable(fd,
 							&usb_endpoint_bridge_in);
-				printf("ep0: bridge_in = ep#%d\n", ep_bridge_in);
+				printf("ep0: bridge_in = ep#%d\n", sisusb_emu.ep.bridge_in);
 			}
 
-			pthread_create(&ep_bridge_thread, NULL, ep_bridge_loop,
-					(void *)(long)fd);
-			pthread_create(&ep_gfx_thread, NULL, ep_gfx_loop,
-					(void *)(long)fd);
-			pthread_create(&ep_bulk_thread, NULL, ep_bulk_loop,
-					(void *)(long)fd);
-			pthread_create(&ep_lbulk_thread, NULL, ep_lbulk_loop,
-					(void *)(long)fd);
+			sisusb_emu_start(fd);
 
 			usb_raw_vbus_draw(fd, usb_config.bMaxPower);
 			usb_raw_configure(fd);
@@ -945,7 +468,7 @@ void log_control_request(struct usb_ctrlrequest *ctrl) {
 }
 
 void ep0_loop(int fd) {
-	while(keep_running && !device_init) {
+	while(!sisusb_emu.stopping && !device_init) {
 		struct usb_raw_control_event event;
 		event.inner.type = 0;
 		event.inner.length = sizeof(event.ctrl);
@@ -986,7 +509,7 @@ void ep0_loop(int fd) {
 	}
 
 	while (1) {
-		if (!main_running)
+		if (sisusb_emu.screen_done)
 			break;
 		sleep(1);
 	}
@@ -1003,22 +526,22 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2)
 		if (!strcmp(argv[1], "--verbose"))
 			verbose = true;
 
-	init_vram();
+	sisusb_emu_init(&sisusb_config, verbose);
 
 	int fd = usb_raw_open();
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
 
-	if (vram) {
-		free(vram);
-		vram = NULL;
-	}
+	sisusb_emu_exit();
 
 	close(fd);
 
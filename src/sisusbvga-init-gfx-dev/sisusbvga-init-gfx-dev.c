@@ -14,9 +14,15 @@
 // core initialization (sisusb_init_gfxcore), as VGA IO register emulation
 // is not implemented.
 //
+// With --speed=full, the emulator instead tests device file
+// creation in /dev/sisusbvga* and verifies that the device correctly
+// rejects open() attempts (the driver requires USB 2.0 High-Speed or
+// higher for actual operation).
+//
 // Vasiliy Kovalev <kovalev@altlinux.org>
 
-#include "../usb_gadget_tests.h"
+#include "../sisusbvga_emu.h"
+
 
 /*----------------------------------------------------------------------*/
 
@@ -24,26 +30,16 @@ static bool verbose = false;
 
 #define VLOG(...) do { if (verbose) printf(__VA_ARGS__); } while(0)
 
-static volatile bool keep_running = true;
 static volatile bool device_init = false;
 
 /*----------------------------------------------------------------------*/
 
-#define PCI_CONFIG_SIZE		128
-#define PCI_BRIDGE_REG_SIZE	1024
-
 static uint32_t pci_config[PCI_CONFIG_SIZE]	= {0};
 static uint32_t bridge_reg[PCI_BRIDGE_REG_SIZE]	= {0};
 
-struct sisusb_packet {
-	unsigned short header;
-	uint32_t address;
-	uint32_t data;
-} __attribute__ ((__packed__));
-
 /*----------------------------------------------------------------------*/
 
-uint32_t process_packet_bridge(struct sisusb_packet *pkt, bool is_read) {
+static uint32_t dev_packet_bridge(struct sisusb_packet *pkt, bool is_read) {
 	uint16_t header = __le16_to_cpu(pkt->header);
 	uint32_t address = __le32_to_cpu(pkt->address);
 	uint32_t data = __le32_to_cpu(pkt->data);
@@ -76,7 +72,7 @@ uint32_t process_packet_bridge(struct sisusb_packet *pkt, bool is_read) {
 	return result;
 }
 
-uint32_t process_packet_gfx(struct sisusb_packet *pkt, bool is_read) {
+static uint32_t dev_packet_gfx(struct sisusb_packet *pkt, bool is_read) {
 	uint16_t header = __le16_to_cpu(pkt->header);
 	uint32_t address = __le32_to_cpu(pkt->address);
 	uint32_t data = __le32_to_cpu(pkt->data);
@@ -97,12 +93,18 @@ uint32_t process_packet_gfx(struct sisusb_packet *pkt, bool is_read) {
 	} else {
 		printf("Skip graphics core initialization\n");
 		// Stop and exit
-		keep_running = false;
+		sisusb_emu.stopping = true;
 	}
 
 	return result;
 }
 
+// Bridge registers and PCI configuration space only, no graphics core
+static const struct sisusb_emu_config sisusb_config = {
+	.bridge_packet =	dev_packet_bridge,
+	.gfx_packet =		dev_packet_gfx,
+};
+
 /*----------------------------------------------------------------------*/
 
 void log_control_request(struct usb_ctrlrequest *ctrl) {
@@ -149,6 +151,41 @@ void log_control_request(struct usb_ctrlrequest *ctrl) {
 	}
 }
 
+/*----------------------------------------------------------------------*/
+/* Device File Test */
+/*----------------------------------------------------------------------*/
+
+#define FIND_DEVICE_WAIT_MS	3000
+
+// The sisusbvga node (usbmisc class) of our device
+static int find_device(char *devpath, size_t maxlen) {
+	return usb_dev_node_wait("usbmisc", "sisusbvga", devpath, maxlen,
+							FIND_DEVICE_WAIT_MS);
+}
+
+static void test_open_close(void) {
+	char devpath[512];
+
+	printf("[TEST /dev/sisusbvga*] Attempting device open...\n");
+
+	if (find_device(devpath, sizeof(devpath)) != 0) {
+		printf("[TEST /dev/sisusbvga*] Device not found\n");
+		return;
+
+	}
+
+	printf("[TEST /dev/sisusbvga*] Device found\n");
+
+	int devfd = open(devpath, O_RDWR);
+
+	if (devfd < 0) {
+		printf("[TEST /dev/sisusbvga*] OK: Open failed (expected for FULL_SPEED)\n");
+	} else {
+		printf("[TEST /dev/sisusbvga*] ERR: Unexpected success\n");
+		close(devfd);
+	}
+}
+
 /*----------------------------------------------------------------------*/
 /* USB device descriptors */
 /*----------------------------------------------------------------------*/
@@ -373,7 +410,7 @@ void process_eps_info(int fd) {
 }
 
 /*----------------------------------------------------------------------*/
-/* Endpoint threads */
+/* Control endpoint */
 /*----------------------------------------------------------------------*/
 
 struct usb_raw_control_event {
@@ -386,105 +423,6 @@ struct usb_raw_control_io {
 	char				data[EP_MAX_PACKET_CONTROL];
 };
 
-struct usb_raw_bulk_io {
-	struct usb_raw_ep_io		inner;
-	char				data[EP_MAX_PACKET_BULK];
-};
-
-int ep_gfx_out = -1;
-int ep_gfx_in = -1;
-int ep_gfx_bulk_out = -1;
-int ep_gfx_lbulk_out = -1;
-int ep_bridge_out = -1;
-int ep_bridge_in = -1;
-
-pthread_t ep_bridge_thread;
-pthread_t ep_gfx_thread;
-
-void *ep_bridge_loop(void *arg) {
-	int fd = (int)(long)arg;
-	struct usb_raw_bulk_io io;
-
-	VLOG("[THREAD] Bridge endpoint thread started\n");
-
-	while (keep_running) {
-		assert(ep_bridge_out != -1);
-		io.inner.ep = ep_bridge_out;
-		io.inner.flags = 0;
-		io.inner.length = sizeof(io.data);
-
-		VLOG("[BRIDGE] Waiting for data on ep#%d...\n", ep_bridge_out);
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
-		if (rv < 0) {
-			if (!keep_running) break;
-			VLOG("[BRIDGE] Read error: %d, errno=%d\n", rv, errno);
-			continue;
-		}
-
-		bool is_read = (rv == 6);
-
-		VLOG("[BRIDGE] *** RECEIVED %d bytes ***\n", rv);
-		if (rv >= 6) {
-			struct sisusb_packet *pkt = (struct sisusb_packet *)io.inner.data;
-			uint32_t result = process_packet_bridge(pkt, is_read);
-
-			if (is_read && ep_bridge_in != -1) {
-				io.inner.ep = ep_bridge_in;
-				io.inner.length = sizeof(struct sisusb_packet);
-
-				// write response data
-				*(int *)(io.inner.data) = result;
-				usb_raw_ep_write(fd, (struct usb_raw_ep_io *)&io);
-			}
-		}
-	}
-
-	VLOG("[THREAD] Bridge endpoint thread exiting\n");
-	return NULL;
-}
-
-void *ep_gfx_loop(void *arg) {
-	int fd = (int)(long)arg;
-	struct usb_raw_bulk_io io;
-
-	VLOG("[THREAD] GFX endpoint thread started\n");
-
-	while (keep_running) {
-		assert(ep_gfx_out != -1);
-		io.inner.ep = ep_gfx_out;
-		io.inner.flags = 0;
-		io.inner.length = sizeof(io.data);
-
-		VLOG("[GFX] Waiting for data on ep#%d...\n", ep_gfx_out);
-		int rv = usb_raw_ep_read(fd, (struct usb_raw_ep_io *)&io);
-		if (rv < 0) {
-			if (!keep_running) break;
-			VLOG("[GFX] Read error: %d, errno=%d\n", rv, errno);
-			continue;
-		}
-
-		bool is_read = (rv == 6);
-
-		VLOG("[GFX] *** RECEIVED %d bytes ***\n", rv);
-		if (rv >= 6) {
-			struct sisusb_packet *pkt = (struct sisusb_packet *)io.inner.data;
-			uint32_t result = process_packet_gfx(pkt, is_read);
-
-			if (is_read && ep_gfx_in != -1) {
-				io.inner.ep = ep_gfx_in;
-				io.inner.length = sizeof(struct sisusb_packet);
-
-				// write response data
-				*(int *)(io.inner.data) = result;
-				usb_raw_ep_write(fd, (struct usb_raw_ep_io *)&io);
-			}
-		}
-	}
-
-	VLOG("[THREAD] GFX endpoint thread exiting\n");
-	return NULL;
-}
-
 bool ep0_request(int fd, struct usb_raw_control_event *event,
 				struct usb_raw_control_io *io) {
 	switch (event->ctrl.bRequestType & USB_TYPE_MASK) {
@@ -522,46 +460,38 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 			}
 			break;
 		case USB_REQ_SET_CONFIGURATION:
-			if (ep_gfx_out == -1) {
-				ep_gfx_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_out == -1) {
+				sisusb_emu.ep.gfx_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_out);
-				printf("ep0: gfx_out = ep#%d\n", ep_gfx_out);
+				printf("ep0: gfx_out = ep#%d\n", sisusb_emu.ep.gfx_out);
 			}
-			if (ep_gfx_in == -1) {
-				ep_gfx_in = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_in == -1) {
+				sisusb_emu.ep.gfx_in = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_in);
-				printf("ep0: gfx_in = ep#%d\n", ep_gfx_in);
+				printf("ep0: gfx_in = ep#%d\n", sisusb_emu.ep.gfx_in);
 			}
-			if (ep_gfx_bulk_out == -1) {
-				ep_gfx_bulk_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_bulk_out == -1) {
+				sisusb_emu.ep.gfx_bulk_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_bulk_out);
-				printf("ep0: gfx_bulk_out = ep#%d\n", ep_gfx_bulk_out);
+				printf("ep0: gfx_bulk_out = ep#%d\n", sisusb_emu.ep.gfx_bulk_out);
 			}
-			if (ep_gfx_lbulk_out == -1) {
-				ep_gfx_lbulk_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.gfx_lbulk_out == -1) {
+				sisusb_emu.ep.gfx_lbulk_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_gfx_lbulk_out);
-				printf("ep0: gfx_lbulk_out = ep#%d\n", ep_gfx_lbulk_out);
+				printf("ep0: gfx_lbulk_out = ep#%d\n", sisusb_emu.ep.gfx_lbulk_out);
 			}
-			if (ep_bridge_out == -1) {
-				ep_bridge_out = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.bridge_out == -1) {
+				sisusb_emu.ep.bridge_out = usb_raw_ep_enable(fd,
 							&usb_endpoint_bridge_out);
-				printf("ep0: bridge_out = ep#%d\n", ep_bridge_out);
+				printf("ep0: bridge_out = ep#%d\n", sisusb_emu.ep.bridge_out);
 			}
-			if (ep_bridge_in == -1) {
-				ep_bridge_in = usb_raw_ep_enable(fd,
+			if (sisusb_emu.ep.bridge_in == -1) {
+				sisusb_emu.ep.bridge_in = usb_raw_ep_enable(fd,
 							&usb_endpoint_bridge_in);
-				printf("ep0: bridge_in = ep#%d\n", ep_bridge_in);
+				printf("ep0: bridge_in = ep#%d\n", sisusb_emu.ep.bridge_in);
 			}
 
-			if (!ep_bridge_thread) {
-				pthread_create(&ep_bridge_thread, 0,
-					       ep_bridge_loop, (void *)(long)fd);
-			}
-
-			if (!ep_gfx_thread) {
-				pthread_create(&ep_gfx_thread, 0,
-					       ep_gfx_loop, (void *)(long)fd);
-			}
+			sisusb_emu_start(fd);
 
 			usb_raw_vbus_draw(fd, usb_config.bMaxPower);
 			usb_raw_configure(fd);
@@ -579,7 +509,7 @@ bool ep0_request(int fd, struct usb_raw_control_event *event,
 }
 
 void ep0_loop(int fd) {
-	while(keep_running && !device_init) {
+	while(!sisusb_emu.stopping && !device_init) {
 		struct usb_raw_control_event event;
 		event.inner.type = 0;
 		event.inner.length = sizeof(event.ctrl);
@@ -619,8 +549,15 @@ void ep0_loop(int fd) {
 		}
 	}
 
+	// At full speed the driver never initializes the device.
+	if (usb_gadget_opts.speed == USB_SPEED_FULL) {
+		test_open_close();
+		sleep(1);
+		return;
+	}
+
 	while (1) {
-		if (!keep_running)
+		if (sisusb_emu.stopping)
 			break;
 		sleep(1);
 	}
@@ -633,15 +570,22 @@ void ep0_loop(int fd) {
 int main(int argc, char **argv) {
 	const char *device = "dummy_udc.0";
 	const char *driver = "dummy_udc";
+
+	usb_gadget_parse_args(&argc, argv);
 	if (argc >= 2)
 		if (!strcmp(argv[1], "--verbose"))
 			verbose = true;
 
+	sisusb_emu_init(&sisusb_config, verbose);
+
 	int fd = usb_raw_open();
 	usb_raw_init(fd, USB_SPEED_HIGH, driver, device);
 	usb_raw_run(fd);
 
 	ep0_loop(fd);
+	usb_gadget_phase(USB_GADGET_PHASE_TEARDOWN);
+
+	sisusb_emu_exit();
 
 	close(fd);
 
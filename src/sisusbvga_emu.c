@@ -0,0 +1,713 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// SiS315 register file and VRAM emulator shared by the sisusbvga gadgets,
+// see sisusbvga_emu.h.
+
+#include "sisusbvga_emu.h"
+
+/*----------------------------------------------------------------------*/
+
+#define VLOG(...) do { if (sisusb_emu.verbose) printf(__VA_ARGS__); } while(0)
+
+struct sisusb_emu sisusb_emu;
+
+// Register spaces for --reg-profile, -1 while profiling is off
+static int prof_bridge = -1;
+static int prof_pci = -1;
+static int prof_gfx = -1;
+static int prof_vram = -1;
+
+#define VRAM_SIZE	(sisusb_emu.cfg->vram_size)
+
+/*----------------------------------------------------------------------*/
+
+static uint8_t get_vram_config_reg(uint32_t size_bytes, uint8_t mode)
+{
+	uint32_t mb = size_bytes / (1024 * 1024);
+	uint8_t power = 0;
+
+	if (mb <= 0) return 0;
+
+	// Adjust base MB depending on topology mode
+	if (mode == SISUSB_RAM_ASYM) {
+		mb = (mb * 2) / 3; // Reverse 1.5x
+	} else if (mode == SISUSB_RAM_1CH_2R || mode == SISUSB_RAM_2CH) {
+		mb >>= 1; // Reverse 2x
+	}
+
+	// Find log2 of base MB
+	while (mb > 1) {
+		mb >>= 1;
+		power++;
+	}
+
+	// Bit 7-4: base size, Bit 3-2: mode, Bit 1-0: bus index
+	return (power << 4) | (mode << 2);
+}
+
+void sisusb_emu_init(const struct sisusb_emu_config *cfg, bool verbose) {
+	sisusb_emu.cfg = cfg;
+	sisusb_emu.verbose = verbose;
+	sisusb_emu.ep = (struct sisusb_emu_eps){
+		.gfx_out = -1, .gfx_in = -1,
+		.gfx_bulk_out = -1, .gfx_lbulk_out = -1,
+		.bridge_out = -1, .bridge_in = -1,
+	};
+
+	if (!VRAM_SIZE)
+		return;
+
+	sisusb_emu.vram = emu_mem_map(VRAM_SIZE, usb_gadget_opts.vram_file);
+	if (!sisusb_emu.vram) {
+		printf("[ERROR] Failed to allocate VRAM!\n");
+		exit(1);
+	}
+	if (usb_gadget_opts.vram_file)
+		printf("[VRAM] Backed by %s\n", usb_gadget_opts.vram_file);
+	printf("[VRAM] Allocated %d MB of emulated VRAM\n", VRAM_SIZE / (1024*1024));
+
+	if (usb_gadget_opts.reg_profile) {
+		prof_bridge = reg_profile_space("bridge", PCI_BRIDGE_REG_SIZE, 0, 4);
+		prof_pci = reg_profile_space("pci", PCI_CONFIG_SIZE, 0, 1);
+		prof_gfx = reg_profile_space("gfx io", GFX_REG_SIZE,
+						SISUSB_PCI_IOPORTBASE, 1);
+		prof_vram = reg_profile_space("vram 64k", VRAM_SIZE >> 16,
+						SISUSB_PCI_MEMBASE, 0x10000);
+	}
+	if (usb_gadget_opts.fb_stats || usb_gadget_opts.fb_snapshot)
+		fb_track_start(sisusb_emu.vram, VRAM_SIZE);
+}
+
+void sisusb_emu_exit(void) {
+	sisusb_emu.stopping = true;
+
+	fb_track_stop();
+	reg_profile_report();
+
+	if (sisusb_emu.vram) {
+		emu_mem_unmap(sisusb_emu.vram, VRAM_SIZE);
+		sisusb_emu.vram = NULL;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+/* Bulk transfers */
+/*----------------------------------------------------------------------*/
+
+static void bulk_queue_push(struct bulk_queue *q, const struct bulk_xfer *xfer) {
+	unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+	// Only fills up if the bulk thread stalls: the driver waits for the
+	// data stage of a transfer before configuring the next one.
+	while (tail - atomic_load_explicit(&q->head, memory_order_acquire) ==
+							BULK_QUEUE_SIZE) {
+		if (sisusb_emu.stopping)
+			return;
+		usleep(100);
+	}
+	q->xfer[tail & (BULK_QUEUE_SIZE - 1)] = *xfer;
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+// The polling interval backs off to 1 ms while idle.
+bool bulk_queue_pop(struct bulk_queue *q, struct bulk_xfer *xfer) {
+	unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned delay = 10;
+
+	for (unsigned waited = 0; ; waited += delay) {
+		if (head != atomic_load_explicit(&q->tail, memory_order_acquire)) {
+			*xfer = q->xfer[head & (BULK_QUEUE_SIZE - 1)];
+			atomic_store_explicit(&q->head, head + 1,
+						memory_order_release);
+			return true;
+		}
+		if (sisusb_emu.stopping || waited >= BULK_QUEUE_WAIT_US)
+			break;
+		usleep(delay);
+		if (delay < 1000)
+			delay *= 2;
+	}
+	return false;
+}
+
+// Smallest chunk checked for a fill pattern
+#define BULK_FILL_MIN	4096
+
+// True if every byte of the chunk has the same value, which is what the
+// driver streams for SUCMD_CLRSCR and console clears. The comparison
+// against itself shifted by one byte checks all the bytes that arrived.
+static bool bulk_is_fill(const uint8_t *data, uint32_t length) {
+	return length >= BULK_FILL_MIN && data[0] == data[length - 1] &&
+		!memcmp(data, data + 1, length - 1);
+}
+
+// Bulk write to VRAM - for large data transfers. Fills are applied with
+// memset, and zero fills release whole pages of VRAM.
+void vram_bulk_write(uint32_t address, const uint8_t *data, uint32_t length) {
+	uint32_t base_addr = address - SISUSB_PCI_MEMBASE;
+	if (base_addr >= VRAM_SIZE || length > VRAM_SIZE - base_addr) {
+		if (sisusb_emu.cfg->bulk_drop_oob) {
+			VLOG("[WARNING] Bulk write would exceed VRAM bounds, truncating\n");
+			length = 0;
+		} else {
+			printf("[WARNING] Bulk write would exceed VRAM bounds, truncating\n");
+			length = base_addr < VRAM_SIZE ? VRAM_SIZE - base_addr : 0;
+		}
+	}
+
+	if (length > 0) {
+		if (bulk_is_fill(data, length)) {
+			if (data[0])
+				memset(&sisusb_emu.vram[base_addr], data[0], length);
+			else
+				emu_mem_zero(&sisusb_emu.vram[base_addr], length);
+			atomic_fetch_add_explicit(&sisusb_emu.fill_bytes, length,
+							memory_order_relaxed);
+			VLOG("  BULK FILL VRAM[0x%08x] length=%u bytes value=0x%02x\n",
+				address, length, data[0]);
+		} else {
+			memcpy(&sisusb_emu.vram[base_addr], data, length);
+		}
+		fb_track_write(base_addr, length);
+		atomic_fetch_add_explicit(&sisusb_emu.bulk_bytes, length,
+						memory_order_relaxed);
+		VLOG("  BULK WRITE VRAM[0x%08x] length=%u bytes\n", address, length);
+	}
+}
+
+/*----------------------------------------------------------------------*/
+/* Bridge registers */
+/*----------------------------------------------------------------------*/
+
+#define BULK_LOG(...) do {						\
+	if (sisusb_emu.cfg->log_bulk_setup)				\
+		printf(__VA_ARGS__);					\
+	else								\
+		VLOG(__VA_ARGS__);					\
+} while (0)
+
+static void bridge_bulk_setup(uint32_t address, uint32_t data) {
+	const struct sisusb_emu_config *cfg = sisusb_emu.cfg;
+	bool small = address < 0x1c0;
+	struct bulk_xfer *setup = small ?
+			&sisusb_emu.bulk_setup : &sisusb_emu.lbulk_setup;
+
+	if (small ? !cfg->small_bulk : !cfg->large_bulk)
+		return;
+
+	switch (address) {
+	case 0x194:	// Small bulk: address register
+	case 0x1d4:	// Large bulk: address register
+		setup->address = data;
+		BULK_LOG("  [BULK CONFIG] Address = 0x%08x\n", data);
+		break;
+
+	case 0x190:	// Small bulk: length register
+	case 0x1d0:	// Large bulk: length register
+		setup->length = data;
+		BULK_LOG("  [BULK CONFIG] Length = %u bytes\n", data);
+		break;
+
+	case 0x180:	// Small bulk: flags/command register
+	case 0x1c0:	// Large bulk: flags/command register
+		setup->flags = data;
+		bulk_queue_push(small ? &sisusb_emu.bulk_queue :
+				&sisusb_emu.lbulk_queue, setup);
+		BULK_LOG("  [BULK CONFIG] Flags = 0x%08x, ready for transfer\n", data);
+		break;
+
+	default:
+		return;
+	}
+
+	if (cfg->bulk_setup_hook)
+		cfg->bulk_setup_hook(setup);
+}
+
+uint32_t process_packet_bridge(struct sisusb_packet *pkt, bool is_read) {
+	uint16_t header = __le16_to_cpu(pkt->header);
+	uint32_t address = __le32_to_cpu(pkt->address);
+	uint32_t data = __le32_to_cpu(pkt->data);
+	uint32_t result = 0;
+	uint32_t reg_offset = address / 4;
+
+	VLOG("[BRIDGE] header=0x%04x, addr=0x%08x, data=0x%08x, %s\n",
+	     header, address, data, is_read ? "READ" : "WRITE");
+
+	// Bridge packets typically have header 0x001f
+	if (header != 0x001f && header != 0x000f) {
+		printf("[WARNING] Unexpected bridge packet header: 0x%04x\n", header);
+	}
+
+	if (reg_offset >= PCI_BRIDGE_REG_SIZE) {
+		printf("[WARNING] Bridge register offset 0x%x out of bounds\n", reg_offset);
+		return 0;
+	}
+
+	reg_profile_access(prof_bridge, reg_offset, is_read);
+
+	if (is_read) {
+		result = sisusb_emu.bridge_reg[reg_offset];
+		VLOG("  READ BRIDGE[0x%03x] = 0x%08x\n", address, result);
+	} else {
+		sisusb_emu.bridge_reg[reg_offset] = data;
+		VLOG("  WRITE BRIDGE[0x%03x] = 0x%08x\n", address, data);
+
+		// Handle bulk transfer configuration registers
+		bridge_bulk_setup(address, data);
+	}
+
+	return result;
+}
+
+/*----------------------------------------------------------------------*/
+/* VGA IO ports */
+/*----------------------------------------------------------------------*/
+
+// Returns the register file behind an indexed data port, NULL for plain
+// ports (index ports included, they hold the current index).
+static uint8_t *vga_indexed_reg(uint32_t port) {
+	switch (port) {
+	case SISUSB_PORT_SR + 1:
+		return &sisusb_emu.sr[sisusb_emu.port[SISUSB_PORT_SR]];
+	case SISUSB_PORT_GR + 1:
+		return &sisusb_emu.gr[sisusb_emu.port[SISUSB_PORT_GR]];
+	case SISUSB_PORT_CR + 1:
+		return &sisusb_emu.cr[sisusb_emu.port[SISUSB_PORT_CR]];
+	default:
+		return NULL;
+	}
+}
+
+static uint8_t vga_port_read(uint32_t port) {
+	uint8_t *reg = vga_indexed_reg(port);
+
+	if (reg == &sisusb_emu.sr[0x3a]) {
+		// DRAM type strap
+		// https://elixir.bootlin.com/linux/v6.12.66/source/drivers/usb/misc/sisusbvga/sisusbvga.c#L1894
+		return sisusb_emu.cfg->ram_type;
+	}
+	if (reg == &sisusb_emu.sr[0x14]) {
+		// DRAM size and topology, whatever the driver's sizing wrote
+		// https://elixir.bootlin.com/linux/v6.12.66/source/drivers/usb/misc/sisusbvga/sisusbvga.c#L2035
+		uint32_t size = sisusb_emu.cfg->vram_size_reported ?
+				sisusb_emu.cfg->vram_size_reported : VRAM_SIZE;
+		return get_vram_config_reg(size, sisusb_emu.cfg->ram_topology);
+	}
+
+	return reg ? *reg : sisusb_emu.port[port];
+}
+
+static void vga_port_write(uint32_t port, uint8_t data) {
+	uint8_t *reg = vga_indexed_reg(port);
+
+	if (reg)
+		*reg = data;
+	else
+		sisusb_emu.port[port] = data;
+}
+
+/*----------------------------------------------------------------------*/
+/* VRAM */
+/*----------------------------------------------------------------------*/
+
+// Fast path for the byte-enable masks the driver actually uses: a full
+// dword (0xF) or one of its aligned halves (0x3, 0xC). Returns a pointer
+// to the bytes to access and their count, or NULL if the access has to
+// go through the byte loop (other masks, unaligned or out of bounds).
+static inline uint8_t *vram_fast_ptr(uint32_t base_addr, uint8_t be_mask,
+					int *size, int *shift) {
+	if (base_addr & 3)
+		return NULL;
+
+	switch (be_mask) {
+	case 0xF:
+		*size = 4;
+		*shift = 0;
+		break;
+	case 0x3:
+		*size = 2;
+		*shift = 0;
+		break;
+	case 0xC:
+		*size = 2;
+		*shift = 16;
+		base_addr += 2;
+		break;
+	default:
+		return NULL;
+	}
+
+	if (!sisusb_emu.cfg->strict_bounds_check)
+		base_addr &= VRAM_SIZE - 1;
+	else if (base_addr > VRAM_SIZE - *size)
+		return NULL;
+
+	return &sisusb_emu.vram[base_addr];
+}
+
+static uint32_t vram_packet_read(uint32_t address, uint8_t be_mask) {
+	uint8_t *vram = sisusb_emu.vram;
+	uint32_t base_addr = address - SISUSB_PCI_MEMBASE;
+	int size, shift;
+	uint8_t *fast = vram_fast_ptr(base_addr, be_mask, &size, &shift);
+	uint32_t result = 0;
+
+	if (fast) {
+		if (size == 4) {
+			uint32_t v;
+			memcpy(&v, fast, 4);
+			result = __le32_to_cpu(v);
+		} else {
+			uint16_t v;
+			memcpy(&v, fast, 2);
+			result = (uint32_t)__le16_to_cpu(v) << shift;
+		}
+	} else {
+		for (int i = 0; i < 4; i++) {
+			if (be_mask & (1 << i)) {
+				uint32_t curr_addr = base_addr + i;
+
+				if (!sisusb_emu.cfg->strict_bounds_check)
+					 curr_addr &= VRAM_SIZE - 1;
+
+				if (curr_addr < VRAM_SIZE) {
+					result |= (uint32_t)vram[curr_addr] << (i * 8);
+				} else {
+					printf("READ VRAM: Address [0x%08x] out of bounds\n", address);
+				}
+			}
+		}
+	}
+	VLOG("  READ VRAM[0x%08x] Mask[0x%x] = 0x%08x\n", address, be_mask, result);
+
+	return result;
+}
+
+static void vram_packet_write(uint32_t address, uint8_t be_mask, uint32_t data) {
+	uint8_t *vram = sisusb_emu.vram;
+	uint32_t base_addr = address - SISUSB_PCI_MEMBASE;
+	int size, shift;
+	uint8_t *fast = vram_fast_ptr(base_addr, be_mask, &size, &shift);
+
+	if (fast) {
+		if (size == 4) {
+			uint32_t v = __cpu_to_le32(data);
+			memcpy(fast, &v, 4);
+		} else {
+			uint16_t v = __cpu_to_le16(data >> shift);
+			memcpy(fast, &v, 2);
+		}
+		fb_track_write(fast - vram, size);
+	} else {
+		for (int i = 0; i < 4; i++) {
+			if (be_mask & (1 << i)) {
+				uint32_t curr_addr = base_addr + i;
+
+				if (!sisusb_emu.cfg->strict_bounds_check)
+					 curr_addr &= VRAM_SIZE - 1;
+
+				if (curr_addr < VRAM_SIZE) {
+					vram[curr_addr] = (uint8_t)(data >> (i * 8));
+					fb_track_write(curr_addr, 1);
+				} else {
+					printf("WRITE VRAM: Address [0x%08x] out of bounds\n", address);
+				}
+			}
+		}
+	}
+	VLOG("  WRITE VRAM[0x%08x] Mask[0x%x] = 0x%08x\n", address, be_mask, data);
+	atomic_fetch_add_explicit(&sisusb_emu.packet_bytes,
+		__builtin_popcount(be_mask), memory_order_relaxed);
+
+	// Corner: (479*640*2) + (639*2) = 0x95FFE.
+	// Logic address 0x95FFE is packet 0x95FFC with mask 0xC.
+	// Triggers twice: horizontal and vertical line loops.
+	if (address == 0xd0095ffc && data == 0xf1000000) {
+		static int corner_hits = 0;
+		corner_hits++;
+
+		if (corner_hits == 1) {
+			printf("[Setup screen] Bottom-Horizontal Line Done\n");
+		} else if (corner_hits == 2) {
+			printf("[Setup screen] Right-Vertical Line Done (Frame Complete)\n");
+			sisusb_emu.screen_done = true;
+		}
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+uint32_t process_packet_gfx(struct sisusb_packet *pkt, bool is_read) {
+	uint16_t header = __le16_to_cpu(pkt->header);
+	uint32_t address = __le32_to_cpu(pkt->address);
+	uint32_t data = __le32_to_cpu(pkt->data);
+
+	uint32_t result = 0;
+
+	if (header == 0x008f) {
+		address = address & (PCI_CONFIG_SIZE - 1);
+		reg_profile_access(prof_pci, address, is_read);
+		if (is_read) {
+			// sisusb_read_pci_config
+			result = sisusb_emu.pci_config[address];
+			VLOG("  READ PCI[0x%02x] = 0x%08x\n", address, result);
+		} else {
+			// sisusb_write_pci_config
+			sisusb_emu.pci_config[address] = data;
+			VLOG("  WRITE PCI[0x%02x] = 0x%08x\n", address, data);
+		}
+
+		return result;
+	}
+
+	// Initialize the graphics core
+	// https://elixir.bootlin.com/linux/v6.12.66/source/drivers/usb/misc/sisusbvga/sisusbvga.c#L2185
+
+	int type = (header >> 6) & 0x03;
+
+	if (type == SISUSB_TYPE_IO) {
+		uint32_t offset;
+		uint8_t low_bits = header & 0x0F;
+
+		if (low_bits == 8) offset = 3;
+		else if (low_bits == 4) offset = 2;
+		else if (low_bits == 2) offset = 1;
+		else offset = 0;
+
+		address = address & ~SISUSB_PCI_IOPORTBASE;
+		address = address + offset;
+
+		data = (data >> ((address & 3) << 3)) & 0xFF;
+
+		reg_profile_access(prof_gfx, address, is_read);
+
+		if (address < GFX_REG_SIZE) {
+			if (is_read) {
+				result = vga_port_read(address);
+				VLOG("  READ GFX REG IO[0x%02x] = 0x%08x\n", address, result);
+			} else {
+				vga_port_write(address, data);
+				VLOG("  WRITE GFX REG IO[0x%02x] = 0x%08x\n", address, data);
+			}
+
+			result = result << ((address & 3) << 3);
+		}
+	} else if (type == SISUSB_TYPE_MEM) {
+		uint8_t be_mask = header & 0x0F;
+
+		reg_profile_access(prof_vram,
+			(address - SISUSB_PCI_MEMBASE) >> 16, is_read);
+
+		if (is_read)
+			result = vram_packet_read(address, be_mask);
+		else
+			vram_packet_write(address, be_mask, data);
+	} else {
+		printf("[ERROR] GFX: Unknown SISUSB_TYPE\n");
+	}
+
+	return result;
+}
+
+/*----------------------------------------------------------------------*/
+/* Endpoint threads */
+/*----------------------------------------------------------------------*/
+
+#define EP_MAX_PACKET_BULK	512
+#define SISUSB_LBULK_MAX	(64 * 1024)	// driver's SISUSB_OBUF_SIZE
+
+struct usb_raw_bulk_io {
+	struct usb_raw_ep_io		inner;
+	char				data[EP_MAX_PACKET_BULK];
+};
+
+struct usb_raw_lbulk_io {
+	struct usb_raw_ep_io		inner;
+	char				data[SISUSB_LBULK_MAX];
+};
+
+// GFX_OUT/GFX_IN and BRIDGE_OUT/BRIDGE_IN: a packet comes in, and for
+// reads (header and address only) the result goes back.
+struct ep_packet_pipe {
+	const char *name;		// thread name in the log
+	const char *tag;		// prefix of the packet log lines
+	const int *ep_out;
+	const int *ep_in;
+	uint32_t (*process)(struct sisusb_packet *pkt, bool is_read);
+	pthread_t thread;
+};
+
+// GFX_BULK_OUT and GFX_LBULK_OUT: data stages of the transfers queued by
+// the bridge thread.
+struct ep_bulk_pipe {
+	const char *name;
+	const char *tag;
+	const int *ep_out;
+	struct bulk_queue *queue;
+	pthread_t thread;
+	struct usb_raw_lbulk_io io;
+};
+
+// Raw gadget descriptor the endpoint threads do their IO on
+static int ep_fd;
+
+static struct ep_packet_pipe bridge_pipe = {
+	.name =		"Bridge",
+	.tag =		"BRIDGE",
+	.ep_out =	&sisusb_emu.ep.bridge_out,
+	.ep_in =	&sisusb_emu.ep.bridge_in,
+};
+
+static struct ep_packet_pipe gfx_pipe = {
+	.name =		"GFX",
+	.tag =		"GFX",
+	.ep_out =	&sisusb_emu.ep.gfx_out,
+	.ep_in =	&sisusb_emu.ep.gfx_in,
+};
+
+static struct ep_bulk_pipe bulk_pipe = {
+	.name =		"Bulk",
+	.tag =		"BULK",
+	.ep_out =	&sisusb_emu.ep.gfx_bulk_out,
+	.queue =	&sisusb_emu.bulk_queue,
+};
+
+static struct ep_bulk_pipe lbulk_pipe = {
+	.name =		"LBulk",
+	.tag =		"LBULK",
+	.ep_out =	&sisusb_emu.ep.gfx_lbulk_out,
+	.queue =	&sisusb_emu.lbulk_queue,
+};
+
+static void *ep_packet_loop(void *arg) {
+	struct ep_packet_pipe *p = arg;
+	struct usb_raw_bulk_io io;
+
+	VLOG("[THREAD] %s endpoint thread started\n", p->name);
+
+	while (!sisusb_emu.stopping) {
+		assert(*p->ep_out != -1);
+		io.inner.ep = *p->ep_out;
+		io.inner.flags = 0;
+		io.inner.length = sizeof(io.data);
+
+		VLOG("[%s] Waiting for data on ep#%d...\n", p->tag, *p->ep_out);
+		int rv = usb_raw_ep_read(ep_fd, (struct usb_raw_ep_io *)&io);
+		if (rv < 0) {
+			if (sisusb_emu.stopping) break;
+			VLOG("[%s] Read error: %d, errno=%d\n", p->tag, rv, errno);
+			continue;
+		}
+
+		bool is_read = (rv == 6);
+
+		VLOG("[%s] *** RECEIVED %d bytes ***\n", p->tag, rv);
+		if (rv >= 6) {
+			struct sisusb_packet *pkt = (struct sisusb_packet *)io.inner.data;
+			uint32_t result = p->process(pkt, is_read);
+
+			if (is_read && *p->ep_in != -1) {
+				io.inner.ep = *p->ep_in;
+				io.inner.length = sizeof(struct sisusb_packet);
+
+				// write response data
+				*(int *)(io.inner.data) = result;
+				usb_raw_ep_write(ep_fd, (struct usb_raw_ep_io *)&io);
+			}
+		}
+	}
+
+	VLOG("[THREAD] %s endpoint thread exiting\n", p->name);
+	return NULL;
+}
+
+// Reads are sized to the configured transfer, so it has to be known before
+// the data stage is posted, unless the config asks for packet-sized reads
+// on GFX_BULK_OUT: then the transfer is picked up once its data arrived.
+static void *ep_bulk_loop(void *arg) {
+	struct ep_bulk_pipe *p = arg;
+	struct usb_raw_lbulk_io *io = &p->io;
+	bool sized = p == &lbulk_pipe || !sisusb_emu.cfg->bulk_packet_reads;
+	struct bulk_xfer xfer = {0};
+
+	VLOG("[THREAD] %s endpoint (ep#%d) thread started\n", p->name, *p->ep_out);
+
+	while (!sisusb_emu.stopping) {
+		uint32_t len = EP_MAX_PACKET_BULK;
+
+		if (sized) {
+			if (xfer.length == 0 && !bulk_queue_pop(p->queue, &xfer))
+				continue;
+			len = xfer.length < sizeof(io->data) ?
+					xfer.length : sizeof(io->data);
+		}
+
+		assert(*p->ep_out != -1);
+		io->inner.ep = *p->ep_out;
+		io->inner.flags = 0;
+		io->inner.length = len;
+
+		VLOG("[%s] Waiting for %u bytes on ep#%d...\n", p->tag, len, *p->ep_out);
+		int rv = usb_raw_ep_read(ep_fd, (struct usb_raw_ep_io *)io);
+		if (rv < 0) {
+			if (sisusb_emu.stopping) break;
+			printf("[%s] Read error: %d, errno=%d\n", p->tag, rv, errno);
+			continue;
+		}
+
+		if (xfer.length == 0 && !bulk_queue_pop(p->queue, &xfer)) {
+			printf("[%s] %d bytes without a configured transfer, dropped\n",
+				p->tag, rv);
+			continue;
+		}
+
+		// Verify length matches requested length
+		uint32_t expected = xfer.length < len ? xfer.length : len;
+		if (rv != expected) {
+			VLOG("[WARNING] Bulk transfer length mismatch: expected=%u, got=%u\n",
+				expected, rv);
+		}
+
+		vram_bulk_write(xfer.address, (uint8_t *)io->inner.data, rv);
+
+		xfer.address += rv;
+		xfer.length = rv < xfer.length ? xfer.length - rv : 0;
+
+		if (xfer.length == 0)
+			BULK_LOG("   [%s] Write data to VRAM OK\n", p->tag);
+	}
+
+	VLOG("[THREAD] %s endpoint thread exiting\n", p->name);
+	return NULL;
+}
+
+static void ep_thread_start(pthread_t *thread, void *(*loop)(void *),
+								void *pipe) {
+	if (*thread)
+		return;
+
+	int rv = pthread_create(thread, NULL, loop, pipe);
+	if (rv != 0) {
+		printf("[ERROR] Failed to start endpoint thread: %s\n",
+			strerror(rv));
+		exit(EXIT_FAILURE);
+	}
+}
+
+void sisusb_emu_start(int fd) {
+	const struct sisusb_emu_config *cfg = sisusb_emu.cfg;
+
+	ep_fd = fd;
+	bridge_pipe.process = cfg->bridge_packet ?
+			cfg->bridge_packet : process_packet_bridge;
+	gfx_pipe.process = cfg->gfx_packet ?
+			cfg->gfx_packet : process_packet_gfx;
+
+	ep_thread_start(&bridge_pipe.thread, ep_packet_loop, &bridge_pipe);
+	ep_thread_start(&gfx_pipe.thread, ep_packet_loop, &gfx_pipe);
+	if (cfg->small_bulk)
+		ep_thread_start(&bulk_pipe.thread, ep_bulk_loop, &bulk_pipe);
+	if (cfg->large_bulk)
+		ep_thread_start(&lbulk_pipe.thread, ep_bulk_loop, &lbulk_pipe);
+}
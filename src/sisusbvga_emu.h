@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// SiS315 register file and VRAM emulator shared by the sisusbvga gadgets.
+//
+// Emulates what sits behind the Net2280 bridge of the SiS USB-to-VGA
+// adapter: PCI configuration space, bridge registers (including the
+// small/large bulk transfer setup), the VGA IO ports with indexed
+// SR/CR/GR register files, and VRAM. A gadget describes its device with
+// a struct sisusb_emu_config (RAM type, topology, size and which bulk
+// paths it serves) and keeps only the USB side: descriptors, enabling the
+// endpoints and its tests. The endpoint threads live here too.
+
+#ifndef _SISUSBVGA_EMU_H
+#define _SISUSBVGA_EMU_H
+
+#include "usb_gadget_tests.h"
+
+/*----------------------------------------------------------------------*/
+
+#define SISUSB_TYPE_MEM		0
+#define SISUSB_TYPE_IO		1
+
+#define SISUSB_PCI_IOPORTBASE	0x0000d000
+#define SISUSB_PCI_MEMBASE	0xd0000000
+
+#define PCI_CONFIG_SIZE		128
+#define PCI_BRIDGE_REG_SIZE	1024
+#define GFX_REG_SIZE		128
+
+// Indexed VGA register files: index port, data port at index + 1
+#define SISUSB_PORT_SR		0x44	// sequencer (SISSR)
+#define SISUSB_PORT_GR		0x4e	// graphics controller (SISGR)
+#define SISUSB_PORT_CR		0x54	// CRT controller (SISCR)
+
+#define RAM_TYPE_SDR		0x1
+#define RAM_TYPE_DDR		0x3
+
+// SISSR 0x14 bits 2-3 (RAM Topology)
+#define SISUSB_RAM_1CH_1R	0x00 // 1 channel / 1 rank (1x)
+#define SISUSB_RAM_1CH_2R	0x01 // 1 channel / 2 rank (2x)
+#define SISUSB_RAM_ASYM		0x02 // Asymmetric (1.5x)
+#define SISUSB_RAM_2CH		0x03 // 2 channel (2x)
+
+struct sisusb_packet {
+	unsigned short header;
+	uint32_t address;
+	uint32_t data;
+} __attribute__ ((__packed__));
+
+/*----------------------------------------------------------------------*/
+
+// Userspace interface of /dev/sisusbvgaN (drivers/usb/misc/sisusbvga/sisusb.h)
+// used by the file operation tests. Offsets passed to lseek() select the
+// address space behind them.
+
+#define SISUSB_PCI_PSEUDO_MEMBASE	0x10000000
+#define SISUSB_PCI_PSEUDO_MMIOBASE	0x20000000
+#define SISUSB_PCI_PSEUDO_IOPORTBASE	0x0000d000
+#define SISUSB_PCI_PSEUDO_PCIBASE	0x00010000
+
+#define SISUSB_ID  0x53495355	// 'SISU'
+
+struct sisusb_info {
+	__u32 sisusb_id;
+	__u8 sisusb_version;
+	__u8 sisusb_revision;
+	__u8 sisusb_patchlevel;
+	__u8 sisusb_gfxinit;
+
+	__u32 sisusb_vrambase;
+	__u32 sisusb_mmiobase;
+	__u32 sisusb_iobase;
+	__u32 sisusb_pcibase;
+
+	__u32 sisusb_vramsize;
+	__u32 sisusb_minor;
+	__u32 sisusb_fbdevactive;
+	__u32 sisusb_conactive;
+
+	__u8 sisusb_reserved[28];
+};
+
+struct sisusb_command {
+	__u8 operation;
+	__u8 data0;
+	__u8 data1;
+	__u8 data2;
+	__u32 data3;
+	__u32 data4;
+};
+
+#define SUCMD_GET	0x01
+#define SUCMD_SET	0x02
+#define SUCMD_SETOR	0x03
+#define SUCMD_SETAND	0x04
+#define SUCMD_SETANDOR	0x05
+#define SUCMD_SETMASK	0x06
+#define SUCMD_CLRSCR	0x07
+
+#define SISUSB_COMMAND		_IOWR(0xF3,0x3D,struct sisusb_command)
+#define SISUSB_GET_CONFIG_SIZE	_IOR(0xF3,0x3E,__u32)
+#define SISUSB_GET_CONFIG	_IOR(0xF3,0x3F,struct sisusb_info)
+
+/*----------------------------------------------------------------------*/
+
+// A bulk transfer as configured through the bridge registers. The bridge
+// thread latches address and length, and the flags write commits the
+// transfer to the queue of the endpoint its data will arrive on.
+struct bulk_xfer {
+	uint32_t address;	// Target VRAM address
+	uint32_t length;	// Transfer length
+	uint32_t flags;		// Transfer flags
+};
+
+#define BULK_QUEUE_SIZE		16	// must be a power of two
+#define BULK_QUEUE_WAIT_US	100000
+
+// Lock-free queue of configured transfers with a single producer (the
+// bridge thread) and a single consumer (the bulk endpoint thread).
+struct bulk_queue {
+	struct bulk_xfer xfer[BULK_QUEUE_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+};
+
+/*----------------------------------------------------------------------*/
+
+struct sisusb_emu_config {
+	uint32_t vram_size;		// emulated VRAM, a power of two,
+					// 0: no graphics core
+	uint32_t vram_size_reported;	// size reported in SR14, 0: vram_size
+	uint8_t ram_type;		// RAM_TYPE_*, reported in SR3A
+	uint8_t ram_topology;		// SISUSB_RAM_*, reported in SR14
+
+	bool small_bulk;	// queue 0x180-0x194 setups for GFX_BULK_OUT
+	bool large_bulk;	// queue 0x1c0-0x1d4 setups for GFX_LBULK_OUT
+	bool bulk_drop_oob;	// drop bulk writes past VRAM instead of
+				// truncating them
+	bool bulk_packet_reads;	// read GFX_BULK_OUT a packet at a time
+				// instead of a whole transfer
+	bool log_bulk_setup;	// print bulk setups and completed transfers
+				// without --verbose
+	bool strict_bounds_check; // no VRAM address wrap-around
+
+	// Called after every bridge write that changes a bulk setup.
+	void (*bulk_setup_hook)(const struct bulk_xfer *setup);
+
+	// Packet handlers of the bridge and gfx endpoint threads, NULL:
+	// process_packet_bridge() and process_packet_gfx().
+	uint32_t (*bridge_packet)(struct sisusb_packet *pkt, bool is_read);
+	uint32_t (*gfx_packet)(struct sisusb_packet *pkt, bool is_read);
+};
+
+// Endpoint handles from usb_raw_ep_enable(), -1 until enabled
+struct sisusb_emu_eps {
+	int gfx_out;
+	int gfx_in;
+	int gfx_bulk_out;
+	int gfx_lbulk_out;
+	int bridge_out;
+	int bridge_in;
+};
+
+struct sisusb_emu {
+	const struct sisusb_emu_config *cfg;
+	bool verbose;
+
+	struct sisusb_emu_eps ep;
+
+	uint32_t pci_config[PCI_CONFIG_SIZE];
+	uint32_t bridge_reg[PCI_BRIDGE_REG_SIZE];
+	uint8_t port[GFX_REG_SIZE];	// plain ports and the index ports
+	uint8_t sr[256];
+	uint8_t gr[256];
+	uint8_t cr[256];
+	uint8_t *vram;
+
+	struct bulk_xfer bulk_setup;	// 0x180-0x194, bridge thread only
+	struct bulk_xfer lbulk_setup;	// 0x1c0-0x1d4, bridge thread only
+	struct bulk_queue bulk_queue;	// GFX_BULK_OUT
+	struct bulk_queue lbulk_queue;	// GFX_LBULK_OUT
+
+	// VRAM bytes stored through the bulk endpoints and through MEM packets.
+	atomic_ullong bulk_bytes;
+	atomic_ullong packet_bytes;
+	// Part of bulk_bytes applied as a fill (see vram_bulk_write).
+	atomic_ullong fill_bytes;
+
+	// Set once the driver has drawn the last pixel of its setup screen.
+	volatile bool screen_done;
+
+	// Set to stop the endpoint threads and make threads waiting on a
+	// bulk queue give up.
+	volatile bool stopping;
+};
+
+extern struct sisusb_emu sisusb_emu;
+
+// Maps VRAM (see --vram-file) and sets up --reg-profile and the
+// framebuffer tracker for the given device.
+void sisusb_emu_init(const struct sisusb_emu_config *cfg, bool verbose);
+// Prints the reports requested on the command line and unmaps VRAM.
+void sisusb_emu_exit(void);
+
+// Starts the endpoint threads once the gadget has enabled the endpoints
+// in sisusb_emu.ep: bridge and gfx, and the bulk endpoints the config
+// serves. Threads that are already running are left alone.
+void sisusb_emu_start(int fd);
+
+uint32_t process_packet_bridge(struct sisusb_packet *pkt, bool is_read);
+uint32_t process_packet_gfx(struct sisusb_packet *pkt, bool is_read);
+
+void vram_bulk_write(uint32_t address, const uint8_t *data, uint32_t length);
+
+// Waits up to BULK_QUEUE_WAIT_US: the data stage may reach the bulk
+// thread before the bridge thread has processed the flags write that
+// configures it.
+bool bulk_queue_pop(struct bulk_queue *q, struct bulk_xfer *xfer);
+
+#endif /* _SISUSBVGA_EMU_H */
@@ -0,0 +1,26 @@
+PERSONALITY(keyboard, "keyboard")
+PERSONALITY(printer, "printer")
+PERSONALITY(mouse, "mouse")
+PERSONALITY(ethernet, "ethernet")
+PERSONALITY(storage_bot, "storage-bot")
+PERSONALITY(serial_ch341, "serial-ch341")
+PERSONALITY(serial_ftdi_sio, "serial-ftdi_sio")
+PERSONALITY(serial_cp210x, "serial-cp210x")
+PERSONALITY(serial_pl2303, "serial-pl2303")
+PERSONALITY(serial_oti6858, "serial-oti6858")
+PERSONALITY(usbtmc, "usbtmc")
+PERSONALITY(input_tab_hanwang, "input-tab-hanwang")
+PERSONALITY(input_tab_pegasus, "input-tab-pegasus")
+PERSONALITY(input_tab_kbtab, "input-tab-kbtab")
+PERSONALITY(input_tab_acecad, "input-tab-acecad")
+PERSONALITY(input_tab_acecad_Flair, "input-tab-acecad-Flair")
+PERSONALITY(input_tab_aiptek, "input-tab-aiptek")
+PERSONALITY(input_tab_script, "input-tab-script")
+PERSONALITY(sisusbvga_init_gfx_dev, "sisusbvga-init-gfx-dev")
+PERSONALITY(sisusbvga_init_gfx_core_DDR_16Mb, "sisusbvga-init-gfx-core-DDR_16Mb")
+PERSONALITY(sisusbvga_init_gfx_core_SDR_8Mb, "sisusbvga-init-gfx-core-SDR_8Mb")
+PERSONALITY(sisusbvga_fops_ioctl, "sisusbvga-fops-ioctl")
+PERSONALITY(sisusbvga_fops_read_write, "sisusbvga-fops-read_write")
+PERSONALITY(sisusbvga_fops_svace_int_overflow, "sisusbvga-fops-svace-int-overflow")
+PERSONALITY(sisusbvga_fops_svace_null_deref, "sisusbvga-fops-svace-null-deref")
+PERSONALITY(composite, "composite")
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Multi-call binary holding every gadget personality, busybox style:
+//
+//   usb-gadget <personality> [options]
+//   <personality> [options]            (symlink or hard link to usb-gadget)
+//
+// Each personality is built from the same src/<name>/<name>.c as its own
+// executable. The Makefile renames its main() to <id>_main() and its
+// log_control_request() to <id>_log_control_request(), where <id> is the
+// name with '-' replaced by '_', and makes every other symbol of the
+// object local, so the gadgets' identically named globals do not clash.
+// The list of personalities is generated into personalities.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../usb_gadget_tests.h"
+
+#define PERSONALITY(id, name) \
+	int id##_main(int argc, char **argv); \
+	void id##_log_control_request(struct usb_ctrlrequest *ctrl);
+#include "personalities.h"
+#undef PERSONALITY
+
+struct personality {
+	const char *name;
+	int (*main)(int argc, char **argv);
+	void (*log_control_request)(struct usb_ctrlrequest *ctrl);
+};
+
+static const struct personality personalities[] = {
+#define PERSONALITY(id, name) { name, id##_main, id##_log_control_request },
+#include "personalities.h"
+#undef PERSONALITY
+};
+
+#define PERSONALITIES_NUM (sizeof(personalities) / sizeof(personalities[0]))
+
+static const struct personality *current;
+
+// Called by the common library, forwards to the selected personality.
+void log_control_request(struct usb_ctrlrequest *ctrl) {
+	current->log_control_request(ctrl);
+}
+
+static const struct personality *find_personality(const char *name) {
+	for (size_t i = 0; i < PERSONALITIES_NUM; i++) {
+		if (strcmp(personalities[i].name, name) == 0)
+			return &personalities[i];
+	}
+	return NULL;
+}
+
+static void usage(const char *prog) {
+	printf("Usage: %s <personality> [options]\n", prog);
+	printf("       %s --list\n", prog);
+	printf("Personalities:\n");
+	for (size_t i = 0; i < PERSONALITIES_NUM; i++)
+		printf("  %s\n", personalities[i].name);
+}
+
+int main(int argc, char **argv) {
+	const char *base = strrchr(argv[0], '/');
+	base = base ? base + 1 : argv[0];
+
+	// Invoked through a link named after a personality
+	current = find_personality(base);
+	if (current)
+		return current->main(argc, argv);
+
+	if (argc < 2) {
+		usage(base);
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(argv[1], "--list") == 0) {
+		for (size_t i = 0; i < PERSONALITIES_NUM; i++)
+			printf("%s\n", personalities[i].name);
+		return EXIT_SUCCESS;
+	}
+
+	if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+		usage(base);
+		return EXIT_SUCCESS;
+	}
+
+	current = find_personality(argv[1]);
+	if (!current) {
+		printf("%s: unknown personality '%s'\n", base, argv[1]);
+		usage(base);
+		exit(EXIT_FAILURE);
+	}
+
+	// The personality sees its own name as argv[0]
+	return current->main(argc - 1, argv + 1);
+}
@@ -0,0 +1,444 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Function definitions shared by the keyboard, mouse and printer gadgets
+// and the composite gadget, see usb_functions.h.
+
+#include "usb_functions.h"
+
+/*----------------------------------------------------------------------*/
+
+#define STRING_ID_INTERFACE	4
+
+#define EP_MAX_PACKET_KEYBOARD	8
+#define EP_MAX_PACKET_MOUSE	4
+#define EP_MAX_PACKET_BULK	512
+
+/*----------------------------------------------------------------------*/
+
+static bool hid_setup(struct usb_function *f, int fd,
+			struct usb_ctrlrequest *ctrl,
+			struct usb_raw_ep_io *io, uint32_t max) {
+	struct hid_function *hid = f->priv;
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		if (ctrl->bRequest != USB_REQ_GET_DESCRIPTOR)
+			return false;
+		switch (ctrl->wValue >> 8) {
+		case HID_DT_HID:
+			memcpy(&io->data[0], &hid->hid, sizeof(hid->hid));
+			io->length = sizeof(hid->hid);
+			return true;
+		case HID_DT_REPORT:
+			assert(hid->report_desc_len <= max);
+			memcpy(&io->data[0], hid->report_desc,
+						hid->report_desc_len);
+			io->length = hid->report_desc_len;
+			// Last request
+			atomic_store(&f->done, true);
+			return true;
+		}
+		return false;
+	case USB_TYPE_CLASS:
+		switch (ctrl->bRequest) {
+		case HID_REQ_SET_IDLE:
+		case HID_REQ_SET_PROTOCOL:
+		case HID_REQ_SET_REPORT:
+			io->length = 0;
+			return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+static void *hid_loop(void *arg) {
+	struct usb_function *f = arg;
+	struct hid_function *hid = f->priv;
+	int fd = hid->fd;
+	struct {
+		struct usb_raw_ep_io	inner;
+		char			data[HID_FUNCTION_REPORT_MAX];
+	} io;
+
+	while (!atomic_load(&f->done))
+		usleep(10000);
+
+	io.inner.ep = f->ep_handles[0];
+	io.inner.flags = 0;
+	io.inner.length = hid->report_len;
+
+	for (int i = 0; ; i = (i + 1) % hid->reports_num) {
+		memcpy(&io.data[0], hid->reports[i], hid->report_len);
+		int rv = usb_raw_ep_write_may_fail(fd,
+					(struct usb_raw_ep_io *)&io);
+		if (rv < 0 && errno == ESHUTDOWN) {
+			printf("%s: device was likely reset, exiting\n",
+								f->name);
+			break;
+		} else if (rv < 0) {
+			perror("usb_raw_ep_write_may_fail()");
+			exit(EXIT_FAILURE);
+		}
+		usleep(hid->period);
+	}
+
+	return NULL;
+}
+
+static void hid_enable(struct usb_function *f, int fd) {
+	struct hid_function *hid = f->priv;
+
+	hid->fd = fd;
+	int rv = pthread_create(&hid->thread, 0, hid_loop, f);
+	if (rv != 0) {
+		perror("pthread_create(hid)");
+		exit(EXIT_FAILURE);
+	}
+	hid->thread_spawned = true;
+	printf("ep0: %s: spawned ep_int_in thread\n", f->name);
+}
+
+static void hid_disable(struct usb_function *f, int fd) {
+	struct hid_function *hid = f->priv;
+
+	if (!hid->thread_spawned)
+		return;
+	printf("ep0: %s: stopping ep_int_in thread\n", f->name);
+	// The thread normally exits on ESHUTDOWN after a reset.
+	pthread_cancel(hid->thread);
+	int rv = pthread_join(hid->thread, NULL);
+	if (rv != 0) {
+		perror("pthread_join(hid)");
+		exit(EXIT_FAILURE);
+	}
+	hid->thread_spawned = false;
+}
+
+/*----------------------------------------------------------------------*/
+
+static const char keyboard_report_desc[] = {
+	0x05, 0x01,                    // Usage Page (Generic Desktop)        0
+	0x09, 0x06,                    // Usage (Keyboard)                    2
+	0xa1, 0x01,                    // Collection (Application)            4
+	0x05, 0x07,                    //  Usage Page (Keyboard)              6
+	0x19, 0xe0,                    //  Usage Minimum (224)                8
+	0x29, 0xe7,                    //  Usage Maximum (231)                10
+	0x15, 0x00,                    //  Logical Minimum (0)                12
+	0x25, 0x01,                    //  Logical Maximum (1)                14
+	0x75, 0x01,                    //  Report Size (1)                    16
+	0x95, 0x08,                    //  Report Count (8)                   18
+	0x81, 0x02,                    //  Input (Data,Var,Abs)               20
+	0x95, 0x01,                    //  Report Count (1)                   22
+	0x75, 0x08,                    //  Report Size (8)                    24
+	0x81, 0x01,                    //  Input (Cnst,Arr,Abs)               26
+	0x95, 0x03,                    //  Report Count (3)                   28
+	0x75, 0x01,                    //  Report Size (1)                    30
+	0x05, 0x08,                    //  Usage Page (LEDs)                  32
+	0x19, 0x01,                    //  Usage Minimum (1)                  34
+	0x29, 0x03,                    //  Usage Maximum (3)                  36
+	0x91, 0x02,                    //  Output (Data,Var,Abs)              38
+	0x95, 0x05,                    //  Report Count (5)                   40
+	0x75, 0x01,                    //  Report Size (1)                    42
+	0x91, 0x01,                    //  Output (Cnst,Arr,Abs)              44
+	0x95, 0x06,                    //  Report Count (6)                   46
+	0x75, 0x08,                    //  Report Size (8)                    48
+	0x15, 0x00,                    //  Logical Minimum (0)                50
+	0x26, 0xff, 0x00,              //  Logical Maximum (255)              52
+	0x05, 0x07,                    //  Usage Page (Keyboard)              55
+	0x19, 0x00,                    //  Usage Minimum (0)                  57
+	0x2a, 0xff, 0x00,              //  Usage Maximum (255)                59
+	0x81, 0x00,                    //  Input (Data,Arr,Abs)               62
+	0xc0,                          // End Collection                      64
+};
+
+// 'x' down, all keys up
+static const char keyboard_reports[][HID_FUNCTION_REPORT_MAX] = {
+	{ 0x00, 0x00, 0x1b, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
+
+struct hid_function keyboard_hid = {
+	.hid = {
+		.bLength =		9,
+		.bDescriptorType =	HID_DT_HID,
+		.bcdHID =		__constant_cpu_to_le16(0x0110),
+		.bCountryCode =		0,
+		.bNumDescriptors =	1,
+		.desc =			{
+			{
+				.bDescriptorType =	HID_DT_REPORT,
+				.wDescriptorLength =	sizeof(keyboard_report_desc),
+			}
+		},
+	},
+	.report_desc =		keyboard_report_desc,
+	.report_desc_len =	sizeof(keyboard_report_desc),
+	.reports =		keyboard_reports,
+	.reports_num =		2,
+	.report_len =		8,
+	.period =		200000,
+};
+
+static const char mouse_report_desc[] = {
+	0x05, 0x01,                    // Usage Page (Generic Desktop)		0
+	0x09, 0x02,                    // Usage (Mouse)				2
+	0xa1, 0x01,                    // Collection (Application)		4
+	0x09, 0x01,                    //  Usage (Pointer)			6
+	0xa1, 0x00,                    //    Collection (Physical)		8
+	0x05, 0x09,                    //      Usage Page (Buttons)		10
+	0x19, 0x01,                    //      Usage Minimum (1)		12
+	0x29, 0x03,                    //      Usage Maximum (3)		14
+	0x15, 0x00,                    //      Logical Minimum (0)		16
+	0x25, 0x01,                    //      Logical Maximum (1)		18
+	0x75, 0x01,                    //      Report Size (1)			20
+	0x95, 0x03,                    //      Report Count (3)			22
+	0x81, 0x02,                    //      Input (Data,Var,Abs)		24
+	0x75, 0x05,                    //      Report Size (5)			26
+	0x95, 0x01,                    //      Report Count (1)			28
+	0x81, 0x01,                    //      Input (Cnst,Arr,Abs)		30
+	0x05, 0x01,                    //      Usage Page (Generic Desktop)	32
+	0x09, 0x30,                    //      Usage (X)			34
+	0x09, 0x31,                    //      Usage (Y)			36
+	0x09, 0x38,                    //      Usage (Wheel)			38
+	0x15, 0x81,                    //      Logical Minimum (-127)		40
+	0x25, 0x7f,                    //      Logical Maximum (127)		42
+	0x75, 0x08,                    //      Report Size (8)			44
+	0x95, 0x03,                    //      Report Count (3)			46
+	0x81, 0x06,                    //      Input (Data,Var,Rel)		48
+	0xc0,                          //    End Collection			50
+	0xc0,                          // End Collection			51
+};
+
+// Right click, release, moves, scroll up and down
+static const char mouse_reports[][HID_FUNCTION_REPORT_MAX] = {
+	{ 0x02, 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x00, 0x00 },
+	{ 0x00, 0xff, 0x00, 0x00 },
+	{ 0x00, 0x00, 0xff, 0x00 },
+	{ 0x00, 0x00, 0x00, 0x01 },
+	{ 0x00, 0x00, 0x00, 0xff },
+};
+
+struct hid_function mouse_hid = {
+	.hid = {
+		.bLength =		9,
+		.bDescriptorType =	HID_DT_HID,
+		.bcdHID =		__constant_cpu_to_le16(0x0111),
+		.bCountryCode =		0,
+		.bNumDescriptors =	1,
+		.desc =			{
+			{
+				.bDescriptorType =	HID_DT_REPORT,
+				.wDescriptorLength =	sizeof(mouse_report_desc),
+			}
+		},
+	},
+	.report_desc =		mouse_report_desc,
+	.report_desc_len =	sizeof(mouse_report_desc),
+	.reports =		mouse_reports,
+	.reports_num =		6,
+	.report_len =		4,
+	.period =		300000,
+};
+
+struct usb_function keyboard_function = {
+	.name = "keyboard",
+	.interface = {
+		.bLength =		USB_DT_INTERFACE_SIZE,
+		.bDescriptorType =	USB_DT_INTERFACE,
+		.bAlternateSetting =	0,
+		.bNumEndpoints =	1,
+		.bInterfaceClass =	USB_CLASS_HID,
+		.bInterfaceSubClass =	1,
+		.bInterfaceProtocol =	1,
+		.iInterface =		STRING_ID_INTERFACE,
+	},
+	.class_desc =		&keyboard_hid.hid,
+	.class_desc_len =	sizeof(keyboard_hid.hid),
+	.eps = {
+		{
+			.bLength =		USB_DT_ENDPOINT_SIZE,
+			.bDescriptorType =	USB_DT_ENDPOINT,
+			.bEndpointAddress =	USB_DIR_IN,
+			.bmAttributes =		USB_ENDPOINT_XFER_INT,
+			.wMaxPacketSize =	EP_MAX_PACKET_KEYBOARD,
+			.bInterval =		5,
+		},
+	},
+	.eps_num =	1,
+	.setup =	hid_setup,
+	.enable =	hid_enable,
+	.disable =	hid_disable,
+	.priv =		&keyboard_hid,
+};
+
+struct usb_function mouse_function = {
+	.name = "mouse",
+	.interface = {
+		.bLength =		USB_DT_INTERFACE_SIZE,
+		.bDescriptorType =	USB_DT_INTERFACE,
+		.bAlternateSetting =	0,
+		.bNumEndpoints =	1,
+		.bInterfaceClass =	USB_CLASS_HID,
+		.bInterfaceSubClass =	1,
+		.bInterfaceProtocol =	2,
+		.iInterface =		STRING_ID_INTERFACE,
+	},
+	.class_desc =		&mouse_hid.hid,
+	.class_desc_len =	sizeof(mouse_hid.hid),
+	.eps = {
+		{
+			.bLength =		USB_DT_ENDPOINT_SIZE,
+			.bDescriptorType =	USB_DT_ENDPOINT,
+			.bEndpointAddress =	USB_DIR_IN,
+			.bmAttributes =		USB_ENDPOINT_XFER_INT,
+			.wMaxPacketSize =	EP_MAX_PACKET_MOUSE,
+			.bInterval =		10,
+		},
+	},
+	.eps_num =	1,
+	.setup =	hid_setup,
+	.enable =	hid_enable,
+	.disable =	hid_disable,
+	.priv =		&mouse_hid,
+};
+
+/*----------------------------------------------------------------------*/
+
+// Printer function: answers GET_DEVICE_ID (usblp puts the interface
+// number into the high byte of wIndex) and reads what the host prints.
+
+// Copy from linux/drivers/usb/gadget/legacy/printer.c
+const char printer_pnp_string[] = "MFG:linux;MDL:g_printer;CLS:PRINTER;SN:1;";
+
+struct printer_function {
+	int fd;
+	pthread_t thread;
+	bool thread_spawned;
+};
+
+static struct printer_function printer;
+
+static bool printer_setup(struct usb_function *f, int fd,
+			struct usb_ctrlrequest *ctrl,
+			struct usb_raw_ep_io *io, uint32_t max) {
+	if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_CLASS)
+		return false;
+
+	switch (ctrl->bRequest) {
+	case GET_DEVICE_ID: {
+		if ((ctrl->wIndex >> 8) != f->interface.bInterfaceNumber)
+			return false;
+		int value = strlen(printer_pnp_string);
+		memcpy(&io->data[0] + 2, printer_pnp_string, value);
+		value += 2;
+		io->data[0] = (value >> 8) & 0xFF;
+		io->data[1] = value & 0xFF;
+		io->length = value;
+		// Last request
+		atomic_store(&f->done, true);
+		return true;
+	}
+	case GET_PORT_STATUS:
+		if ((ctrl->wIndex & 0xff) != f->interface.bInterfaceNumber)
+			return false;
+		io->data[0] = 0x18;	// selected, no error
+		io->length = 1;
+		return true;
+	case SOFT_RESET:
+		if ((ctrl->wIndex & 0xff) != f->interface.bInterfaceNumber)
+			return false;
+		io->length = 0;
+		return true;
+	}
+	return false;
+}
+
+static void *printer_loop(void *arg) {
+	struct usb_function *f = arg;
+	struct {
+		struct usb_raw_ep_io	inner;
+		char			data[EP_MAX_PACKET_BULK];
+	} io;
+
+	while (true) {
+		io.inner.ep = f->ep_handles[0];
+		io.inner.flags = 0;
+		io.inner.length = sizeof(io.data);
+
+		int rv = ioctl(printer.fd, USB_RAW_IOCTL_EP_READ, &io);
+		if (rv < 0 && errno == ESHUTDOWN) {
+			printf("printer: device was likely reset, exiting\n");
+			break;
+		} else if (rv < 0) {
+			perror("ioctl(USB_RAW_IOCTL_EP_READ)");
+			exit(EXIT_FAILURE);
+		}
+		printf("printer: bulk_out: read %d bytes\n", rv);
+	}
+
+	return NULL;
+}
+
+static void printer_enable(struct usb_function *f, int fd) {
+	printer.fd = fd;
+	int rv = pthread_create(&printer.thread, 0, printer_loop, f);
+	if (rv != 0) {
+		perror("pthread_create(printer)");
+		exit(EXIT_FAILURE);
+	}
+	printer.thread_spawned = true;
+	printf("ep0: printer: spawned ep_bulk_out thread\n");
+}
+
+static void printer_disable(struct usb_function *f, int fd) {
+	if (!printer.thread_spawned)
+		return;
+	printf("ep0: printer: stopping ep_bulk_out thread\n");
+	pthread_cancel(printer.thread);
+	int rv = pthread_join(printer.thread, NULL);
+	if (rv != 0) {
+		perror("pthread_join(printer)");
+		exit(EXIT_FAILURE);
+	}
+	printer.thread_spawned = false;
+}
+
+struct usb_function printer_function = {
+	.name = "printer",
+	.interface = {
+		.bLength =		USB_DT_INTERFACE_SIZE,
+		.bDescriptorType =	USB_DT_INTERFACE,
+		.bAlternateSetting =	0,
+		.bNumEndpoints =	2,
+		.bInterfaceClass =	USB_CLASS_PRINTER,
+		.bInterfaceSubClass =	1,
+		.bInterfaceProtocol =	2,
+		.iInterface =		STRING_ID_INTERFACE,
+	},
+	.eps = {
+		{
+			.bLength =		USB_DT_ENDPOINT_SIZE,
+			.bDescriptorType =	USB_DT_ENDPOINT,
+			.bEndpointAddress =	USB_DIR_OUT,
+			.bmAttributes =		USB_ENDPOINT_XFER_BULK,
+			.wMaxPacketSize =	EP_MAX_PACKET_BULK,
+		},
+		{
+			.bLength =		USB_DT_ENDPOINT_SIZE,
+			.bDescriptorType =	USB_DT_ENDPOINT,
+			.bEndpointAddress =	USB_DIR_IN,
+			.bmAttributes =		USB_ENDPOINT_XFER_BULK,
+			.wMaxPacketSize =	EP_MAX_PACKET_BULK,
+		},
+	},
+	.eps_num =	2,
+	.setup =	printer_setup,
+	.enable =	printer_enable,
+	.disable =	printer_disable,
+	.priv =		&printer,
+};
+
+/*----------------------------------------------------------------------*/
+
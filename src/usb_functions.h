@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Function definitions shared by the keyboard, mouse and printer gadgets
+// and the composite gadget.
+//
+// Each function is a struct usb_function: its interface, class
+// descriptors and endpoints as the standalone gadget describes them, and
+// the setup/enable/disable callbacks usb_composite_ep0_loop() uses. The
+// standalone gadgets serve ep0 and their endpoints themselves and only
+// take the descriptors (and report data) from here, so a change to a
+// function's descriptors reaches both.
+
+#ifndef _USB_FUNCTIONS_H
+#define _USB_FUNCTIONS_H
+
+#include "usb_gadget_tests.h"
+
+#include <linux/hid.h>
+
+/*----------------------------------------------------------------------*/
+
+struct hid_class_descriptor {
+	__u8  bDescriptorType;
+	__le16 wDescriptorLength;
+} __attribute__ ((packed));
+
+struct hid_descriptor {
+	__u8  bLength;
+	__u8  bDescriptorType;
+	__le16 bcdHID;
+	__u8  bCountryCode;
+	__u8  bNumDescriptors;
+
+	struct hid_class_descriptor desc[1];
+} __attribute__ ((packed));
+
+// Printer class requests
+#define GET_DEVICE_ID		0
+#define GET_PORT_STATUS		1
+#define SOFT_RESET		2
+
+/*----------------------------------------------------------------------*/
+
+// HID functions: the report descriptor is served on request, and once the
+// host has fetched it the reports are sent in a loop, one every period.
+
+#define HID_FUNCTION_REPORT_MAX	8
+
+struct hid_function {
+	struct hid_descriptor hid;
+	const char *report_desc;
+	int report_desc_len;
+	const char (*reports)[HID_FUNCTION_REPORT_MAX];
+	int reports_num;
+	int report_len;
+	useconds_t period;
+	int fd;
+	pthread_t thread;
+	bool thread_spawned;
+};
+
+extern struct hid_function keyboard_hid;
+extern struct hid_function mouse_hid;
+
+// IEEE 1284 device ID returned for GET_DEVICE_ID
+extern const char printer_pnp_string[];
+
+// Interface numbers and endpoint numbers are 0 until the gadget assigns
+// them; bNumEndpoints is preset for the standalone gadgets.
+extern struct usb_function keyboard_function;
+extern struct usb_function mouse_function;
+// Endpoints: bulk OUT, then bulk IN.
+extern struct usb_function printer_function;
+
+/*----------------------------------------------------------------------*/
+
+#endif /* _USB_FUNCTIONS_H */
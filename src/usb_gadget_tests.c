@@ -1,5 +1,46 @@
+// CPU_SET(), pthread_setaffinity_np()
+#define _GNU_SOURCE
+
 #include "usb_gadget_tests.h"
 
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <linux/kcov.h>
+#include <linux/netlink.h>
+
+#include <linux/input.h>
+
+/*----------------------------------------------------------------------*/
+
+static int64_t input_latency_submit(struct usb_raw_ep_io *io);
+static void    input_latency_complete(int64_t slot, int rv);
+static void    dev_watch_start(int fd, const char *udc);
+static void    dev_watch_bind(int fd);
+static void    dev_watch_set_id(int fd, uint16_t vendor, uint16_t product);
+static void    kcov_start(const char *udc);
+
+/*----------------------------------------------------------------------*/
+
+// SIGUSR1 asks for a framebuffer snapshot (--fb-snapshot) and only the
+// fb_track thread waits for it. Every thread the library starts blocks it
+// first, so a SIGUSR1 never lands in one of them with the default action
+// (terminate), whichever of them was started before fb_track_start().
+static void block_sigusr1(void) {
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
 /*----------------------------------------------------------------------*/
 
 int usb_raw_open() {
@@ -11,11 +52,770 @@ int usb_raw_open() {
 	return fd;
 }
 
+/*----------------------------------------------------------------------*/
+
+// --speed: the gadget's descriptors are written for the speed it passes to
+// usb_raw_init(). When another speed is requested, device, configuration
+// and endpoint descriptors are adapted on their way to the host and to
+// USB_RAW_IOCTL_EP_ENABLE, and the requests that only exist because of
+// the new speed (BOS at SuperSpeed, device qualifier below high speed)
+// are answered here without reaching the gadget.
+
+// Speeds of each raw-gadget fd: with --instances one process runs several.
+struct speed_state {
+	int fd;
+	enum usb_device_speed native;
+	enum usb_device_speed actual;
+};
+
+#define SPEED_STATES_MAX	32	// dummy_hcd allows num=32
+
+static struct speed_state speed_states[SPEED_STATES_MAX];
+static unsigned speed_nstates;
+static pthread_mutex_t speed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Last control request fetched on ep0, to tell what ep0 data carries.
+// Per thread, as with --instances each gadget instance runs its own ep0.
+static __thread struct usb_ctrlrequest speed_ctrl;
+
+// Entries are only added, so lookups don't take speed_lock.
+static const struct speed_state *speed_get(int fd) {
+	static const struct speed_state none = {
+		.native = USB_SPEED_UNKNOWN,
+		.actual = USB_SPEED_UNKNOWN,
+	};
+	unsigned n = __atomic_load_n(&speed_nstates, __ATOMIC_ACQUIRE);
+
+	for (unsigned i = 0; i < n; i++)
+		if (speed_states[i].fd == fd)
+			return &speed_states[i];
+	return &none;
+}
+
+static void speed_set(int fd, enum usb_device_speed native,
+				enum usb_device_speed actual) {
+	struct speed_state *st = NULL;
+
+	pthread_mutex_lock(&speed_lock);
+	for (unsigned i = 0; i < speed_nstates; i++)
+		if (speed_states[i].fd == fd)
+			st = &speed_states[i];
+	if (!st) {
+		if (speed_nstates == SPEED_STATES_MAX) {
+			printf("fail: more than %d raw-gadget instances\n",
+							SPEED_STATES_MAX);
+			exit(EXIT_FAILURE);
+		}
+		st = &speed_states[speed_nstates];
+	}
+	st->fd = fd;
+	st->native = native;
+	st->actual = actual;
+	if (st == &speed_states[speed_nstates])
+		__atomic_store_n(&speed_nstates, speed_nstates + 1,
+							__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&speed_lock);
+}
+
+static bool speed_adjusted(const struct speed_state *st) {
+	return st->actual != st->native;
+}
+
+static bool speed_is_high(enum usb_device_speed speed) {
+	return speed >= USB_SPEED_HIGH;
+}
+
+// Interrupt polling period in microseconds for bInterval at the given speed
+static uint32_t speed_interval_us(enum usb_device_speed speed, uint8_t n) {
+	if (!speed_is_high(speed))
+		return (n ? n : 1) * 1000;
+	n = n < 1 ? 1 : n > 16 ? 16 : n;
+	return 125u << (n - 1);
+}
+
+static uint8_t speed_interval(enum usb_device_speed speed, uint32_t us) {
+	if (!speed_is_high(speed)) {
+		uint32_t frames = us / 1000;
+		return frames < 1 ? 1 : frames > 255 ? 255 : frames;
+	}
+	uint8_t n = 1;
+	while (n < 16 && (125u << n) <= us)
+		n++;
+	return n;
+}
+
+static void speed_adjust_endpoint(const struct speed_state *st,
+				struct usb_endpoint_descriptor *desc) {
+	uint16_t maxp = __le16_to_cpu(desc->wMaxPacketSize);
+	uint16_t mult = st->actual == USB_SPEED_HIGH ? maxp & 0x1800 : 0;
+	uint16_t size = maxp & 0x7ff;
+
+	switch (desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) {
+	case USB_ENDPOINT_XFER_BULK:
+		// Bulk is not allowed at low speed; dummy_hcd rejects it.
+		if (st->actual == USB_SPEED_FULL) {
+			uint16_t p = 8;
+			while (p < 64 && p * 2 <= size)
+				p *= 2;
+			size = p;
+		} else if (st->actual == USB_SPEED_HIGH) {
+			size = 512;
+		} else if (st->actual >= USB_SPEED_SUPER) {
+			size = 1024;
+		}
+		break;
+	case USB_ENDPOINT_XFER_INT:
+		if (st->actual == USB_SPEED_LOW && size > 8)
+			size = 8;
+		else if (st->actual == USB_SPEED_FULL && size > 64)
+			size = 64;
+		else if (size > 1024)
+			size = 1024;
+		if (speed_is_high(st->native) != speed_is_high(st->actual))
+			desc->bInterval = speed_interval(st->actual,
+				speed_interval_us(st->native, desc->bInterval));
+		break;
+	case USB_ENDPOINT_XFER_ISOC:
+		if (st->actual == USB_SPEED_FULL && size > 1023)
+			size = 1023;
+		else if (size > 1024)
+			size = 1024;
+		break;
+	default:
+		return;
+	}
+
+	desc->wMaxPacketSize = __cpu_to_le16(mult | size);
+}
+
+static void speed_adjust_device(const struct speed_state *st,
+				struct usb_device_descriptor *desc) {
+	uint16_t bcd = __le16_to_cpu(desc->bcdUSB);
+
+	switch (st->actual) {
+	case USB_SPEED_LOW:
+		desc->bMaxPacketSize0 = 8;
+		break;
+	case USB_SPEED_HIGH:
+		desc->bMaxPacketSize0 = 64;
+		break;
+	case USB_SPEED_SUPER:
+	case USB_SPEED_SUPER_PLUS:
+		desc->bMaxPacketSize0 = 9;	// 2^9 = 512
+		if (bcd < 0x0300)
+			bcd = 0x0300;
+		break;
+	default:
+		break;
+	}
+	if (!speed_is_high(st->actual) && bcd > 0x0200)
+		bcd = 0x0200;
+	desc->bcdUSB = __cpu_to_le16(bcd);
+}
+
+// Adapts descriptors sent in reply to GET_DESCRIPTOR. A reply may be
+// truncated to wLength, so only complete descriptors are touched.
+static void speed_adjust_ep0_data(const struct speed_state *st,
+				uint8_t *data, uint32_t length) {
+	if ((speed_ctrl.bRequestType & (USB_DIR_IN | USB_TYPE_MASK)) !=
+			(USB_DIR_IN | USB_TYPE_STANDARD) ||
+			speed_ctrl.bRequest != USB_REQ_GET_DESCRIPTOR)
+		return;
+
+	switch (speed_ctrl.wValue >> 8) {
+	case USB_DT_DEVICE: {
+		// The host reads the first 8 bytes alone for bMaxPacketSize0.
+		struct usb_device_descriptor desc = {0};
+		uint32_t len = length < sizeof(desc) ? length : sizeof(desc);
+		memcpy(&desc, data, len);
+		speed_adjust_device(st, &desc);
+		memcpy(data, &desc, len);
+		break;
+	}
+	case USB_DT_CONFIG:
+	case USB_DT_OTHER_SPEED_CONFIG:
+		for (uint32_t off = 0; off + 2 <= length && data[off] >= 2;
+							off += data[off]) {
+			if (data[off + 1] == USB_DT_ENDPOINT &&
+					off + USB_DT_ENDPOINT_SIZE <= length)
+				speed_adjust_endpoint(st,
+					(struct usb_endpoint_descriptor *)&data[off]);
+		}
+		break;
+	}
+}
+
+// At SuperSpeed every endpoint descriptor of a configuration is followed
+// by a SuperSpeed Endpoint Companion descriptor. The gadgets build the
+// whole configuration into their reply buffer before cutting io->length to
+// wLength, so the configuration is rebuilt from its full wTotalLength with
+// the endpoints adapted and a companion after each, and cut to wLength
+// again. Returns the io to send: out, or io when nothing was added.
+
+#define SPEED_CONFIG_MAX	4096
+
+struct speed_config_io {
+	struct usb_raw_ep_io inner;
+	uint8_t data[SPEED_CONFIG_MAX];
+};
+
+static struct usb_raw_ep_io *speed_ss_config(const struct speed_state *st,
+			struct usb_raw_ep_io *io, struct speed_config_io *out) {
+	const uint8_t *data = io->data;
+	uint32_t total, off, len = 0;
+
+	if (st->actual < USB_SPEED_SUPER ||
+			speed_ctrl.bRequestType != USB_DIR_IN ||
+			speed_ctrl.bRequest != USB_REQ_GET_DESCRIPTOR ||
+			(speed_ctrl.wValue >> 8) != USB_DT_CONFIG ||
+			io->length < USB_DT_CONFIG_SIZE)
+		return io;
+	total = data[2] | (data[3] << 8);
+
+	for (off = 0; off + 2 <= total && data[off] >= 2; off += data[off]) {
+		uint8_t size = data[off];
+
+		// Already has companions.
+		if (data[off + 1] == USB_DT_SS_ENDPOINT_COMP)
+			return io;
+		if (off + size > total || len + size +
+				USB_DT_SS_EP_COMP_SIZE > sizeof(out->data)) {
+			printf("fail: configuration too long for companions\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(&out->data[len], &data[off], size);
+		if (data[off + 1] != USB_DT_ENDPOINT ||
+				size < USB_DT_ENDPOINT_SIZE) {
+			len += size;
+			continue;
+		}
+
+		struct usb_endpoint_descriptor *ep = (void *)&out->data[len];
+		struct usb_ss_ep_comp_descriptor comp = {
+			.bLength = USB_DT_SS_EP_COMP_SIZE,
+			.bDescriptorType = USB_DT_SS_ENDPOINT_COMP,
+		};
+		speed_adjust_endpoint(st, ep);
+		// One packet per service interval, no bursts or streams.
+		if (usb_endpoint_xfer_int(ep) || usb_endpoint_xfer_isoc(ep))
+			comp.wBytesPerInterval = ep->wMaxPacketSize;
+		len += size;
+		memcpy(&out->data[len], &comp, sizeof(comp));
+		len += sizeof(comp);
+	}
+
+	((struct usb_config_descriptor *)out->data)->wTotalLength =
+							__cpu_to_le16(len);
+	out->inner.ep = io->ep;
+	out->inner.flags = io->flags;
+	out->inner.length = __le16_to_cpu(speed_ctrl.wLength) < len ?
+				__le16_to_cpu(speed_ctrl.wLength) : len;
+	return &out->inner;
+}
+
+struct speed_bos {
+	struct usb_bos_descriptor bos;
+	struct usb_ext_cap_descriptor ext;
+	struct usb_ss_cap_descriptor ss;
+} __attribute__ ((packed));
+
+// Answers control requests that exist only because of --speed. Returns
+// false for requests that are left to the gadget. Nothing is printed:
+// the requests answered here never reach the gadget, so its output only
+// holds what the gadget itself handled.
+static bool speed_ep0_request(int fd, struct usb_raw_event *event) {
+	struct usb_ctrlrequest *ctrl = (struct usb_ctrlrequest *)event->data;
+	const struct speed_state *st = speed_get(fd);
+	struct {
+		struct usb_raw_ep_io inner;
+		struct speed_bos data;
+	} io;
+
+	if (!speed_adjusted(st) || event->type != USB_RAW_EVENT_CONTROL ||
+			ctrl->bRequestType != USB_DIR_IN ||
+			ctrl->bRequest != USB_REQ_GET_DESCRIPTOR)
+		return false;
+
+	switch (ctrl->wValue >> 8) {
+	case USB_DT_DEVICE_QUALIFIER:
+		// A device that is not high-speed capable has no qualifier.
+		if (speed_is_high(st->actual))
+			return false;
+		usb_raw_ep0_stall(fd);
+		return true;
+	case USB_DT_BOS:
+		// Required from SuperSpeed devices (bcdUSB 0x0300).
+		if (st->actual < USB_SPEED_SUPER)
+			return false;
+		io.data = (struct speed_bos) {
+			.bos = {
+				.bLength = USB_DT_BOS_SIZE,
+				.bDescriptorType = USB_DT_BOS,
+				.wTotalLength = __cpu_to_le16(sizeof(io.data)),
+				.bNumDeviceCaps = 2,
+			},
+			.ext = {
+				.bLength = USB_DT_USB_EXT_CAP_SIZE,
+				.bDescriptorType = USB_DT_DEVICE_CAPABILITY,
+				.bDevCapabilityType = USB_CAP_TYPE_EXT,
+			},
+			.ss = {
+				.bLength = USB_DT_USB_SS_CAP_SIZE,
+				.bDescriptorType = USB_DT_DEVICE_CAPABILITY,
+				.bDevCapabilityType = USB_SS_CAP_TYPE,
+				.wSpeedSupported = __cpu_to_le16(USB_FULL_SPEED_OPERATION |
+						USB_HIGH_SPEED_OPERATION |
+						USB_5GBPS_OPERATION),
+				.bFunctionalitySupport = USB_LOW_SPEED_OPERATION,
+				.bU1devExitLat = 0x01,
+				.bU2DevExitLat = __cpu_to_le16(0x01f4),
+			},
+		};
+		io.inner.ep = 0;
+		io.inner.flags = 0;
+		io.inner.length = ctrl->wLength < sizeof(io.data) ?
+					ctrl->wLength : sizeof(io.data);
+		int rv = ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io);
+		if (rv < 0) {
+			perror("ioctl(USB_RAW_IOCTL_EP0_WRITE)");
+			exit(EXIT_FAILURE);
+		}
+		return true;
+	}
+	return false;
+}
+
+/*----------------------------------------------------------------------*/
+
+// --fuzz: every enumeration runs in a child forked from
+// usb_gadget_parse_args(), so the gadget is set up without exec and with
+// a fresh raw-gadget instance each time. The child applies seeded
+// mutations to the data the gadget returns on ep0 (device, configuration,
+// interface, endpoint and class descriptors and class responses) and is
+// ended by SIGALRM after the enumeration window, or FUZZ_SETTLE_MS after
+// SET_CONFIGURATION. Closing raw-gadget disconnects the device, and the
+// parent forks the next iteration with the next seed. Kernel reports are
+// picked up from /dev/kmsg after each iteration.
+
+#define FUZZ_DATA_MAX		4096
+#define FUZZ_CHAIN_MAX		64
+#define FUZZ_SETTLE_MS		100
+#define FUZZ_STATS_MS		1000
+
+// Zero while not fuzzing.
+static uint64_t fuzz_state;
+
+static const char *const fuzz_kmsg_patterns[] = {
+	"BUG:", "WARNING:", "KASAN:", "UBSAN:", "KMSAN:", "Oops",
+	"general protection fault", "kernel BUG", "INFO: task",
+	"Kernel panic",
+};
+
+static const uint8_t fuzz_bytes[] = {
+	0x00, 0x01, 0x02, 0x03, 0x07, 0x08, 0x0f, 0x10, 0x40,
+	0x7f, 0x80, 0x81, 0xfe, 0xff,
+};
+
+static const uint16_t fuzz_words[] = {
+	0x0000, 0x0001, 0x0008, 0x0009, 0x0040, 0x0200, 0x0400,
+	0x07ff, 0x1800, 0x7fff, 0x8000, 0xffff,
+};
+
+// Descriptor fields worth mutating, by descriptor type.
+struct fuzz_field {
+	uint8_t type;
+	uint8_t offset;
+	uint8_t size;
+};
+
+static const struct fuzz_field fuzz_fields[] = {
+	{ USB_DT_DEVICE,	2,	2 },	// bcdUSB
+	{ USB_DT_DEVICE,	4,	1 },	// bDeviceClass
+	{ USB_DT_DEVICE,	7,	1 },	// bMaxPacketSize0
+	{ USB_DT_DEVICE,	17,	1 },	// bNumConfigurations
+	{ USB_DT_CONFIG,	2,	2 },	// wTotalLength
+	{ USB_DT_CONFIG,	4,	1 },	// bNumInterfaces
+	{ USB_DT_CONFIG,	5,	1 },	// bConfigurationValue
+	{ USB_DT_CONFIG,	7,	1 },	// bmAttributes
+	{ USB_DT_INTERFACE,	2,	1 },	// bInterfaceNumber
+	{ USB_DT_INTERFACE,	3,	1 },	// bAlternateSetting
+	{ USB_DT_INTERFACE,	4,	1 },	// bNumEndpoints
+	{ USB_DT_INTERFACE,	5,	1 },	// bInterfaceClass
+	{ USB_DT_INTERFACE,	6,	1 },	// bInterfaceSubClass
+	{ USB_DT_INTERFACE,	7,	1 },	// bInterfaceProtocol
+	{ USB_DT_ENDPOINT,	2,	1 },	// bEndpointAddress
+	{ USB_DT_ENDPOINT,	3,	1 },	// bmAttributes
+	{ USB_DT_ENDPOINT,	4,	2 },	// wMaxPacketSize
+	{ USB_DT_ENDPOINT,	6,	1 },	// bInterval
+	{ 0x21,			5,	1 },	// HID bNumDescriptors
+	{ 0x21,			6,	1 },	// HID bDescriptorType
+	{ 0x21,			7,	2 },	// HID wDescriptorLength
+};
+
+#define ARRAY_LEN(a)	(sizeof(a) / sizeof((a)[0]))
+
+// xorshift64*
+static uint64_t fuzz_next(void) {
+	fuzz_state ^= fuzz_state >> 12;
+	fuzz_state ^= fuzz_state << 25;
+	fuzz_state ^= fuzz_state >> 27;
+	return fuzz_state * 0x2545f4914f6cdd1dull;
+}
+
+static uint32_t fuzz_rand(uint32_t n) {
+	return n ? fuzz_next() % n : 0;
+}
+
+// splitmix64, so that neighbouring seeds give unrelated streams.
+static void fuzz_seed(uint64_t seed) {
+	uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	fuzz_state = (z ^ (z >> 31)) | 1;
+}
+
+static void fuzz_value(uint8_t *p, uint8_t size) {
+	uint16_t v = size == 2 ? p[0] | (p[1] << 8) : p[0];
+
+	switch (fuzz_rand(4)) {
+	case 0:
+		v = size == 2 ? fuzz_words[fuzz_rand(ARRAY_LEN(fuzz_words))] :
+				fuzz_bytes[fuzz_rand(ARRAY_LEN(fuzz_bytes))];
+		break;
+	case 1:
+		v += fuzz_rand(2) ? 1 : -1;
+		break;
+	case 2:
+		v ^= 1 << fuzz_rand(size * 8);
+		break;
+	case 3:
+		v = fuzz_next();
+		break;
+	}
+	p[0] = v;
+	if (size == 2)
+		p[1] = v >> 8;
+}
+
+// Offsets of the descriptors in a reply that is a chain of descriptors.
+// Returns 0 if data does not parse as one.
+static int fuzz_chain(const uint8_t *data, uint32_t length, uint32_t *offs) {
+	uint32_t off = 0;
+	int n = 0;
+
+	while (off + 2 <= length && n < FUZZ_CHAIN_MAX) {
+		if (data[off] < 2 || off + data[off] > length)
+			return 0;
+		offs[n++] = off;
+		off += data[off];
+	}
+	return off == length ? n : 0;
+}
+
+// Mutates a field of the descriptor at data, by its type; bLength and
+// bDescriptorType of any descriptor are candidates too.
+static void fuzz_mutate_desc(uint8_t *data, uint32_t avail) {
+	const struct fuzz_field *cand[ARRAY_LEN(fuzz_fields)];
+	uint32_t len = data[0] < avail ? data[0] : avail;
+	int n = 0;
+
+	for (size_t i = 0; i < ARRAY_LEN(fuzz_fields); i++) {
+		const struct fuzz_field *f = &fuzz_fields[i];
+		if (f->type == data[1] && f->offset + f->size <= len)
+			cand[n++] = f;
+	}
+
+	if (n && fuzz_rand(4)) {
+		const struct fuzz_field *f = cand[fuzz_rand(n)];
+		fuzz_value(&data[f->offset], f->size);
+	} else if (fuzz_rand(2) || len <= 2) {
+		fuzz_value(&data[fuzz_rand(2)], 1);
+	} else {
+		// Class-specific or unlisted field
+		fuzz_value(&data[2 + fuzz_rand(len - 2)], 1);
+	}
+}
+
+// Applies one mutation to the reply in data, which holds length bytes and
+// may grow up to cap.
+static void fuzz_mutate(uint8_t *data, uint32_t *length, uint32_t cap) {
+	uint32_t offs[FUZZ_CHAIN_MAX];
+	int n = fuzz_chain(data, *length, offs);
+	uint32_t len = *length;
+
+	switch (fuzz_rand(n ? 8 : 4)) {
+	case 0:
+		// Truncated reply
+		*length = fuzz_rand(len);
+		return;
+	case 1:
+		// Trailing garbage
+		if (len < cap) {
+			uint32_t extra = 1 + fuzz_rand(cap - len < 64 ?
+							cap - len : 64);
+			for (uint32_t i = 0; i < extra; i++)
+				data[len + i] = fuzz_next();
+			*length = len + extra;
+		}
+		return;
+	case 2:
+	case 3:
+		if (!len)
+			return;
+		if (!n) {
+			uint32_t off = fuzz_rand(len);
+			if (off + 1 < len && fuzz_rand(2))
+				fuzz_value(&data[off], 2);
+			else
+				fuzz_value(&data[off], 1);
+			return;
+		}
+		// fall through
+	case 4:
+	case 5: {
+		int i = fuzz_rand(n);
+		fuzz_mutate_desc(&data[offs[i]], len - offs[i]);
+		return;
+	}
+	case 6: {
+		// Duplicated descriptor
+		int i = fuzz_rand(n);
+		uint32_t dlen = data[offs[i]];
+		if (len + dlen > cap)
+			return;
+		memmove(&data[offs[i] + dlen], &data[offs[i]],
+						len - offs[i]);
+		*length = len + dlen;
+		return;
+	}
+	case 7: {
+		// Dropped descriptor
+		int i = fuzz_rand(n);
+		uint32_t dlen = data[offs[i]];
+		memmove(&data[offs[i]], &data[offs[i] + dlen],
+					len - offs[i] - dlen);
+		*length = len - dlen;
+		return;
+	}
+	}
+}
+
+// Sends a mutated copy of an ep0 IN reply; half of the replies go out
+// unchanged so that enumeration gets far enough to reach class code.
+static int fuzz_ep0_write(int fd, struct usb_raw_ep_io *io) {
+	static struct {
+		struct usb_raw_ep_io inner;
+		uint8_t data[FUZZ_DATA_MAX];
+	} copy;
+	uint32_t cap = speed_ctrl.wLength < FUZZ_DATA_MAX ?
+				speed_ctrl.wLength : FUZZ_DATA_MAX;
+
+	if (io->length > cap || fuzz_rand(2))
+		return ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, io);
+
+	copy.inner = *io;
+	memcpy(copy.data, io->data, io->length);
+	for (int i = 1 + fuzz_rand(3); i > 0; i--)
+		fuzz_mutate(copy.data, &copy.inner.length, cap);
+	return ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &copy);
+}
+
+// Called on SET_CONFIGURATION: the host has accepted the descriptors,
+// give the class driver FUZZ_SETTLE_MS to probe.
+static void fuzz_configured(void) {
+	struct itimerval it = {
+		.it_value = { .tv_usec = FUZZ_SETTLE_MS * 1000 },
+	};
+	struct itimerval old;
+
+	getitimer(ITIMER_REAL, &old);
+	if (timercmp(&old.it_value, &it.it_value, >))
+		setitimer(ITIMER_REAL, &it, NULL);
+}
+
+// Reads the kernel log records that arrived since the last call and
+// prints those that look like a crash or warning. Returns their number.
+static int fuzz_kmsg_scan(int kmsg, uint64_t iteration, uint64_t seed) {
+	char rec[1024];
+	int found = 0;
+
+	while (kmsg >= 0) {
+		ssize_t len = read(kmsg, rec, sizeof(rec) - 1);
+		if (len < 0 && errno == EPIPE)
+			continue;	// overwritten records
+		if (len <= 0)
+			break;
+		rec[len] = 0;
+		char *msg = strchr(rec, ';');
+		msg = msg ? msg + 1 : rec;
+		msg[strcspn(msg, "\n")] = 0;
+		for (size_t i = 0; i < ARRAY_LEN(fuzz_kmsg_patterns); i++) {
+			if (strstr(msg, fuzz_kmsg_patterns[i])) {
+				printf("[fuzz] iteration %llu (--fuzz=%llu,1): "
+					"%s\n", (unsigned long long)iteration,
+					(unsigned long long)seed, msg);
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+static void fuzz_stats(uint64_t execs, uint64_t start_ns,
+			unsigned reports, unsigned crashes) {
+	double sec = (monotonic_ns() - start_ns) / 1e9;
+	printf("[fuzz] %llu execs in %.1f s, %.1f/s, %u kernel reports, "
+		"%u gadget crashes\n", (unsigned long long)execs, sec,
+		sec > 0 ? execs / sec : 0, reports, crashes);
+}
+
+// Runs the iterations; returns only in the children.
+static void fuzz_run(void) {
+	uint64_t seed = usb_gadget_opts.fuzz_seed;
+	uint64_t iterations = usb_gadget_opts.fuzz_iterations;
+	int kmsg = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	uint64_t start = monotonic_ns(), last_stats = start;
+	unsigned reports = 0, crashes = 0;
+	uint64_t i;
+
+	if (kmsg < 0)
+		perror("[fuzz] open(/dev/kmsg), kernel reports not detected");
+	else
+		lseek(kmsg, 0, SEEK_END);
+	fflush(stdout);
+
+	for (i = 0; !iterations || i < iterations; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork()");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			struct itimerval it = {
+				.it_value = {
+					.tv_sec = usb_gadget_opts.fuzz_window_ms / 1000,
+					.tv_usec = usb_gadget_opts.fuzz_window_ms % 1000 * 1000,
+				},
+			};
+			if (kmsg >= 0)
+				close(kmsg);
+			// A single iteration is a replay, keep its log.
+			if (iterations != 1) {
+				int null = open("/dev/null", O_WRONLY);
+				dup2(null, STDOUT_FILENO);
+				dup2(null, STDERR_FILENO);
+				close(null);
+			}
+			fuzz_seed(seed + i);
+			setitimer(ITIMER_REAL, &it, NULL);
+			return;
+		}
+
+		int status;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		if (WIFSIGNALED(status) && WTERMSIG(status) != SIGALRM) {
+			printf("[fuzz] iteration %llu (--fuzz=%llu,1): gadget "
+				"killed by signal %d\n", (unsigned long long)i,
+				(unsigned long long)(seed + i), WTERMSIG(status));
+			crashes++;
+		}
+		reports += fuzz_kmsg_scan(kmsg, i, seed + i);
+
+		uint64_t now = monotonic_ns();
+		if (now - last_stats >= FUZZ_STATS_MS * 1000000ull) {
+			fuzz_stats(i + 1, start, reports, crashes);
+			last_stats = now;
+		}
+	}
+
+	fuzz_stats(i, start, reports, crashes);
+	exit(reports || crashes ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*----------------------------------------------------------------------*/
+
+// --cpu, --rt-prio: applied in usb_raw_init() to the calling thread, which
+// runs ep0 or creates the thread that does. Endpoint threads started from
+// there inherit the CPU affinity and the SCHED_FIFO policy, while the
+// library's monitor threads started earlier (output verifier, uevent and
+// kcov readers) keep the default scheduling.
+
+static cpu_set_t sched_cpus;
+
+// Parses a CPU list like "0,2-3" into sched_cpus.
+static bool sched_parse_cpus(const char *list) {
+	CPU_ZERO(&sched_cpus);
+	while (*list) {
+		char *end;
+		long first = strtol(list, &end, 10), last = first;
+		if (end == list)
+			return false;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list)
+				return false;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			return false;
+		for (long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, &sched_cpus);
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return false;
+		list = end;
+	}
+	return CPU_COUNT(&sched_cpus) > 0;
+}
+
+static void sched_apply(void) {
+	if (usb_gadget_opts.cpu_list) {
+		int rv = pthread_setaffinity_np(pthread_self(),
+					sizeof(sched_cpus), &sched_cpus);
+		if (rv) {
+			errno = rv;
+			perror("pthread_setaffinity_np()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (usb_gadget_opts.rt_prio) {
+		struct sched_param param = {
+			.sched_priority = usb_gadget_opts.rt_prio,
+		};
+		int rv = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+						&param);
+		if (rv) {
+			errno = rv;
+			perror("pthread_setschedparam(SCHED_FIFO)");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+// Set by usb_gadget_instances()
+static bool instances_supported;
+
 void usb_raw_init(int fd, enum usb_device_speed speed,
 			const char *driver, const char *device) {
 	struct usb_raw_init arg;
+	if (usb_gadget_opts.instances > 1 && !instances_supported) {
+		printf("fail: --instances is not supported by this gadget\n");
+		exit(EXIT_FAILURE);
+	}
 	strcpy((char *)&arg.driver_name[0], driver);
 	strcpy((char *)&arg.device_name[0], device);
+	dev_watch_start(fd, device);
+	kcov_start(device);
+	sched_apply();
+	enum usb_device_speed native = speed;
+	if (usb_gadget_opts.speed != USB_SPEED_UNKNOWN)
+		speed = usb_gadget_opts.speed;
+	speed_set(fd, native, speed);
 	arg.speed = speed;
 	int rv = ioctl(fd, USB_RAW_IOCTL_INIT, &arg);
 	if (rv < 0) {
@@ -25,6 +825,7 @@ void usb_raw_init(int fd, enum usb_device_speed speed,
 }
 
 void usb_raw_run(int fd) {
+	usb_gadget_phase(USB_GADGET_PHASE_ENUMERATION);
 	int rv = ioctl(fd, USB_RAW_IOCTL_RUN, 0);
 	if (rv < 0) {
 		perror("ioctl(USB_RAW_IOCTL_RUN)");
@@ -33,10 +834,28 @@ void usb_raw_run(int fd) {
 }
 
 void usb_raw_event_fetch(int fd, struct usb_raw_event *event) {
-	int rv = ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, event);
-	if (rv < 0) {
-		perror("ioctl(USB_RAW_IOCTL_EVENT_FETCH)");
-		exit(EXIT_FAILURE);
+	uint32_t length = event->length;
+
+	do {
+		event->length = length;
+		int rv = ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, event);
+		if (rv < 0) {
+			perror("ioctl(USB_RAW_IOCTL_EVENT_FETCH)");
+			exit(EXIT_FAILURE);
+		}
+	} while (speed_ep0_request(fd, event));
+	dev_watch_bind(fd);
+
+	if (event->type == USB_RAW_EVENT_CONTROL &&
+			event->length >= sizeof(speed_ctrl)) {
+		memcpy(&speed_ctrl, event->data, sizeof(speed_ctrl));
+		if ((speed_ctrl.bRequestType & USB_TYPE_MASK) ==
+				USB_TYPE_STANDARD &&
+				speed_ctrl.bRequest == USB_REQ_SET_CONFIGURATION) {
+			usb_gadget_phase(USB_GADGET_PHASE_CONFIGURE);
+			if (fuzz_state)
+				fuzz_configured();
+		}
 	}
 }
 
@@ -50,7 +869,24 @@ int usb_raw_ep0_read(int fd, struct usb_raw_ep_io *io) {
 }
 
 int usb_raw_ep0_write(int fd, struct usb_raw_ep_io *io) {
-	int rv = ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, io);
+	const struct speed_state *st = speed_get(fd);
+	struct speed_config_io ss_config;
+	if (speed_adjusted(st)) {
+		struct usb_raw_ep_io *ss = speed_ss_config(st, io, &ss_config);
+		if (ss == io)
+			speed_adjust_ep0_data(st, io->data, io->length);
+		io = ss;
+	}
+	if (speed_ctrl.bRequest == USB_REQ_GET_DESCRIPTOR &&
+			(speed_ctrl.wValue >> 8) == USB_DT_DEVICE &&
+			io->length >= USB_DT_DEVICE_SIZE) {
+		struct usb_device_descriptor *desc = (void *)io->data;
+		dev_watch_set_id(fd, __le16_to_cpu(desc->idVendor),
+				__le16_to_cpu(desc->idProduct));
+	}
+	int rv = fuzz_state && (speed_ctrl.bRequestType & USB_DIR_IN) ?
+			fuzz_ep0_write(fd, io) :
+			ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, io);
 	if (rv < 0) {
 		perror("ioctl(USB_RAW_IOCTL_EP0_WRITE)");
 		exit(EXIT_FAILURE);
@@ -59,7 +895,11 @@ int usb_raw_ep0_write(int fd, struct usb_raw_ep_io *io) {
 }
 
 int usb_raw_ep_enable(int fd, struct usb_endpoint_descriptor *desc) {
-	int rv = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, desc);
+	struct usb_endpoint_descriptor adjusted = *desc;
+	const struct speed_state *st = speed_get(fd);
+	if (speed_adjusted(st))
+		speed_adjust_endpoint(st, &adjusted);
+	int rv = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &adjusted);
 	if (rv < 0) {
 		perror("ioctl(USB_RAW_IOCTL_EP_ENABLE)");
 		exit(EXIT_FAILURE);
@@ -86,7 +926,9 @@ int usb_raw_ep_read(int fd, struct usb_raw_ep_io *io) {
 }
 
 int usb_raw_ep_write(int fd, struct usb_raw_ep_io *io) {
+	int64_t slot = input_latency_submit(io);
 	int rv = ioctl(fd, USB_RAW_IOCTL_EP_WRITE, io);
+	input_latency_complete(slot, rv);
 	if (rv < 0) {
 		perror("ioctl(USB_RAW_IOCTL_EP_WRITE)");
 		exit(EXIT_FAILURE);
@@ -95,7 +937,10 @@ int usb_raw_ep_write(int fd, struct usb_raw_ep_io *io) {
 }
 
 int usb_raw_ep_write_may_fail(int fd, struct usb_raw_ep_io *io) {
-	return ioctl(fd, USB_RAW_IOCTL_EP_WRITE, io);
+	int64_t slot = input_latency_submit(io);
+	int rv = ioctl(fd, USB_RAW_IOCTL_EP_WRITE, io);
+	input_latency_complete(slot, rv);
+	return rv;
 }
 
 void usb_raw_configure(int fd) {
@@ -104,6 +949,7 @@ void usb_raw_configure(int fd) {
 		perror("ioctl(USB_RAW_IOCTL_CONFIGURED)");
 		exit(EXIT_FAILURE);
 	}
+	usb_gadget_phase(USB_GADGET_PHASE_TRAFFIC);
 }
 
 void usb_raw_vbus_draw(int fd, uint32_t power) {
@@ -169,34 +1015,316 @@ void log_event(struct usb_raw_event *event) {
 
 /*----------------------------------------------------------------------*/
 
-// Open the first available /dev/ttyUSB* device
+// Host-side device node discovery. A thread started by usb_raw_init(),
+// before the gadget connects, records the "add" uevents of USB devices
+// and device nodes from a NETLINK_KOBJECT_UEVENT socket. Our USB device
+// is the one with the VID/PID of the device descriptor the gadget sent,
+// on the dummy_hcd bus paired with our dummy_udc; a node belongs to us
+// if its DEVPATH lies below that device. Without the socket (no
+// privileges, other network namespace), lookups fall back to polling
+// /dev every 10 ms.
+//
+// With --instances every raw-gadget fd has its own bus. Lookups use the
+// bus of the instance whose ep0 the calling thread serves, other threads
+// that of the first instance.
+
+#define DEV_WATCH_EVENTS	128	// must be a power of two
+#define DEV_WATCH_BUSES		32	// dummy_hcd allows num=32
+
+struct dev_watch_event {
+	char devpath[256];
+	char subsystem[32];
+	char devname[64];	// node below /dev, "" if none
+	char product[32];	// PRODUCT of USB devices, "vid/pid/bcd"
+};
+
+struct dev_watch_bus {
+	int fd;			// raw-gadget fd of the instance
+	char bus[32];		// "/dummy_hcd.N/", "" for other UDCs
+	uint16_t vendor;
+	uint16_t product;
+	bool have_id;
+};
+
+static struct {
+	bool running;
+	int sock;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct dev_watch_event events[DEV_WATCH_EVENTS];
+	unsigned nevents;	// total recorded, events[] keeps the last ones
+	struct dev_watch_bus buses[DEV_WATCH_BUSES];
+	unsigned nbuses;
+} dev_watch = {
+	.sock = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void dev_watch_parse(const char *msg, size_t len) {
+	struct dev_watch_event ev = {0};
+	bool add = false, usb_device = false;
+
+	for (size_t off = strlen(msg) + 1; off < len; off += strlen(msg + off) + 1) {
+		const char *kv = msg + off;
+		if (!strcmp(kv, "ACTION=add"))
+			add = true;
+		else if (!strcmp(kv, "DEVTYPE=usb_device"))
+			usb_device = true;
+		else if (!strncmp(kv, "DEVPATH=", 8))
+			snprintf(ev.devpath, sizeof(ev.devpath), "%s", kv + 8);
+		else if (!strncmp(kv, "SUBSYSTEM=", 10))
+			snprintf(ev.subsystem, sizeof(ev.subsystem), "%s", kv + 10);
+		else if (!strncmp(kv, "DEVNAME=", 8))
+			snprintf(ev.devname, sizeof(ev.devname), "%s", kv + 8);
+		else if (!strncmp(kv, "PRODUCT=", 8))
+			snprintf(ev.product, sizeof(ev.product), "%s", kv + 8);
+	}
+	if (!add || (!usb_device && !ev.devname[0]))
+		return;
+	if (!usb_device)
+		ev.product[0] = '\0';
+
+	pthread_mutex_lock(&dev_watch.lock);
+	dev_watch.events[dev_watch.nevents++ & (DEV_WATCH_EVENTS - 1)] = ev;
+	pthread_cond_broadcast(&dev_watch.cond);
+	pthread_mutex_unlock(&dev_watch.lock);
+}
+
+static void *dev_watch_loop(void *arg) {
+	char buf[8192];
+
+	block_sigusr1();
+
+	while (true) {
+		ssize_t len = recv(dev_watch.sock, buf, sizeof(buf) - 1, 0);
+		if (len < 0) {
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			break;
+		}
+		buf[len] = '\0';
+		dev_watch_parse(buf, len);
+	}
+	return NULL;
+}
+
+// Instance this thread serves ep0 of, see dev_watch_bind()
+static __thread struct dev_watch_bus *dev_watch_self;
+
+// Called with dev_watch.lock held.
+static struct dev_watch_bus *dev_watch_find(int fd) {
+	for (unsigned i = 0; i < dev_watch.nbuses; i++)
+		if (dev_watch.buses[i].fd == fd)
+			return &dev_watch.buses[i];
+	return NULL;
+}
+
+static void dev_watch_start(int fd, const char *udc) {
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		// kernel uevents
+	};
+	int size = 1 << 20;
+	unsigned n;
+
+	pthread_mutex_lock(&dev_watch.lock);
+	struct dev_watch_bus *b = dev_watch_find(fd);
+	if (!b && dev_watch.nbuses < DEV_WATCH_BUSES)
+		b = &dev_watch.buses[dev_watch.nbuses++];
+	if (b) {
+		*b = (struct dev_watch_bus){ .fd = fd };
+		if (sscanf(udc, "dummy_udc.%u", &n) == 1)
+			snprintf(b->bus, sizeof(b->bus), "/dummy_hcd.%u/", n);
+	}
+	pthread_mutex_unlock(&dev_watch.lock);
+
+	if (dev_watch.running)
+		return;
+
+	dev_watch.sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+					NETLINK_KOBJECT_UEVENT);
+	if (dev_watch.sock < 0)
+		return;
+	if (setsockopt(dev_watch.sock, SOL_SOCKET, SO_RCVBUFFORCE,
+					&size, sizeof(size)) < 0)
+		setsockopt(dev_watch.sock, SOL_SOCKET, SO_RCVBUF,
+					&size, sizeof(size));
+	if (bind(dev_watch.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			pthread_create(&dev_watch.thread, NULL,
+					dev_watch_loop, NULL) != 0) {
+		close(dev_watch.sock);
+		dev_watch.sock = -1;
+		return;
+	}
+	dev_watch.running = true;
+}
+
+// Makes lookups from this thread use the bus of the instance on fd
+// (see usb_raw_event_fetch).
+static void dev_watch_bind(int fd) {
+	if (dev_watch_self && dev_watch_self->fd == fd)
+		return;
+	pthread_mutex_lock(&dev_watch.lock);
+	dev_watch_self = dev_watch_find(fd);
+	pthread_mutex_unlock(&dev_watch.lock);
+}
+
+// Remembers the IDs our device enumerates with (see usb_raw_ep0_write).
+static void dev_watch_set_id(int fd, uint16_t vendor, uint16_t product) {
+	pthread_mutex_lock(&dev_watch.lock);
+	struct dev_watch_bus *b = dev_watch_find(fd);
+	if (b) {
+		b->vendor = vendor;
+		b->product = product;
+		b->have_id = true;
+	}
+	pthread_mutex_unlock(&dev_watch.lock);
+}
+
+// DEVPATH of our USB device, the latest one if it re-enumerated.
+// Called with dev_watch.lock held.
+static const char *dev_watch_usb_device(void) {
+	struct dev_watch_bus *b = dev_watch_self ? dev_watch_self :
+					&dev_watch.buses[0];
+	char product[16];
+	unsigned first = dev_watch.nevents > DEV_WATCH_EVENTS ?
+				dev_watch.nevents - DEV_WATCH_EVENTS : 0;
+
+	if (!b->have_id)
+		return NULL;
+	snprintf(product, sizeof(product), "%x/%x/", b->vendor, b->product);
+
+	for (unsigned i = dev_watch.nevents; i-- > first; ) {
+		struct dev_watch_event *ev =
+				&dev_watch.events[i & (DEV_WATCH_EVENTS - 1)];
+		if (strncmp(ev->product, product, strlen(product)))
+			continue;
+		if (b->bus[0] && !strstr(ev->devpath, b->bus))
+			continue;
+		return ev->devpath;
+	}
+	return NULL;
+}
+
+// True if the sysfs path (e.g. /sys/class/input/event3) is a device
+// below our USB device, or if that can't be told.
+static bool dev_watch_ours(const char *syspath) {
+	char real[PATH_MAX];
+	bool ours = true;
+
+	if (!dev_watch.running || !realpath(syspath, real))
+		return true;
+
+	pthread_mutex_lock(&dev_watch.lock);
+	const char *usb = dev_watch_usb_device();
+	if (usb) {
+		size_t len = strlen(usb);
+		ours = !strncmp(real, "/sys", 4) &&
+			!strncmp(real + 4, usb, len) && real[4 + len] == '/';
+	}
+	pthread_mutex_unlock(&dev_watch.lock);
+	return ours;
+}
+
+// Waits until another uevent has been recorded after *seen, or until the
+// deadline; sleeps 10 ms when uevents are not available.
+static void dev_watch_wait(unsigned *seen, uint64_t deadline) {
+	if (!dev_watch.running) {
+		usleep(10000); // 10 ms
+		return;
+	}
+
+	uint64_t realtime_deadline;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	realtime_deadline = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	uint64_t now = monotonic_ns();
+	realtime_deadline += deadline > now ? deadline - now : 0;
+	ts.tv_sec = realtime_deadline / 1000000000ull;
+	ts.tv_nsec = realtime_deadline % 1000000000ull;
+
+	pthread_mutex_lock(&dev_watch.lock);
+	while (dev_watch.nevents == *seen &&
+			pthread_cond_timedwait(&dev_watch.cond,
+					&dev_watch.lock, &ts) == 0)
+		;
+	*seen = dev_watch.nevents;
+	pthread_mutex_unlock(&dev_watch.lock);
+}
+
+// Looks the node up among the recorded uevents, or in /dev without them.
+static bool dev_node_find(const char *subsystem, const char *prefix,
+				char *path, size_t len) {
+	bool found = false;
+
+	if (!dev_watch.running) {
+		char pattern[PATH_MAX];
+		glob_t g;
+		snprintf(pattern, sizeof(pattern), "/dev/%s*", prefix);
+		if (glob(pattern, 0, NULL, &g) == 0) {
+			snprintf(path, len, "%s", g.gl_pathv[0]);
+			found = true;
+			globfree(&g);
+		}
+		return found;
+	}
+
+	pthread_mutex_lock(&dev_watch.lock);
+	const char *usb = dev_watch_usb_device();
+	unsigned first = dev_watch.nevents > DEV_WATCH_EVENTS ?
+				dev_watch.nevents - DEV_WATCH_EVENTS : 0;
+	for (unsigned i = first; usb && i < dev_watch.nevents; i++) {
+		struct dev_watch_event *ev =
+				&dev_watch.events[i & (DEV_WATCH_EVENTS - 1)];
+		size_t ulen = strlen(usb);
+		if (strcmp(ev->subsystem, subsystem) ||
+				strncmp(ev->devname, prefix, strlen(prefix)) ||
+				strncmp(ev->devpath, usb, ulen) ||
+				ev->devpath[ulen] != '/')
+			continue;
+		snprintf(path, len, "/dev/%s", ev->devname);
+		found = true;
+		break;
+	}
+	pthread_mutex_unlock(&dev_watch.lock);
+	return found;
+}
+
+int usb_dev_node_wait(const char *subsystem, const char *prefix,
+			char *path, size_t len, int timeout_ms) {
+	uint64_t deadline = monotonic_ns() + timeout_ms * 1000000ull;
+	unsigned seen = 0;
+
+	while (!dev_node_find(subsystem, prefix, path, len)) {
+		if (monotonic_ns() > deadline)
+			return -1;
+		dev_watch_wait(&seen, deadline);
+	}
+	return 0;
+}
+
+void usb_dev_node_bind(int fd) {
+	dev_watch_bind(fd);
+}
+
+/*----------------------------------------------------------------------*/
+
+// Open the /dev/ttyUSB* node of our device
 // Returns file descriptor on success, -1 on failure
-// Waits up to 3 seconds for a device to appear
+// Waits up to 3 seconds for the device to appear
 int usb_tty_open(void) {
-	int tty_fd = -1;
-	glob_t glob_result;
-	time_t start_time = time(NULL);
-	const int timeout_sec = 3;
-
-	while (tty_fd < 0 && difftime(time(NULL), start_time)
-							< timeout_sec) {
-		if (glob("/dev/ttyUSB*", 0, NULL, &glob_result) == 0) {
-			for (size_t i = 0; i < glob_result.gl_pathc; i++) {
-				tty_fd = open(glob_result.gl_pathv[i],
-					O_RDWR | O_NOCTTY | O_NONBLOCK);
-				if (tty_fd >= 0) {
-					// printf("Successfully opened %s\n",
-					//	glob_result.gl_pathv[i]);
-					break;
-				}
-			}
-			globfree(&glob_result);
-		}
+	char path[PATH_MAX];
+	const int timeout_ms = 3000;
 
-		if (tty_fd < 0)
-			usleep(100000); // 100 ms
+	if (usb_dev_node_wait("tty", "ttyUSB", path, sizeof(path),
+							timeout_ms) < 0) {
+		perror("Failed to open any /dev/ttyUSB* device\n");
+		return -1;
 	}
 
+	int tty_fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
 	if (tty_fd < 0)
 		perror("Failed to open any /dev/ttyUSB* device\n");
 
@@ -211,3 +1339,1919 @@ void usb_tty_close(int tty_fd) {
 }
 
 /*----------------------------------------------------------------------*/
+
+// Host coverage (USB_GADGET_KCOV=<file>): a thread enables KCOV remote
+// coverage for the USB bus(es) of the dummy_hcd instances paired with the
+// UDCs of all --instances, which covers hub_event() and URB completions,
+// i.e. the host side of enumeration and traffic. It drains the kcov
+// buffer every KCOV_POLL_MS into a bitmap with one bit per byte of a
+// KCOV_RANGE_SHIFT sized window of kernel text (kernel image and
+// modules), faulted in only where covered. At exit the unique PCs are
+// written to the file, one "0x<pc>" per line in ascending order, as
+// syz-cover and addr2line take them. Nothing is printed to stdout, so
+// golden outputs are unaffected.
+
+#define KCOV_AREA_WORDS		(1 << 18)
+#define KCOV_BUSES_MAX		64	// 32 dummy_hcd with two root hubs
+#define KCOV_POLL_MS		10
+#define KCOV_RANGE_SHIFT	31
+#define KCOV_PAGE_BITS		(4096 * 8)
+#define KCOV_PAGES		((1ull << KCOV_RANGE_SHIFT) / KCOV_PAGE_BITS)
+
+static struct {
+	const char *path;
+	char error[256];	// written to the file instead of PCs
+	pthread_t thread;
+	atomic_bool stop;
+	int fd;
+	unsigned long *area;
+	uint64_t base;		// 0 until the first PC
+	uint8_t *bitmap;
+	uint64_t pages[KCOV_PAGES / 64];	// bitmap pages touched
+	uint64_t outside;	// PCs outside [base, base + range)
+	unsigned nbuses;
+	unsigned buses[KCOV_BUSES_MAX];
+} kcov;
+
+static void kcov_add(uint64_t pc) {
+	if (!kcov.base)
+		kcov.base = pc & ~((1ull << KCOV_RANGE_SHIFT) - 1);
+	uint64_t off = pc - kcov.base;
+	if (pc < kcov.base || off >> KCOV_RANGE_SHIFT) {
+		kcov.outside++;
+		return;
+	}
+	kcov.bitmap[off / 8] |= 1 << (off % 8);
+	kcov.pages[off / KCOV_PAGE_BITS / 64] |= 1ull << (off / KCOV_PAGE_BITS % 64);
+}
+
+static void kcov_drain(void) {
+	unsigned long n = __atomic_load_n(&kcov.area[0], __ATOMIC_RELAXED);
+	if (n >= KCOV_AREA_WORDS)
+		n = KCOV_AREA_WORDS - 1;
+	for (unsigned long i = 0; i < n; i++)
+		kcov_add(kcov.area[i + 1]);
+	__atomic_store_n(&kcov.area[0], 0, __ATOMIC_RELAXED);
+}
+
+// Remote coverage is tied to the task that enabled it, so one thread
+// enables, drains and disables.
+static void *kcov_loop(void *arg) {
+	struct {
+		struct kcov_remote_arg arg;
+		uint64_t handles[KCOV_BUSES_MAX];
+	} remote = {
+		.arg = {
+			.trace_mode = KCOV_TRACE_PC,
+			.area_size = KCOV_AREA_WORDS,
+			.num_handles = kcov.nbuses,
+		},
+	};
+
+	block_sigusr1();
+
+	for (unsigned i = 0; i < kcov.nbuses; i++)
+		remote.arg.handles[i] = kcov_remote_handle(KCOV_SUBSYSTEM_USB,
+							kcov.buses[i]);
+	if (ioctl(kcov.fd, KCOV_REMOTE_ENABLE, &remote) < 0) {
+		snprintf(kcov.error, sizeof(kcov.error),
+			"ioctl(KCOV_REMOTE_ENABLE): %s", strerror(errno));
+		return NULL;
+	}
+
+	while (!atomic_load(&kcov.stop)) {
+		kcov_drain();
+		usleep(KCOV_POLL_MS * 1000);
+	}
+	kcov_drain();
+	ioctl(kcov.fd, KCOV_DISABLE, 0);
+	return NULL;
+}
+
+static void kcov_finish(void) {
+	FILE *f;
+
+	atomic_store(&kcov.stop, true);
+	if (kcov.thread)
+		pthread_join(kcov.thread, NULL);
+
+	f = fopen(kcov.path, "w");
+	if (!f) {
+		perror("fopen(kcov)");
+		return;
+	}
+	if (kcov.error[0])
+		fprintf(f, "# %s\n", kcov.error);
+	for (uint64_t p = 0; kcov.bitmap && p < KCOV_PAGES; p++) {
+		if (!(kcov.pages[p / 64] & (1ull << (p % 64))))
+			continue;
+		uint64_t *word = (uint64_t *)&kcov.bitmap[p * KCOV_PAGE_BITS / 8];
+		for (unsigned w = 0; w < KCOV_PAGE_BITS / 64; w++) {
+			for (uint64_t bits = word[w]; bits; bits &= bits - 1) {
+				fprintf(f, "0x%llx\n", (unsigned long long)
+					(kcov.base + p * KCOV_PAGE_BITS +
+					 w * 64 + __builtin_ctzll(bits)));
+			}
+		}
+	}
+	if (kcov.outside)
+		fprintf(f, "# %llu PCs outside the covered range dropped\n",
+			(unsigned long long)kcov.outside);
+	fclose(f);
+}
+
+// Called for the first UDC: the others are derived from it, and are
+// brought up only after coverage is enabled.
+static void kcov_start(const char *udc) {
+	const char *path = getenv("USB_GADGET_KCOV");
+	char pattern[128];
+	glob_t g;
+
+	if (!path || !*path || kcov.path)
+		return;
+	kcov.path = path;
+	atexit(kcov_finish);
+
+	// dummy_udc.N is paired with dummy_hcd.N, which has one root hub
+	// per bus (two with is_super_speed=Y).
+	for (int n = 0; n < usb_gadget_opts.instances; n++) {
+		char name[64];
+		usb_gadget_udc_name(udc, n, name, sizeof(name));
+		const char *num = strrchr(name, '.');
+
+		snprintf(pattern, sizeof(pattern),
+			"/sys/devices/platform/dummy_hcd%s/usb*/busnum",
+			num ? num : "");
+		if (glob(pattern, 0, NULL, &g) != 0)
+			continue;
+		for (size_t i = 0; i < g.gl_pathc &&
+					kcov.nbuses < KCOV_BUSES_MAX; i++) {
+			FILE *f = fopen(g.gl_pathv[i], "r");
+			if (f && fscanf(f, "%u", &kcov.buses[kcov.nbuses]) == 1)
+				kcov.nbuses++;
+			if (f)
+				fclose(f);
+		}
+		globfree(&g);
+	}
+	if (!kcov.nbuses) {
+		snprintf(kcov.error, sizeof(kcov.error),
+			"no USB bus found at %s", pattern);
+		return;
+	}
+
+	kcov.fd = open("/sys/kernel/debug/kcov", O_RDWR | O_CLOEXEC);
+	if (kcov.fd < 0) {
+		snprintf(kcov.error, sizeof(kcov.error),
+			"open(/sys/kernel/debug/kcov): %s", strerror(errno));
+		return;
+	}
+	if (ioctl(kcov.fd, KCOV_INIT_TRACE, KCOV_AREA_WORDS) < 0) {
+		snprintf(kcov.error, sizeof(kcov.error),
+			"ioctl(KCOV_INIT_TRACE): %s", strerror(errno));
+		return;
+	}
+	kcov.area = mmap(NULL, KCOV_AREA_WORDS * sizeof(unsigned long),
+			PROT_READ | PROT_WRITE, MAP_SHARED, kcov.fd, 0);
+	kcov.bitmap = emu_mem_map(1ull << (KCOV_RANGE_SHIFT - 3), NULL);
+	if (kcov.area == MAP_FAILED || !kcov.bitmap) {
+		snprintf(kcov.error, sizeof(kcov.error), "mmap(): %s",
+			strerror(errno));
+		kcov.bitmap = NULL;
+		return;
+	}
+	if (pthread_create(&kcov.thread, NULL, kcov_loop, NULL) != 0) {
+		snprintf(kcov.error, sizeof(kcov.error), "pthread_create()");
+		kcov.thread = 0;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+struct usb_gadget_opts usb_gadget_opts = {
+	.input_latency = false,
+	.stroke_sec = 0,
+	.vram_file = NULL,
+	.fb_stats = false,
+	.fb_snapshot = NULL,
+	.fb_width = 640,
+	.fb_height = 480,
+	.fb_bpp = 16,
+	.reg_profile = false,
+	.speed = USB_SPEED_UNKNOWN,
+	.fuzz = false,
+	.fuzz_seed = 0,
+	.fuzz_iterations = 0,
+	.fuzz_window_ms = 1000,
+	.cpu_list = NULL,
+	.rt_prio = 0,
+	.instances = 1,
+};
+
+static int phase_fd = -1;
+static atomic_bool phase_seen[USB_GADGET_PHASE_COUNT];
+
+static const char *const phase_names[USB_GADGET_PHASE_COUNT] = {
+	[USB_GADGET_PHASE_ENUMERATION]	= "enumeration",
+	[USB_GADGET_PHASE_CONFIGURE]	= "configure",
+	[USB_GADGET_PHASE_TRAFFIC]	= "traffic",
+	[USB_GADGET_PHASE_TEARDOWN]	= "teardown",
+};
+
+void usb_gadget_phase(enum usb_gadget_phase phase) {
+	struct timespec ts;
+
+	if (phase_fd < 0 || atomic_exchange(&phase_seen[phase], true))
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	dprintf(phase_fd, "%s %lld.%09ld\n", phase_names[phase],
+		(long long)ts.tv_sec, ts.tv_nsec);
+}
+
+void usb_gadget_parse_args(int *argc, char **argv) {
+	const char *expect_dir = getenv("USB_GADGET_EXPECT");
+	const char *phase_path = getenv("USB_GADGET_PHASES");
+	int out = 1;
+
+	for (int i = 1; i < *argc; i++) {
+		if (!strcmp(argv[i], "--latency")) {
+			usb_gadget_opts.input_latency = true;
+			continue;
+		}
+		if (!strncmp(argv[i], "--stroke=", 9)) {
+			usb_gadget_opts.stroke_sec = atoi(argv[i] + 9);
+			if (usb_gadget_opts.stroke_sec <= 0) {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (!strncmp(argv[i], "--vram-file=", 12)) {
+			usb_gadget_opts.vram_file = argv[i] + 12;
+			continue;
+		}
+		if (!strncmp(argv[i], "--speed=", 8)) {
+			const char *name = argv[i] + 8;
+			if (!strcmp(name, "low"))
+				usb_gadget_opts.speed = USB_SPEED_LOW;
+			else if (!strcmp(name, "full"))
+				usb_gadget_opts.speed = USB_SPEED_FULL;
+			else if (!strcmp(name, "high"))
+				usb_gadget_opts.speed = USB_SPEED_HIGH;
+			else if (!strcmp(name, "super"))
+				usb_gadget_opts.speed = USB_SPEED_SUPER;
+			else {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--reg-profile")) {
+			usb_gadget_opts.reg_profile = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "--fb-stats")) {
+			usb_gadget_opts.fb_stats = true;
+			continue;
+		}
+		if (!strncmp(argv[i], "--fb-snapshot=", 14)) {
+			usb_gadget_opts.fb_snapshot = argv[i] + 14;
+			continue;
+		}
+		if (!strncmp(argv[i], "--fb-mode=", 10)) {
+			if (sscanf(argv[i] + 10, "%dx%dx%d",
+					&usb_gadget_opts.fb_width,
+					&usb_gadget_opts.fb_height,
+					&usb_gadget_opts.fb_bpp) != 3 ||
+					usb_gadget_opts.fb_width <= 0 ||
+					usb_gadget_opts.fb_height <= 0 ||
+					(usb_gadget_opts.fb_bpp != 8 &&
+					 usb_gadget_opts.fb_bpp != 16 &&
+					 usb_gadget_opts.fb_bpp != 32)) {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (!strncmp(argv[i], "--cpu=", 6)) {
+			usb_gadget_opts.cpu_list = argv[i] + 6;
+			if (!sched_parse_cpus(usb_gadget_opts.cpu_list)) {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (!strncmp(argv[i], "--rt-prio=", 10)) {
+			int prio = atoi(argv[i] + 10);
+			if (prio < sched_get_priority_min(SCHED_FIFO) ||
+					prio > sched_get_priority_max(SCHED_FIFO)) {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			usb_gadget_opts.rt_prio = prio;
+			continue;
+		}
+		if (!strncmp(argv[i], "--instances=", 12)) {
+			usb_gadget_opts.instances = atoi(argv[i] + 12);
+			if (usb_gadget_opts.instances <= 0) {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (!strncmp(argv[i], "--fuzz=", 7)) {
+			unsigned long long seed, iterations = 0;
+			int n = sscanf(argv[i] + 7, "%llu,%llu,%d", &seed,
+					&iterations,
+					&usb_gadget_opts.fuzz_window_ms);
+			if (n < 1 || usb_gadget_opts.fuzz_window_ms <= 0) {
+				printf("invalid %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			usb_gadget_opts.fuzz = true;
+			usb_gadget_opts.fuzz_seed = seed;
+			usb_gadget_opts.fuzz_iterations = iterations;
+			continue;
+		}
+		argv[out++] = argv[i];
+	}
+	argv[out] = NULL;
+	*argc = out;
+
+	// Fork before any thread is started; the children go on from here.
+	if (usb_gadget_opts.fuzz) {
+		fuzz_run();
+		return;
+	}
+
+	if (expect_dir && *expect_dir)
+		expect_start(expect_dir);
+	if (phase_path && *phase_path) {
+		phase_fd = open(phase_path, O_WRONLY | O_CREAT | O_APPEND |
+						O_CLOEXEC, 0644);
+		if (phase_fd < 0) {
+			perror("open(phases)");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+int usb_gadget_instances(void) {
+	instances_supported = true;
+	return usb_gadget_opts.instances;
+}
+
+// "dummy_udc.N" + i -> "dummy_udc.<N+i>"; names without a number
+// (a real UDC) are only valid for instance 0.
+void usb_gadget_udc_name(const char *device, int i, char *name, size_t len) {
+	const char *dot = strrchr(device, '.');
+	char *end;
+	long base = dot ? strtol(dot + 1, &end, 10) : 0;
+
+	if (!dot || end == dot + 1 || *end) {
+		if (i != 0) {
+			printf("fail: can't derive UDC %d from %s\n", i, device);
+			exit(EXIT_FAILURE);
+		}
+		snprintf(name, len, "%s", device);
+		return;
+	}
+	snprintf(name, len, "%.*s.%ld", (int)(dot - device), device, base + i);
+}
+
+/*----------------------------------------------------------------------*/
+
+void *emu_mem_map(size_t size, const char *path) {
+	void *mem;
+
+	if (!path) {
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		return mem == MAP_FAILED ? NULL : mem;
+	}
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("open(vram file)");
+		return NULL;
+	}
+	// Truncating to the full size leaves a sparse, zero-filled file.
+	if (ftruncate(fd, size) < 0) {
+		perror("ftruncate(vram file)");
+		close(fd);
+		return NULL;
+	}
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return mem == MAP_FAILED ? NULL : mem;
+}
+
+void emu_mem_unmap(void *mem, size_t size) {
+	if (mem)
+		munmap(mem, size);
+}
+
+void emu_mem_zero(void *mem, size_t len) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)mem;
+	uintptr_t first = (start + page - 1) & ~(page - 1);
+	uintptr_t last = (start + len) & ~(page - 1);
+
+	if (first >= last) {
+		memset(mem, 0, len);
+		return;
+	}
+
+	// File-backed mappings get a hole punched, anonymous ones lose the
+	// pages; both read back as zeroes.
+	if (madvise((void *)first, last - first, MADV_REMOVE) < 0 &&
+			(errno != EINVAL ||
+			 madvise((void *)first, last - first, MADV_DONTNEED) < 0))
+		memset((void *)first, 0, last - first);
+
+	memset(mem, 0, first - start);
+	memset((void *)last, 0, start + len - last);
+}
+
+/*----------------------------------------------------------------------*/
+
+uint64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned read_sysfs_hex(const char *path) {
+	unsigned value = 0;
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%x", &value) != 1)
+		value = 0;
+	fclose(f);
+	return value;
+}
+
+// Open every /dev/input/eventN whose input device has the given VID/PID,
+// with event timestamps taken from CLOCK_MONOTONIC.
+// Returns the number of nodes opened (at most max).
+int input_event_open(uint16_t vendor, uint16_t product, int *fds,
+			char paths[][INPUT_NODE_PATH_MAX], int max) {
+	glob_t glob_result;
+	int nfds = 0;
+
+	if (glob("/sys/class/input/event*", 0, NULL, &glob_result) != 0)
+		return 0;
+
+	for (size_t i = 0; i < glob_result.gl_pathc && nfds < max; i++) {
+		char path[PATH_MAX];
+		const char *node = strrchr(glob_result.gl_pathv[i], '/') + 1;
+
+		snprintf(path, sizeof(path), "%s/device/id/vendor",
+						glob_result.gl_pathv[i]);
+		if (read_sysfs_hex(path) != vendor)
+			continue;
+		if (!dev_watch_ours(glob_result.gl_pathv[i]))
+			continue;
+		snprintf(path, sizeof(path), "%s/device/id/product",
+						glob_result.gl_pathv[i]);
+		if (read_sysfs_hex(path) != product)
+			continue;
+
+		snprintf(paths[nfds], INPUT_NODE_PATH_MAX,
+						"/dev/input/%s", node);
+		int fd = open(paths[nfds], O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+
+		int clk = CLOCK_MONOTONIC;
+		if (ioctl(fd, EVIOCSCLOCKID, &clk) < 0) {
+			perror("ioctl(EVIOCSCLOCKID)");
+			close(fd);
+			continue;
+		}
+		fds[nfds++] = fd;
+	}
+	globfree(&glob_result);
+
+	return nfds;
+}
+
+// Same as input_event_open(), but waits up to timeout_ms for the host
+// to create the nodes.
+int input_event_wait_open(uint16_t vendor, uint16_t product, int *fds,
+		char paths[][INPUT_NODE_PATH_MAX], int max, int timeout_ms) {
+	uint64_t deadline = monotonic_ns() + timeout_ms * 1000000ull;
+	unsigned seen = 0;
+	int nfds;
+
+	while ((nfds = input_event_open(vendor, product,
+					fds, paths, max)) == 0) {
+		if (monotonic_ns() > deadline)
+			break;
+		dev_watch_wait(&seen, deadline);
+	}
+	return nfds;
+}
+
+/*----------------------------------------------------------------------*/
+
+#define INPUT_LATENCY_NODES_MAX		8
+#define INPUT_LATENCY_QUEUE_SIZE	4096	// must be a power of two
+#define INPUT_LATENCY_SAMPLES_MAX	(1 << 20)
+#define INPUT_LATENCY_WAIT_MS		5000
+#define INPUT_LATENCY_HIST_BUCKETS	16
+
+struct input_latency_entry {
+	uint64_t submit_ns;
+	uint64_t complete_ns;	// 0 while the ep write is in flight
+	bool failed;
+};
+
+static struct {
+	bool active;
+	atomic_bool stop;
+	int ep;
+	uint16_t vendor;
+	uint16_t product;
+	pthread_t thread;
+	pthread_mutex_t lock;
+
+	int fds[INPUT_LATENCY_NODES_MAX];
+	char paths[INPUT_LATENCY_NODES_MAX][INPUT_NODE_PATH_MAX];
+	bool frame_pending[INPUT_LATENCY_NODES_MAX];
+	int nfds;
+
+	// Submitted reports not yet matched to an evdev frame.
+	struct input_latency_entry queue[INPUT_LATENCY_QUEUE_SIZE];
+	uint64_t head;
+	uint64_t tail;
+
+	uint64_t *samples;
+	size_t nsamples;
+	size_t samples_cap;
+
+	uint64_t submitted;
+	uint64_t matched;
+	uint64_t coalesced;
+	uint64_t overflow;
+	uint64_t unsolicited;
+	uint64_t syn_dropped;
+} input_latency = {
+	.ep = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t input_latency_submit(struct usb_raw_ep_io *io) {
+	int64_t slot = -1;
+
+	if (!input_latency.active || io->ep != input_latency.ep)
+		return -1;
+
+	pthread_mutex_lock(&input_latency.lock);
+	// Reports sent before the event node was opened can never be
+	// matched, so they are not accounted for at all.
+	if (input_latency.nfds == 0)
+		goto out;
+	if (input_latency.tail - input_latency.head ==
+					INPUT_LATENCY_QUEUE_SIZE) {
+		input_latency.overflow++;
+		goto out;
+	}
+	slot = input_latency.tail++;
+	input_latency.queue[slot & (INPUT_LATENCY_QUEUE_SIZE - 1)] =
+		(struct input_latency_entry){ .submit_ns = monotonic_ns() };
+	input_latency.submitted++;
+out:
+	pthread_mutex_unlock(&input_latency.lock);
+	return slot;
+}
+
+static void input_latency_complete(int64_t slot, int rv) {
+	if (slot < 0)
+		return;
+
+	pthread_mutex_lock(&input_latency.lock);
+	// The host usually emits the evdev frame before the ep write
+	// returns here, in which case the entry is already matched.
+	if ((uint64_t)slot >= input_latency.head &&
+				(uint64_t)slot < input_latency.tail) {
+		struct input_latency_entry *e = &input_latency.queue[
+				slot & (INPUT_LATENCY_QUEUE_SIZE - 1)];
+		if (rv < 0)
+			e->failed = true;
+		else
+			e->complete_ns = monotonic_ns();
+	}
+	pthread_mutex_unlock(&input_latency.lock);
+}
+
+static void input_latency_add_sample(uint64_t ns) {
+	if (input_latency.nsamples == input_latency.samples_cap) {
+		if (input_latency.samples_cap >= INPUT_LATENCY_SAMPLES_MAX)
+			return;
+		size_t cap = input_latency.samples_cap ?
+				input_latency.samples_cap * 2 : 1024;
+		uint64_t *samples = realloc(input_latency.samples,
+						cap * sizeof(*samples));
+		if (!samples)
+			return;
+		input_latency.samples = samples;
+		input_latency.samples_cap = cap;
+	}
+	input_latency.samples[input_latency.nsamples++] = ns;
+}
+
+// Match an evdev frame stamped at frame_ns to the report that caused it.
+static void input_latency_match(uint64_t frame_ns) {
+	const uint64_t mask = INPUT_LATENCY_QUEUE_SIZE - 1;
+
+	pthread_mutex_lock(&input_latency.lock);
+	while (input_latency.head != input_latency.tail) {
+		struct input_latency_entry *e =
+			&input_latency.queue[input_latency.head & mask];
+
+		if (e->failed) {
+			input_latency.head++;
+			continue;
+		}
+		if (e->submit_ns > frame_ns)
+			break;
+
+		// If the oldest report had already completed when a newer
+		// one was submitted, and the newer one also predates this
+		// frame, the oldest report never produced a frame of its
+		// own: the input core filtered or merged it.
+		if (input_latency.head + 1 != input_latency.tail) {
+			struct input_latency_entry *next =
+				&input_latency.queue[(input_latency.head + 1) & mask];
+			if (next->submit_ns <= frame_ns && e->complete_ns &&
+					e->complete_ns <= next->submit_ns) {
+				input_latency.coalesced++;
+				input_latency.head++;
+				continue;
+			}
+		}
+
+		input_latency_add_sample(frame_ns - e->submit_ns);
+		input_latency.matched++;
+		input_latency.head++;
+		pthread_mutex_unlock(&input_latency.lock);
+		return;
+	}
+	input_latency.unsolicited++;
+	pthread_mutex_unlock(&input_latency.lock);
+}
+
+static void input_latency_read_node(int idx) {
+	struct input_event ev[64];
+
+	while (true) {
+		ssize_t rv = read(input_latency.fds[idx], ev, sizeof(ev));
+		if (rv <= 0)
+			return;
+
+		for (size_t i = 0; i < rv / sizeof(ev[0]); i++) {
+			if (ev[i].type != EV_SYN) {
+				input_latency.frame_pending[idx] = true;
+				continue;
+			}
+			if (ev[i].code == SYN_DROPPED) {
+				input_latency.syn_dropped++;
+				input_latency.frame_pending[idx] = false;
+				continue;
+			}
+			if (ev[i].code != SYN_REPORT ||
+					!input_latency.frame_pending[idx])
+				continue;
+			input_latency.frame_pending[idx] = false;
+			input_latency_match(
+				(uint64_t)ev[i].input_event_sec * 1000000000ull +
+				(uint64_t)ev[i].input_event_usec * 1000ull);
+		}
+	}
+}
+
+static void *input_latency_loop(void *arg) {
+	block_sigusr1();
+
+	int nfds = input_event_wait_open(input_latency.vendor,
+			input_latency.product, input_latency.fds,
+			input_latency.paths, INPUT_LATENCY_NODES_MAX,
+			INPUT_LATENCY_WAIT_MS);
+	if (nfds == 0) {
+		printf("[latency] no input device %04x:%04x appeared\n",
+			input_latency.vendor, input_latency.product);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&input_latency.lock);
+	input_latency.nfds = nfds;
+	pthread_mutex_unlock(&input_latency.lock);
+
+	struct pollfd pfds[INPUT_LATENCY_NODES_MAX];
+	for (int i = 0; i < nfds; i++) {
+		pfds[i].fd = input_latency.fds[i];
+		pfds[i].events = POLLIN;
+	}
+
+	while (!atomic_load(&input_latency.stop)) {
+		int rv = poll(pfds, nfds, 50);
+		if (rv <= 0)
+			continue;
+		for (int i = 0; i < nfds; i++) {
+			if (pfds[i].revents & POLLIN)
+				input_latency_read_node(i);
+		}
+	}
+
+	// Pick up frames that arrived right before the stop request.
+	for (int i = 0; i < nfds; i++)
+		input_latency_read_node(i);
+
+	return NULL;
+}
+
+void input_latency_start(uint16_t vendor, uint16_t product) {
+	input_latency.vendor = vendor;
+	input_latency.product = product;
+	atomic_store(&input_latency.stop, false);
+
+	int rv = pthread_create(&input_latency.thread, NULL,
+					input_latency_loop, NULL);
+	if (rv != 0) {
+		perror("pthread_create(input_latency)");
+		exit(EXIT_FAILURE);
+	}
+	input_latency.active = true;
+}
+
+void input_latency_track_ep(int ep) {
+	input_latency.ep = ep;
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(uint64_t *sorted, size_t n, double p) {
+	size_t idx = (size_t)(p * (n - 1) + 0.5);
+	return sorted[idx] / 1000.0;
+}
+
+void input_latency_report(void) {
+	if (!input_latency.active)
+		return;
+
+	// Give the host a moment to deliver the last frames.
+	usleep(100000);
+	atomic_store(&input_latency.stop, true);
+	pthread_join(input_latency.thread, NULL);
+	input_latency.active = false;
+
+	for (int i = 0; i < input_latency.nfds; i++)
+		close(input_latency.fds[i]);
+
+	pthread_mutex_lock(&input_latency.lock);
+
+	uint64_t dropped = input_latency.overflow;
+	for (uint64_t i = input_latency.head; i != input_latency.tail; i++) {
+		if (!input_latency.queue[i &
+				(INPUT_LATENCY_QUEUE_SIZE - 1)].failed)
+			dropped++;
+	}
+
+	printf("[latency] device %04x:%04x, %d event node(s):",
+		input_latency.vendor, input_latency.product, input_latency.nfds);
+	for (int i = 0; i < input_latency.nfds; i++)
+		printf(" %s", input_latency.paths[i]);
+	printf("\n");
+	printf("[latency] reports: %llu submitted, %llu matched, "
+		"%llu coalesced, %llu dropped\n",
+		(unsigned long long)input_latency.submitted,
+		(unsigned long long)input_latency.matched,
+		(unsigned long long)input_latency.coalesced,
+		(unsigned long long)dropped);
+	printf("[latency] frames: %llu unsolicited, %llu SYN_DROPPED\n",
+		(unsigned long long)input_latency.unsolicited,
+		(unsigned long long)input_latency.syn_dropped);
+
+	size_t n = input_latency.nsamples;
+	if (n > 0) {
+		uint64_t *s = input_latency.samples;
+		uint64_t sum = 0;
+		unsigned hist[INPUT_LATENCY_HIST_BUCKETS] = {0};
+
+		qsort(s, n, sizeof(*s), compare_u64);
+		for (size_t i = 0; i < n; i++) {
+			uint64_t us = s[i] / 1000;
+			int b = 0;
+			sum += s[i];
+			while (us > 1 && b < INPUT_LATENCY_HIST_BUCKETS - 1) {
+				us >>= 1;
+				b++;
+			}
+			hist[b]++;
+		}
+
+		printf("[latency] usb->evdev (us): min %.1f, avg %.1f, "
+			"p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+			s[0] / 1000.0, (double)sum / n / 1000.0,
+			percentile_us(s, n, 0.50), percentile_us(s, n, 0.90),
+			percentile_us(s, n, 0.99), s[n - 1] / 1000.0);
+		for (int b = 0; b < INPUT_LATENCY_HIST_BUCKETS; b++) {
+			if (!hist[b])
+				continue;
+			printf("[latency]   < %6u us: %u\n", 2u << b, hist[b]);
+		}
+	}
+
+	free(input_latency.samples);
+	input_latency.samples = NULL;
+	input_latency.nsamples = input_latency.samples_cap = 0;
+
+	pthread_mutex_unlock(&input_latency.lock);
+}
+
+/*----------------------------------------------------------------------*/
+
+#define PEN_STROKE_LEN		512	// samples per stroke
+#define PEN_STROKE_LIFT		32	// samples with the pen up per stroke
+#define PEN_STROKE_NODES_MAX	8
+#define PEN_STROKE_WAIT_MS	5000
+
+static atomic_bool pen_stroke_done;
+
+// Triangle wave over [0, max] with the given period in samples.
+static uint32_t pen_tri(uint64_t i, uint32_t period, uint32_t max) {
+	uint32_t half = period / 2;
+	uint32_t p = i % period;
+	uint32_t v = p < half ? p : period - p;
+	return (uint64_t)v * max / half;
+}
+
+// The periods are pairwise coprime, so the curve keeps visiting new
+// coordinate, pressure and tilt combinations instead of retracing itself.
+static void pen_stroke_sample(const struct pen_device *dev, uint64_t i,
+				struct pen_sample *s) {
+	s->x = pen_tri(i, 2 * 1021, dev->x_max);
+	s->y = pen_tri(i, 2 * 773, dev->y_max);
+	s->tilt_x = pen_tri(i, 2 * 251, dev->tilt_x_max);
+	s->tilt_y = pen_tri(i, 2 * 331, dev->tilt_y_max);
+	s->tip = i % PEN_STROKE_LEN < PEN_STROKE_LEN - PEN_STROKE_LIFT;
+	s->pressure = s->tip ? 1 + pen_tri(i, 2 * 127,
+				dev->pressure_max - 1) : 0;
+}
+
+// Kernel time (system + irq + softirq) spent on all CPUs, in ns.
+static uint64_t kernel_cpu_ns(void) {
+	unsigned long long user, nice, system, idle, iowait, irq, softirq;
+	FILE *f = fopen("/proc/stat", "r");
+	if (!f)
+		return 0;
+	int rv = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu",
+		&user, &nice, &system, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+	if (rv != 7)
+		return 0;
+	return (system + irq + softirq) * 1000000000ull /
+					sysconf(_SC_CLK_TCK);
+}
+
+static uint64_t self_kernel_cpu_ns(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)ru.ru_stime.tv_sec * 1000000000ull +
+					ru.ru_stime.tv_usec * 1000ull;
+}
+
+static void pen_stroke_drain(int *fds, int nfds, uint64_t *frames,
+				uint64_t *events, uint64_t *dropped) {
+	struct input_event ev[64];
+
+	for (int n = 0; n < nfds; n++) {
+		ssize_t rv;
+		while ((rv = read(fds[n], ev, sizeof(ev))) > 0) {
+			for (size_t i = 0; i < rv / sizeof(ev[0]); i++) {
+				if (ev[i].type != EV_SYN)
+					(*events)++;
+				else if (ev[i].code == SYN_REPORT)
+					(*frames)++;
+				else if (ev[i].code == SYN_DROPPED)
+					(*dropped)++;
+			}
+		}
+	}
+}
+
+void pen_stroke_run(int fd, int ep, const struct pen_device *dev) {
+	struct {
+		struct usb_raw_ep_io inner;
+		char data[64];
+	} io;
+	int fds[PEN_STROKE_NODES_MAX];
+	char paths[PEN_STROKE_NODES_MAX][INPUT_NODE_PATH_MAX];
+	uint64_t reports = 0, frames = 0, events = 0, dropped = 0;
+
+	assert(dev->report_len <= sizeof(io.data));
+	assert(dev->prologue_len <= sizeof(io.data));
+
+	// The host driver only polls the endpoint while the input device
+	// is open, so keep the event nodes open for the whole run.
+	int nfds = input_event_wait_open(dev->vendor, dev->product,
+			fds, paths, PEN_STROKE_NODES_MAX, PEN_STROKE_WAIT_MS);
+	if (nfds == 0)
+		printf("[stroke] no input device %04x:%04x appeared\n",
+			dev->vendor, dev->product);
+
+	io.inner.ep = ep;
+	io.inner.flags = 0;
+
+	if (dev->prologue_len) {
+		memcpy(&io.inner.data[0], dev->prologue, dev->prologue_len);
+		io.inner.length = dev->prologue_len;
+		usb_raw_ep_write_may_fail(fd, (struct usb_raw_ep_io *)&io);
+	}
+
+	uint64_t kernel_start = kernel_cpu_ns();
+	uint64_t self_start = self_kernel_cpu_ns();
+	uint64_t start = monotonic_ns();
+	uint64_t deadline = start + usb_gadget_opts.stroke_sec * 1000000000ull;
+	uint64_t now = start;
+
+	io.inner.length = dev->report_len;
+	for (uint64_t i = 0; ; i++) {
+		struct pen_sample sample;
+
+		if (i % 64 == 0) {
+			now = monotonic_ns();
+			if (now >= deadline)
+				break;
+			pen_stroke_drain(fds, nfds,
+					&frames, &events, &dropped);
+		}
+
+		pen_stroke_sample(dev, i, &sample);
+		memset(&io.inner.data[0], 0, dev->report_len);
+		dev->encode(&sample, (uint8_t *)&io.inner.data[0]);
+		if (usb_raw_ep_write_may_fail(fd,
+				(struct usb_raw_ep_io *)&io) < 0) {
+			now = monotonic_ns();
+			break;
+		}
+		reports++;
+	}
+
+	uint64_t kernel_ns = kernel_cpu_ns() - kernel_start;
+	uint64_t self_ns = self_kernel_cpu_ns() - self_start;
+	double sec = (now - start) / 1e9;
+
+	// Give the host a moment to deliver the last frames.
+	usleep(100000);
+	pen_stroke_drain(fds, nfds, &frames, &events, &dropped);
+	for (int n = 0; n < nfds; n++)
+		close(fds[n]);
+
+	// Host-side cost: kernel time on all CPUs minus the time the gadget
+	// process itself spent in raw-gadget ioctls.
+	double host_us = self_ns < kernel_ns ?
+				(kernel_ns - self_ns) / 1000.0 : 0;
+
+	printf("[stroke] %.2f s: %llu reports (%.0f reports/s)\n", sec,
+		(unsigned long long)reports, sec > 0 ? reports / sec : 0);
+	printf("[stroke] evdev: %llu frames, %llu events, %llu SYN_DROPPED\n",
+		(unsigned long long)frames, (unsigned long long)events,
+		(unsigned long long)dropped);
+	printf("[stroke] kernel cpu: %.1f ms all cpus, %.1f ms gadget process\n",
+		kernel_ns / 1e6, self_ns / 1e6);
+	if (reports) {
+		printf("[stroke] host cpu: %.2f us/report", host_us / reports);
+		if (events)
+			printf(", %.2f us/event", host_us / events);
+		printf("\n");
+	}
+
+	atomic_store(&pen_stroke_done, true);
+}
+
+// Keep the process alive until the stroke finishes (or clearly never will).
+void pen_stroke_wait(void) {
+	if (!usb_gadget_opts.stroke_sec)
+		return;
+
+	uint64_t deadline = monotonic_ns() +
+		(usb_gadget_opts.stroke_sec + PEN_STROKE_WAIT_MS / 1000 + 5) *
+							1000000000ull;
+	while (!atomic_load(&pen_stroke_done) && monotonic_ns() < deadline)
+		usleep(10000); // 10 ms
+}
+
+/*----------------------------------------------------------------------*/
+
+#define FB_PAGE_SHIFT		12
+#define FB_FRAME_GAP_MS		10
+#define FB_POLL_MS		2
+
+static struct {
+	bool active;
+	atomic_bool stop;
+	pthread_t thread;
+	uint8_t *mem;
+	size_t size;
+
+	// One bit per dirty page, set by the writers, cleared per frame.
+	_Atomic uint64_t *dirty;
+	size_t dirty_words;
+	atomic_ullong frame_bytes;
+
+	uint64_t frames;
+	uint64_t total_bytes;
+	uint64_t max_bytes;
+	uint64_t first_ns;	// start of the first frame
+	uint64_t last_ns;	// end of the last frame
+	uint64_t snapshots;
+} fb_track;
+
+static size_t fb_visible_bytes(void) {
+	size_t bytes = (size_t)usb_gadget_opts.fb_width *
+			usb_gadget_opts.fb_height * usb_gadget_opts.fb_bpp / 8;
+	return bytes < fb_track.size ? bytes : fb_track.size;
+}
+
+static void fb_snapshot(void) {
+	const char *path = usb_gadget_opts.fb_snapshot;
+	int width = usb_gadget_opts.fb_width;
+	int height = usb_gadget_opts.fb_height;
+	int bpp = usb_gadget_opts.fb_bpp / 8;
+
+	if (!path)
+		return;
+	if ((size_t)width * height * bpp > fb_track.size) {
+		printf("[fb] %dx%dx%d does not fit into VRAM\n",
+			width, height, bpp * 8);
+		return;
+	}
+
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		perror("fopen(fb snapshot)");
+		return;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", width, height);
+	for (int y = 0; y < height; y++) {
+		const uint8_t *src = fb_track.mem + (size_t)y * width * bpp;
+		for (int x = 0; x < width; x++, src += bpp) {
+			uint8_t rgb[3];
+			if (bpp == 1) {
+				// No palette emulation: show the index as gray.
+				rgb[0] = rgb[1] = rgb[2] = src[0];
+			} else if (bpp == 2) {
+				uint16_t v = src[0] | (src[1] << 8);	// RGB565
+				rgb[0] = ((v >> 11) & 0x1f) * 255 / 31;
+				rgb[1] = ((v >> 5) & 0x3f) * 255 / 63;
+				rgb[2] = (v & 0x1f) * 255 / 31;
+			} else {
+				rgb[0] = src[2];			// XRGB8888
+				rgb[1] = src[1];
+				rgb[2] = src[0];
+			}
+			fwrite(rgb, 1, sizeof(rgb), f);
+		}
+	}
+	fclose(f);
+	fb_track.snapshots++;
+}
+
+static void fb_frame_close(uint64_t now) {
+	uint64_t bytes = atomic_exchange(&fb_track.frame_bytes, 0);
+	size_t visible_pages = (fb_visible_bytes() + (1 << FB_PAGE_SHIFT) - 1)
+							>> FB_PAGE_SHIFT;
+	size_t pages = 0, first = SIZE_MAX, last = 0;
+
+	for (size_t w = 0; w < fb_track.dirty_words; w++) {
+		uint64_t bits = atomic_exchange(&fb_track.dirty[w], 0);
+		if (!bits)
+			continue;
+		pages += __builtin_popcountll(bits);
+		size_t lo = w * 64 + __builtin_ctzll(bits);
+		size_t hi = w * 64 + 63 - __builtin_clzll(bits);
+		if (lo < visible_pages && lo < first)
+			first = lo;
+		if (lo < visible_pages)
+			last = hi < visible_pages ? hi : visible_pages - 1;
+	}
+
+	fb_track.frames++;
+	fb_track.total_bytes += bytes;
+	if (bytes > fb_track.max_bytes)
+		fb_track.max_bytes = bytes;
+	fb_track.last_ns = now;
+
+	if (!usb_gadget_opts.fb_stats)
+		return;
+
+	printf("[fb] frame %llu: %llu bytes, %zu dirty pages",
+		(unsigned long long)fb_track.frames,
+		(unsigned long long)bytes, pages);
+	if (first != SIZE_MAX) {
+		// Dirty rectangle, rounded out to whole pages and lines.
+		size_t pitch = (size_t)usb_gadget_opts.fb_width *
+						usb_gadget_opts.fb_bpp / 8;
+		size_t y0 = (first << FB_PAGE_SHIFT) / pitch;
+		size_t y1 = (((last + 1) << FB_PAGE_SHIFT) - 1) / pitch;
+		if (y1 >= (size_t)usb_gadget_opts.fb_height)
+			y1 = usb_gadget_opts.fb_height - 1;
+		printf(", rect 0,%zu %dx%zu", y0,
+			usb_gadget_opts.fb_width, y1 - y0 + 1);
+	}
+	printf("\n");
+}
+
+static void *fb_track_loop(void *arg) {
+	sigset_t set;
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = FB_POLL_MS * 1000000 };
+	uint64_t seen = 0, quiet_since = 0;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+
+	while (!atomic_load(&fb_track.stop)) {
+		if (sigtimedwait(&set, NULL, &ts) == SIGUSR1)
+			fb_snapshot();
+
+		uint64_t now = monotonic_ns();
+		uint64_t bytes = atomic_load(&fb_track.frame_bytes);
+		if (bytes == 0)
+			continue;
+		if (bytes != seen) {
+			if (seen == 0 && fb_track.frames == 0)
+				fb_track.first_ns = now;
+			seen = bytes;
+			quiet_since = now;
+			continue;
+		}
+		if (now - quiet_since >= FB_FRAME_GAP_MS * 1000000ull) {
+			fb_frame_close(now);
+			seen = 0;
+		}
+	}
+	return NULL;
+}
+
+void fb_track_start(uint8_t *mem, size_t size) {
+	fb_track.mem = mem;
+	fb_track.size = size;
+	fb_track.dirty_words = ((size >> FB_PAGE_SHIFT) + 63) / 64;
+	fb_track.dirty = calloc(fb_track.dirty_words, sizeof(uint64_t));
+	if (!fb_track.dirty) {
+		printf("[fb] failed to allocate the dirty bitmap\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Inherited by every thread created from here on.
+	block_sigusr1();
+
+	atomic_store(&fb_track.stop, false);
+	int rv = pthread_create(&fb_track.thread, NULL, fb_track_loop, NULL);
+	if (rv != 0) {
+		perror("pthread_create(fb_track)");
+		exit(EXIT_FAILURE);
+	}
+	fb_track.active = true;
+}
+
+void fb_track_write(uint32_t offset, uint32_t length) {
+	if (!fb_track.active || length == 0 || offset >= fb_track.size)
+		return;
+
+	size_t first = offset >> FB_PAGE_SHIFT;
+	size_t last = (offset + (size_t)length - 1) >> FB_PAGE_SHIFT;
+	if (last >= (fb_track.size >> FB_PAGE_SHIFT))
+		last = (fb_track.size >> FB_PAGE_SHIFT) - 1;
+
+	for (size_t page = first; page <= last; page++) {
+		_Atomic uint64_t *word = &fb_track.dirty[page / 64];
+		uint64_t bit = 1ull << (page % 64);
+		// Most writes hit pages already dirty in this frame.
+		if (!(atomic_load_explicit(word, memory_order_relaxed) & bit))
+			atomic_fetch_or_explicit(word, bit,
+						memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&fb_track.frame_bytes, length,
+						memory_order_relaxed);
+}
+
+void fb_track_stop(void) {
+	if (!fb_track.active)
+		return;
+
+	atomic_store(&fb_track.stop, true);
+	pthread_join(fb_track.thread, NULL);
+	fb_track.active = false;
+
+	if (atomic_load(&fb_track.frame_bytes))
+		fb_frame_close(monotonic_ns());
+	fb_snapshot();
+
+	if (usb_gadget_opts.fb_stats) {
+		double sec = (fb_track.last_ns - fb_track.first_ns) / 1e9;
+		printf("[fb] %llu frames in %.3f s",
+			(unsigned long long)fb_track.frames, sec);
+		if (sec > 0)
+			printf(" (%.1f fps)", fb_track.frames / sec);
+		printf(", %llu bytes written",
+			(unsigned long long)fb_track.total_bytes);
+		if (fb_track.frames)
+			printf(", %llu bytes/frame avg, %llu max",
+				(unsigned long long)(fb_track.total_bytes /
+							fb_track.frames),
+				(unsigned long long)fb_track.max_bytes);
+		printf("\n");
+	}
+	if (usb_gadget_opts.fb_snapshot)
+		printf("[fb] %llu snapshot(s) of %dx%dx%d written to %s\n",
+			(unsigned long long)fb_track.snapshots,
+			usb_gadget_opts.fb_width, usb_gadget_opts.fb_height,
+			usb_gadget_opts.fb_bpp, usb_gadget_opts.fb_snapshot);
+
+	free(fb_track.dirty);
+	fb_track.dirty = NULL;
+}
+
+/*----------------------------------------------------------------------*/
+
+#define REG_PROFILE_SPACES_MAX	8
+
+struct reg_profile_entry {
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t last_ns;
+	uint64_t gap_sum_ns;	// sum of inter-arrival times
+	uint64_t gap_min_ns;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int nspaces;
+	struct {
+		const char *name;
+		uint32_t nregs;
+		uint32_t base;
+		uint32_t stride;
+		struct reg_profile_entry *regs;
+	} spaces[REG_PROFILE_SPACES_MAX];
+	uint64_t first_ns;
+	uint64_t last_ns;
+} reg_profile = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+int reg_profile_space(const char *name, uint32_t nregs,
+			uint32_t base, uint32_t stride) {
+	if (reg_profile.nspaces == REG_PROFILE_SPACES_MAX) {
+		printf("[regprof] too many register spaces\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int space = reg_profile.nspaces++;
+	reg_profile.spaces[space].name = name;
+	reg_profile.spaces[space].nregs = nregs;
+	reg_profile.spaces[space].base = base;
+	reg_profile.spaces[space].stride = stride;
+	reg_profile.spaces[space].regs = calloc(nregs,
+					sizeof(struct reg_profile_entry));
+	if (!reg_profile.spaces[space].regs) {
+		printf("[regprof] failed to allocate %s counters\n", name);
+		exit(EXIT_FAILURE);
+	}
+	return space;
+}
+
+void reg_profile_access(int space, uint32_t reg, bool is_read) {
+	if (space < 0 || reg >= reg_profile.spaces[space].nregs)
+		return;
+
+	uint64_t now = monotonic_ns();
+
+	pthread_mutex_lock(&reg_profile.lock);
+	struct reg_profile_entry *e = &reg_profile.spaces[space].regs[reg];
+	if (e->reads + e->writes) {
+		uint64_t gap = now - e->last_ns;
+		e->gap_sum_ns += gap;
+		if (gap < e->gap_min_ns)
+			e->gap_min_ns = gap;
+	} else {
+		e->gap_min_ns = UINT64_MAX;
+	}
+	if (is_read)
+		e->reads++;
+	else
+		e->writes++;
+	e->last_ns = now;
+
+	if (!reg_profile.first_ns)
+		reg_profile.first_ns = now;
+	reg_profile.last_ns = now;
+	pthread_mutex_unlock(&reg_profile.lock);
+}
+
+struct reg_profile_row {
+	int space;
+	uint32_t reg;
+	uint64_t total;
+};
+
+static int reg_profile_row_cmp(const void *a, const void *b) {
+	const struct reg_profile_row *x = a, *y = b;
+	if (x->total != y->total)
+		return x->total < y->total ? 1 : -1;
+	if (x->space != y->space)
+		return x->space - y->space;
+	return (x->reg > y->reg) - (x->reg < y->reg);
+}
+
+void reg_profile_report(void) {
+	struct reg_profile_row *rows = NULL;
+	size_t nrows = 0;
+
+	if (!reg_profile.nspaces)
+		return;
+
+	pthread_mutex_lock(&reg_profile.lock);
+
+	printf("[regprof] %.3f s between first and last access\n",
+		(reg_profile.last_ns - reg_profile.first_ns) / 1e9);
+
+	for (int s = 0; s < reg_profile.nspaces; s++) {
+		uint64_t reads = 0, writes = 0, used = 0;
+
+		for (uint32_t r = 0; r < reg_profile.spaces[s].nregs; r++) {
+			struct reg_profile_entry *e =
+					&reg_profile.spaces[s].regs[r];
+			if (!(e->reads + e->writes))
+				continue;
+			reads += e->reads;
+			writes += e->writes;
+			used++;
+
+			struct reg_profile_row *tmp = realloc(rows,
+						(nrows + 1) * sizeof(*rows));
+			if (!tmp)
+				break;
+			rows = tmp;
+			rows[nrows++] = (struct reg_profile_row){
+				.space = s, .reg = r,
+				.total = e->reads + e->writes,
+			};
+		}
+		// Every read is a round trip: the host waits for the answer.
+		printf("[regprof] %-8s %8llu reads (round trips), %8llu writes, "
+			"%llu registers\n", reg_profile.spaces[s].name,
+			(unsigned long long)reads, (unsigned long long)writes,
+			(unsigned long long)used);
+	}
+
+	qsort(rows, nrows, sizeof(*rows), reg_profile_row_cmp);
+
+	printf("[regprof] %-8s %10s %8s %8s %12s %12s\n", "space", "address",
+		"reads", "writes", "avg gap us", "min gap us");
+	for (size_t i = 0; i < nrows; i++) {
+		int s = rows[i].space;
+		struct reg_profile_entry *e =
+				&reg_profile.spaces[s].regs[rows[i].reg];
+		uint32_t address = reg_profile.spaces[s].base +
+				rows[i].reg * reg_profile.spaces[s].stride;
+
+		printf("[regprof] %-8s 0x%08x %8llu %8llu",
+			reg_profile.spaces[s].name, address,
+			(unsigned long long)e->reads,
+			(unsigned long long)e->writes);
+		if (rows[i].total > 1)
+			printf(" %12.1f %12.1f\n",
+				e->gap_sum_ns / 1e3 / (rows[i].total - 1),
+				e->gap_min_ns / 1e3);
+		else
+			printf(" %12s %12s\n", "-", "-");
+	}
+
+	pthread_mutex_unlock(&reg_profile.lock);
+	free(rows);
+}
+
+/*----------------------------------------------------------------------*/
+
+#define EXPECT_ALT_MAX		16
+
+struct expect_alt {
+	char name[32];		// out.N
+	char **lines;
+	size_t nlines;
+	bool alive;
+};
+
+static struct {
+	struct expect_alt alts[EXPECT_ALT_MAX];
+	int nalts;
+	size_t line;		// lines matched so far
+	int out_fd;		// where the output really goes
+	int pipe_fd;		// read end of the captured stdout/stderr
+	pthread_t thread;
+} expect;
+
+static void expect_load(struct expect_alt *alt, const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror("fopen(expected output)");
+		exit(EXIT_FAILURE);
+	}
+
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, f)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		alt->lines = realloc(alt->lines,
+				(alt->nlines + 1) * sizeof(*alt->lines));
+		alt->lines[alt->nlines++] = strdup(line);
+	}
+	free(line);
+	fclose(f);
+
+	const char *name = strrchr(path, '/');
+	snprintf(alt->name, sizeof(alt->name), "%s", name ? name + 1 : path);
+	alt->alive = true;
+}
+
+// Reports what the alternatives still alive expected instead of line
+// (NULL: end of output) and terminates the process.
+static void expect_fail(const char *line) {
+	if (line)
+		dprintf(expect.out_fd, "[expect] line %zu: unexpected \"%s\"\n",
+			expect.line + 1, line);
+	else
+		dprintf(expect.out_fd, "[expect] output ended after line %zu\n",
+			expect.line);
+
+	for (int i = 0; i < expect.nalts; i++) {
+		struct expect_alt *alt = &expect.alts[i];
+		if (!alt->alive)
+			continue;
+		if (expect.line < alt->nlines)
+			dprintf(expect.out_fd, "[expect]   %s: expected \"%s\"\n",
+				alt->name, alt->lines[expect.line]);
+		else
+			dprintf(expect.out_fd, "[expect]   %s: expected end of output\n",
+				alt->name);
+	}
+	_exit(EXIT_FAILURE);
+}
+
+// One step of the matcher: every alternative still alive is at the same
+// line, and the ones that disagree with the new line drop out.
+static void expect_match(const char *line) {
+	bool any = false;
+
+	for (int i = 0; i < expect.nalts; i++) {
+		struct expect_alt *alt = &expect.alts[i];
+		if (alt->alive && expect.line < alt->nlines &&
+				!strcmp(alt->lines[expect.line], line))
+			any = true;
+	}
+	if (!any)
+		expect_fail(line);
+
+	for (int i = 0; i < expect.nalts; i++) {
+		struct expect_alt *alt = &expect.alts[i];
+		if (alt->alive && (expect.line >= alt->nlines ||
+				strcmp(alt->lines[expect.line], line)))
+			alt->alive = false;
+	}
+	expect.line++;
+}
+
+static void *expect_loop(void *arg) {
+	char buf[4096];
+	char *line = NULL;
+	size_t len = 0, size = 0;
+	ssize_t rv;
+
+	block_sigusr1();
+
+	while ((rv = read(expect.pipe_fd, buf, sizeof(buf))) != 0) {
+		if (rv < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		// Pass the output on first, so that the mismatch report
+		// follows everything up to the offending line.
+		for (ssize_t off = 0; off < rv; ) {
+			ssize_t n = write(expect.out_fd, buf + off, rv - off);
+			if (n < 0 && errno != EINTR)
+				break;
+			if (n > 0)
+				off += n;
+		}
+
+		for (ssize_t i = 0; i < rv; i++) {
+			if (len + 1 >= size) {
+				size = size ? size * 2 : 256;
+				line = realloc(line, size);
+			}
+			if (buf[i] != '\n') {
+				line[len++] = buf[i];
+				continue;
+			}
+			line[len] = '\0';
+			expect_match(line);
+			len = 0;
+		}
+	}
+
+	// A last line without a newline still counts
+	if (len) {
+		line[len] = '\0';
+		expect_match(line);
+	}
+	free(line);
+	return NULL;
+}
+
+static void expect_finish(void) {
+	fflush(stdout);
+	fflush(stderr);
+
+	// Closing the last write ends of the pipe lets the thread drain it.
+	dup2(expect.out_fd, STDOUT_FILENO);
+	dup2(expect.out_fd, STDERR_FILENO);
+	pthread_join(expect.thread, NULL);
+
+	for (int i = 0; i < expect.nalts; i++)
+		if (expect.alts[i].alive &&
+				expect.alts[i].nlines == expect.line)
+			return;
+	expect_fail(NULL);
+}
+
+void expect_start(const char *dir) {
+	char pattern[PATH_MAX];
+	glob_t g;
+	int fds[2];
+
+	snprintf(pattern, sizeof(pattern), "%s/out.*", dir);
+	if (glob(pattern, 0, NULL, &g) != 0) {
+		printf("expect: no %s\n", pattern);
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < g.gl_pathc && expect.nalts < EXPECT_ALT_MAX; i++)
+		expect_load(&expect.alts[expect.nalts++], g.gl_pathv[i]);
+	globfree(&g);
+
+	if (pipe(fds) < 0) {
+		perror("pipe()");
+		exit(EXIT_FAILURE);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	expect.out_fd = dup(STDOUT_FILENO);
+	expect.pipe_fd = fds[0];
+	dup2(fds[1], STDOUT_FILENO);
+	dup2(fds[1], STDERR_FILENO);
+	close(fds[1]);
+
+	// Lines have to reach the matcher as they are printed.
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (pthread_create(&expect.thread, NULL, expect_loop, NULL) != 0) {
+		perror("pthread_create(expect)");
+		exit(EXIT_FAILURE);
+	}
+	atexit(expect_finish);
+}
+
+/*----------------------------------------------------------------------*/
+
+#define COMPOSITE_EP0_MAX_DATA	1024
+
+void usb_composite_add(struct usb_composite *c, struct usb_function *f) {
+	assert(c->functions_num < USB_COMPOSITE_FUNCTIONS_MAX);
+	assert(f->eps_num <= USB_FUNCTION_EPS_MAX);
+	f->interface.bInterfaceNumber = c->functions_num;
+	f->interface.bNumEndpoints = f->eps_num;
+	for (int i = 0; i < f->eps_num; i++)
+		f->ep_handles[i] = -1;
+	c->functions[c->functions_num++] = f;
+}
+
+static bool composite_ep_fits(struct usb_raw_ep_info *info,
+				struct usb_endpoint_descriptor *ep) {
+	if (usb_endpoint_dir_in(ep) ? !info->caps.dir_in : !info->caps.dir_out)
+		return false;
+	if (usb_endpoint_maxp(ep) > info->limits.maxpacket_limit)
+		return false;
+	switch (usb_endpoint_type(ep)) {
+	case USB_ENDPOINT_XFER_BULK:
+		return info->caps.type_bulk;
+	case USB_ENDPOINT_XFER_INT:
+		return info->caps.type_int;
+	case USB_ENDPOINT_XFER_ISOC:
+		return info->caps.type_iso;
+	}
+	return false;
+}
+
+// Gives every endpoint of every function its own UDC endpoint, so that
+// no two functions end up with the same address.
+static void composite_assign_eps(int fd, struct usb_composite *c) {
+	struct usb_raw_eps_info info;
+	bool used[USB_RAW_EPS_NUM_MAX] = { false };
+	uint16_t taken[2] = { 1, 1 };	// per direction, ep0 is taken
+
+	memset(&info, 0, sizeof(info));
+	int num = usb_raw_eps_info(fd, &info);
+
+	for (int i = 0; i < c->functions_num; i++) {
+		struct usb_function *f = c->functions[i];
+		for (int j = 0; j < f->eps_num; j++) {
+			struct usb_endpoint_descriptor *ep = &f->eps[j];
+			int dir = usb_endpoint_dir_in(ep);
+			int addr = 0, k;
+
+			ep->bEndpointAddress &= USB_ENDPOINT_DIR_MASK;
+			for (k = 0; k < num; k++) {
+				if (used[k] || !composite_ep_fits(&info.eps[k], ep))
+					continue;
+				addr = info.eps[k].addr;
+				if (addr == USB_RAW_EP_ADDR_ANY) {
+					for (addr = 1; addr < 16; addr++)
+						if (!(taken[dir] & (1 << addr)))
+							break;
+				}
+				if (addr < 16 && !(taken[dir] & (1 << addr)))
+					break;
+			}
+			if (k == num) {
+				printf("composite: no endpoint left for %s\n",
+								f->name);
+				exit(EXIT_FAILURE);
+			}
+			used[k] = true;
+			taken[dir] |= 1 << addr;
+			ep->bEndpointAddress |= addr;
+		}
+	}
+}
+
+static int composite_build_config(struct usb_composite *c, uint8_t *data,
+					int length, bool other_speed) {
+	struct usb_config_descriptor *config = (void *)data;
+	int total_length = 0;
+
+#define COMPOSITE_APPEND(ptr, len) do {				\
+		assert(total_length + (len) <= length);		\
+		memcpy(&data[total_length], (ptr), (len));	\
+		total_length += (len);				\
+	} while (0)
+
+	COMPOSITE_APPEND(&c->config, sizeof(c->config));
+	for (int i = 0; i < c->functions_num; i++) {
+		struct usb_function *f = c->functions[i];
+		COMPOSITE_APPEND(&f->interface, sizeof(f->interface));
+		if (f->class_desc_len)
+			COMPOSITE_APPEND(f->class_desc, f->class_desc_len);
+		for (int j = 0; j < f->eps_num; j++)
+			COMPOSITE_APPEND(&f->eps[j], USB_DT_ENDPOINT_SIZE);
+	}
+
+#undef COMPOSITE_APPEND
+
+	config->wTotalLength = __cpu_to_le16(total_length);
+	config->bNumInterfaces = c->functions_num;
+	printf("config->wTotalLength: %d\n", total_length);
+
+	if (other_speed)
+		config->bDescriptorType = USB_DT_OTHER_SPEED_CONFIG;
+
+	return total_length;
+}
+
+static void composite_disable(int fd, struct usb_composite *c) {
+	if (!c->configured)
+		return;
+	for (int i = 0; i < c->functions_num; i++) {
+		struct usb_function *f = c->functions[i];
+		if (f->disable)
+			f->disable(f, fd);
+		for (int j = 0; j < f->eps_num; j++) {
+			if (f->ep_handles[j] < 0)
+				continue;
+			usb_raw_ep_disable(fd, f->ep_handles[j]);
+			f->ep_handles[j] = -1;
+		}
+	}
+	c->configured = false;
+}
+
+static void composite_enable(int fd, struct usb_composite *c) {
+	for (int i = 0; i < c->functions_num; i++) {
+		struct usb_function *f = c->functions[i];
+		for (int j = 0; j < f->eps_num; j++) {
+			f->ep_handles[j] = usb_raw_ep_enable(fd, &f->eps[j]);
+			printf("ep0: %s: ep 0x%02x enabled: %d\n", f->name,
+				f->eps[j].bEndpointAddress, f->ep_handles[j]);
+		}
+		if (f->enable)
+			f->enable(f, fd);
+	}
+	c->configured = true;
+}
+
+static struct usb_function *composite_function(struct usb_composite *c,
+						struct usb_ctrlrequest *ctrl) {
+	uint8_t index = __le16_to_cpu(ctrl->wIndex) & 0xff;
+
+	for (int i = 0; i < c->functions_num; i++) {
+		struct usb_function *f = c->functions[i];
+		switch (ctrl->bRequestType & USB_RECIP_MASK) {
+		case USB_RECIP_INTERFACE:
+			if (f->interface.bInterfaceNumber == index)
+				return f;
+			break;
+		case USB_RECIP_ENDPOINT:
+			for (int j = 0; j < f->eps_num; j++)
+				if (f->eps[j].bEndpointAddress == index)
+					return f;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static bool composite_standard_device(int fd, struct usb_composite *c,
+			struct usb_ctrlrequest *ctrl, struct usb_raw_ep_io *io) {
+	uint16_t value = __le16_to_cpu(ctrl->wValue);
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (value >> 8) {
+		case USB_DT_DEVICE:
+			memcpy(&io->data[0], &c->device, sizeof(c->device));
+			io->length = sizeof(c->device);
+			return true;
+		case USB_DT_CONFIG:
+			io->length = composite_build_config(c, io->data,
+						COMPOSITE_EP0_MAX_DATA, false);
+			return true;
+		case USB_DT_STRING:
+			io->data[0] = 4;
+			io->data[1] = USB_DT_STRING;
+			if ((value & 0xff) == 0) {
+				io->data[2] = 0x09;
+				io->data[3] = 0x04;
+			} else {
+				io->data[2] = 'x';
+				io->data[3] = 0x00;
+			}
+			io->length = 4;
+			return true;
+		}
+		return false;
+	case USB_REQ_SET_CONFIGURATION:
+		composite_disable(fd, c);
+		if ((value & 0xff) == c->config.bConfigurationValue) {
+			composite_enable(fd, c);
+			usb_raw_vbus_draw(fd, c->config.bMaxPower);
+			usb_raw_configure(fd);
+		}
+		io->length = 0;
+		return true;
+	case USB_REQ_GET_CONFIGURATION:
+		io->data[0] = c->configured ? c->config.bConfigurationValue : 0;
+		io->length = 1;
+		return true;
+	case USB_REQ_GET_STATUS:
+		io->data[0] = 0;
+		io->data[1] = 0;
+		io->length = 2;
+		return true;
+	}
+	return false;
+}
+
+// Standard interface and endpoint requests a function did not handle:
+// a single alternate setting, no halted endpoints.
+static bool composite_standard_default(struct usb_ctrlrequest *ctrl,
+					struct usb_raw_ep_io *io) {
+	switch (ctrl->bRequest) {
+	case USB_REQ_SET_INTERFACE:
+		io->length = 0;
+		return __le16_to_cpu(ctrl->wValue) == 0;
+	case USB_REQ_GET_INTERFACE:
+		io->data[0] = 0;
+		io->length = 1;
+		return true;
+	case USB_REQ_GET_STATUS:
+		io->data[0] = 0;
+		io->data[1] = 0;
+		io->length = 2;
+		return true;
+	case USB_REQ_CLEAR_FEATURE:
+	case USB_REQ_SET_FEATURE:
+		io->length = 0;
+		return true;
+	}
+	return false;
+}
+
+static bool composite_setup(int fd, struct usb_composite *c,
+			struct usb_ctrlrequest *ctrl, struct usb_raw_ep_io *io) {
+	bool standard = (ctrl->bRequestType & USB_TYPE_MASK) ==
+							USB_TYPE_STANDARD;
+
+	if (standard && (ctrl->bRequestType & USB_RECIP_MASK) ==
+							USB_RECIP_DEVICE)
+		return composite_standard_device(fd, c, ctrl, io);
+
+	struct usb_function *f = composite_function(c, ctrl);
+	if (f && f->setup && f->setup(f, fd, ctrl, io, COMPOSITE_EP0_MAX_DATA))
+		return true;
+	if (standard)
+		return f && composite_standard_default(ctrl, io);
+
+	// Class or vendor requests to the device, or with a wIndex that
+	// does not follow the usual layout (the printer class puts the
+	// interface number into the high byte): first taker wins.
+	for (int i = 0; i < c->functions_num; i++) {
+		struct usb_function *other = c->functions[i];
+		if (other != f && other->setup && other->setup(other, fd,
+					ctrl, io, COMPOSITE_EP0_MAX_DATA))
+			return true;
+	}
+	return false;
+}
+
+static bool composite_done(struct usb_composite *c) {
+	for (int i = 0; i < c->functions_num; i++)
+		if (!atomic_load(&c->functions[i]->done))
+			return false;
+	return c->functions_num > 0;
+}
+
+void usb_composite_ep0_loop(int fd, struct usb_composite *c) {
+	while (!composite_done(c)) {
+		struct {
+			struct usb_raw_event		inner;
+			struct usb_ctrlrequest		ctrl;
+		} event;
+		event.inner.type = 0;
+		event.inner.length = sizeof(event.ctrl);
+
+		usb_raw_event_fetch(fd, &event.inner);
+		log_event(&event.inner);
+
+		if (event.inner.type == USB_RAW_EVENT_CONNECT) {
+			composite_assign_eps(fd, c);
+			continue;
+		}
+
+		if (event.inner.type == USB_RAW_EVENT_RESET ||
+				event.inner.type == USB_RAW_EVENT_DISCONNECT) {
+			composite_disable(fd, c);
+			continue;
+		}
+
+		if (event.inner.type != USB_RAW_EVENT_CONTROL)
+			continue;
+
+		struct {
+			struct usb_raw_ep_io		inner;
+			uint8_t				data[COMPOSITE_EP0_MAX_DATA];
+		} io;
+		io.inner.ep = 0;
+		io.inner.flags = 0;
+		io.inner.length = 0;
+
+		if (!composite_setup(fd, c, &event.ctrl, &io.inner)) {
+			printf("ep0: stalling\n");
+			usb_raw_ep0_stall(fd);
+			continue;
+		}
+
+		uint16_t length = __le16_to_cpu(event.ctrl.wLength);
+		if (event.ctrl.bRequestType & USB_DIR_IN) {
+			if (length < io.inner.length)
+				io.inner.length = length;
+			int rv = usb_raw_ep0_write(fd, &io.inner);
+			printf("ep0: transferred %d bytes (in)\n", rv);
+		} else {
+			io.inner.length = length < sizeof(io.data) ?
+						length : sizeof(io.data);
+			int rv = usb_raw_ep0_read(fd, &io.inner);
+			printf("ep0: transferred %d bytes (out)\n", rv);
+		}
+	}
+}
@@ -23,6 +23,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 
 #include <linux/types.h>
 #include <linux/usb/ch9.h>
@@ -137,9 +138,239 @@ void log_control_request(struct usb_ctrlrequest *ctrl);
 
 /*----------------------------------------------------------------------*/
 
+// Waits up to timeout_ms for the host to create a device node of the
+// given subsystem whose name starts with prefix (e.g. "tty", "ttyUSB";
+// "usbmisc", "sisusbvga"; "input", "input/event") for our gadget, found
+// from kernel uevents by VID/PID and bus path. Writes "/dev/<name>" to
+// path and returns 0, or -1 on timeout.
+int  usb_dev_node_wait(const char *subsystem, const char *prefix,
+			char *path, size_t len, int timeout_ms);
+
+// With --instances the lookups use the bus of the instance whose ep0 the
+// calling thread serves; other threads (e.g. one opening an instance's
+// tty) pick the instance by its raw-gadget fd.
+void usb_dev_node_bind(int fd);
+
 int  usb_tty_open(void);
 void usb_tty_close(int tty_fd);
 
 /*----------------------------------------------------------------------*/
 
+// Options shared by all gadgets. usb_gadget_parse_args() consumes the
+// ones it recognizes and compacts argv, so the gadget-specific parsing
+// in main() keeps seeing its own arguments at argv[1], argv[2], ...
+struct usb_gadget_opts {
+	bool input_latency;	// --latency
+	int stroke_sec;		// --stroke=<seconds>
+	const char *vram_file;	// --vram-file=<path>
+	bool fb_stats;		// --fb-stats
+	const char *fb_snapshot; // --fb-snapshot=<path.ppm>
+	int fb_width;		// --fb-mode=<width>x<height>x<bpp>
+	int fb_height;
+	int fb_bpp;
+	bool reg_profile;	// --reg-profile
+	enum usb_device_speed speed; // --speed=low|full|high|super,
+				// USB_SPEED_UNKNOWN: the gadget's own
+	bool fuzz;		// --fuzz=<seed>[,<iterations>[,<window_ms>]]
+	uint64_t fuzz_seed;
+	uint64_t fuzz_iterations; // 0: until interrupted
+	int fuzz_window_ms;
+	const char *cpu_list;	// --cpu=<list>, e.g. "2" or "0,2-3"
+	int rt_prio;		// --rt-prio=<1..99>, 0: SCHED_OTHER
+	int instances;		// --instances=<n>, gadgets run by one process
+};
+
+extern struct usb_gadget_opts usb_gadget_opts;
+
+void usb_gadget_parse_args(int *argc, char **argv);
+// Number of devices to run (--instances), for gadgets that keep their
+// state per instance. usb_raw_init() rejects --instances=<n> with n > 1
+// in gadgets that never ask for it.
+int  usb_gadget_instances(void);
+void usb_gadget_udc_name(const char *device, int i, char *name, size_t len);
+
+/*----------------------------------------------------------------------*/
+
+// Test phases, recorded when USB_GADGET_PHASES names a file: one line
+// "<phase> <CLOCK_REALTIME seconds>" at the start of each phase, appended
+// as it happens so that a killed gadget still leaves its record. The raw
+// gadget wrappers mark enumeration (usb_raw_run), configure (the first
+// SET_CONFIGURATION fetched on ep0) and traffic (usb_raw_configure);
+// gadgets mark teardown when their ep0 loop is done. Each phase is
+// recorded once.
+enum usb_gadget_phase {
+	USB_GADGET_PHASE_ENUMERATION,
+	USB_GADGET_PHASE_CONFIGURE,
+	USB_GADGET_PHASE_TRAFFIC,
+	USB_GADGET_PHASE_TEARDOWN,
+	USB_GADGET_PHASE_COUNT,
+};
+
+void usb_gadget_phase(enum usb_gadget_phase phase);
+
+/*----------------------------------------------------------------------*/
+
+// Streaming golden-output verifier, started by usb_gadget_parse_args()
+// when USB_GADGET_EXPECT names a result.outs directory. stdout and stderr
+// are routed through a pipe to a thread that passes everything on to the
+// original stdout and matches each line against all out.N alternatives
+// at once. An alternative drops out at its first differing line; when
+// none is left, the process prints the mismatch and exits instead of
+// running into its remaining sleeps or the check.sh timeout.
+void expect_start(const char *dir);
+
+/*----------------------------------------------------------------------*/
+
+// Zero-filled memory for emulated device RAM, faulted in lazily on first
+// touch. If path is set, the mapping is shared with that (sparse) file so
+// the content can be inspected after the run. Returns NULL on failure.
+void *emu_mem_map(size_t size, const char *path);
+void emu_mem_unmap(void *mem, size_t size);
+// Zeroes len bytes at mem inside such a mapping. Whole pages are handed
+// back to the kernel instead of being written, so clearing memory that
+// was never touched does not fault it in.
+void emu_mem_zero(void *mem, size_t len);
+
+/*----------------------------------------------------------------------*/
+
+// Dirty-region tracking on emulated video memory (--fb-stats) and PPM
+// snapshots of the visible framebuffer (--fb-snapshot, on SIGUSR1 and at
+// exit). A frame is a burst of writes followed by FB_FRAME_GAP_MS of
+// quiet; fb_track_stop() prints frames per second and bytes per frame.
+// fb_track_start() blocks SIGUSR1 in the calling thread, so call it before
+// the gadget creates its own threads; the library's threads block it
+// themselves. Only the tracker then takes SIGUSR1.
+void fb_track_start(uint8_t *mem, size_t size);
+void fb_track_write(uint32_t offset, uint32_t length);
+void fb_track_stop(void);
+
+/*----------------------------------------------------------------------*/
+
+// Per-register access profiler (--reg-profile). Each emulated register
+// space is registered once; register i is shown at base + i * stride, so
+// a space can also stand for address ranges. reg_profile_access() is a
+// no-op for space -1, which is what callers keep when profiling is off.
+// reg_profile_report() prints per-space totals and all accessed
+// registers sorted by access count, with inter-arrival times.
+int  reg_profile_space(const char *name, uint32_t nregs,
+			uint32_t base, uint32_t stride);
+void reg_profile_access(int space, uint32_t reg, bool is_read);
+void reg_profile_report(void);
+
+/*----------------------------------------------------------------------*/
+
+// End-to-end USB-to-evdev latency measurement for HID gadgets.
+// Reports written to the tracked endpoint are timestamped on submission
+// and matched against SYN_REPORT frames read from the host-side
+// /dev/input/eventN nodes created for (vendor, product).
+void input_latency_start(uint16_t vendor, uint16_t product);
+void input_latency_track_ep(int ep);
+void input_latency_report(void);
+
+/*----------------------------------------------------------------------*/
+
+#define INPUT_NODE_PATH_MAX	32
+
+uint64_t monotonic_ns(void);
+
+// Open the host-side /dev/input/eventN nodes created for (vendor, product).
+// Returns the number of nodes opened; _wait_ polls for up to timeout_ms.
+int input_event_open(uint16_t vendor, uint16_t product, int *fds,
+			char paths[][INPUT_NODE_PATH_MAX], int max);
+int input_event_wait_open(uint16_t vendor, uint16_t product, int *fds,
+		char paths[][INPUT_NODE_PATH_MAX], int max, int timeout_ms);
+
+/*----------------------------------------------------------------------*/
+
+// Synthetic pen strokes for tablet gadgets (--stroke=<seconds>).
+// The generator sweeps the full coordinate, pressure and tilt ranges of
+// the device along a parametric curve, lifting the pen periodically, and
+// writes one report per sample to the interrupt endpoint back to back.
+// Each gadget supplies an encoder for its own packet format.
+
+struct pen_sample {
+	uint32_t x;		// 0..x_max
+	uint32_t y;		// 0..y_max
+	uint32_t pressure;	// 0..pressure_max, 0 while the pen is up
+	uint32_t tilt_x;	// 0..tilt_x_max
+	uint32_t tilt_y;	// 0..tilt_y_max
+	bool tip;		// pen touches the surface
+};
+
+struct pen_device {
+	uint16_t vendor;
+	uint16_t product;
+	uint32_t x_max;
+	uint32_t y_max;
+	uint32_t pressure_max;
+	uint32_t tilt_x_max;
+	uint32_t tilt_y_max;
+	int report_len;
+	// Optional report sent once before the stroke (e.g. tool in proximity).
+	const uint8_t *prologue;
+	int prologue_len;
+	void (*encode)(const struct pen_sample *s, uint8_t *report);
+};
+
+void pen_stroke_run(int fd, int ep, const struct pen_device *dev);
+void pen_stroke_wait(void);
+
+/*----------------------------------------------------------------------*/
+
+// Composite gadgets: several functions, each one interface with its class
+// descriptors and endpoints, combined into a single configuration.
+// usb_composite_add() numbers the interfaces in the order the functions
+// are added. usb_composite_ep0_loop() serves ep0: it builds the device
+// and configuration descriptors, assigns endpoint addresses across all
+// functions on connect, enables every function's endpoints on
+// SET_CONFIGURATION and routes interface and endpoint requests (and
+// class/vendor requests to the device) to the functions' setup().
+// Requests nobody handles are stalled. The loop returns once every
+// function has set its done flag.
+
+#define USB_FUNCTION_EPS_MAX		4
+#define USB_COMPOSITE_FUNCTIONS_MAX	8
+
+struct usb_function {
+	const char *name;
+	// bInterfaceNumber and bNumEndpoints are filled in.
+	struct usb_interface_descriptor interface;
+	// Class descriptors between the interface and its endpoints.
+	const void *class_desc;
+	size_t class_desc_len;
+	// Endpoint number 0: assigned by usb_composite_ep0_loop().
+	struct usb_endpoint_descriptor eps[USB_FUNCTION_EPS_MAX];
+	int eps_num;
+	// Raw gadget endpoint handles, valid between enable() and disable().
+	int ep_handles[USB_FUNCTION_EPS_MAX];
+	// Handles a control request for the function: fills io->data (up to
+	// max bytes) and io->length for IN requests and returns true, or
+	// returns false to leave it to the defaults. The data stage of OUT
+	// requests is read after setup() returns.
+	bool (*setup)(struct usb_function *f, int fd,
+			struct usb_ctrlrequest *ctrl,
+			struct usb_raw_ep_io *io, uint32_t max);
+	// Called after the endpoints are enabled, e.g. to start threads.
+	void (*enable)(struct usb_function *f, int fd);
+	// Called on reset or reconfiguration before the endpoints are
+	// disabled.
+	void (*disable)(struct usb_function *f, int fd);
+	atomic_bool done;
+	void *priv;
+};
+
+struct usb_composite {
+	struct usb_device_descriptor device;
+	// wTotalLength and bNumInterfaces are filled in.
+	struct usb_config_descriptor config;
+	struct usb_function *functions[USB_COMPOSITE_FUNCTIONS_MAX];
+	int functions_num;
+	bool configured;
+};
+
+void usb_composite_add(struct usb_composite *c, struct usb_function *f);
+void usb_composite_ep0_loop(int fd, struct usb_composite *c);
+
+/*----------------------------------------------------------------------*/
+
 #endif /* _USB_GADGET_TESTS_H */
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Waits until every given path exists, for check.sh and the test scripts
+// to use after modprobe instead of a fixed sleep:
+//
+//   wait-ready [-t <timeout_ms>] <path>...
+//
+// e.g. /dev/raw-gadget, /sys/class/udc/dummy_udc.0 or
+// /sys/bus/usb/drivers/<name>. The nearest existing ancestor of a
+// missing path is watched with inotify, which reports nodes created in
+// /dev right away. sysfs does not generate inotify events, so the path
+// is also checked again every WAIT_RECHECK_MS.
+// Exits with 0 once all paths exist, 1 on timeout (default 5 seconds).
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WAIT_TIMEOUT_MS		5000
+#define WAIT_RECHECK_MS		10
+
+static int64_t monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool exists(const char *path) {
+	struct stat st;
+	return stat(path, &st) == 0;
+}
+
+// Watches the nearest existing ancestor of path for new entries.
+static void watch_ancestor(int ifd, const char *path) {
+	char dir[PATH_MAX];
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	while (true) {
+		char *slash = strrchr(dir, '/');
+		if (!slash)
+			return;
+		if (slash == dir)
+			slash[1] = '\0';
+		else
+			*slash = '\0';
+		if (exists(dir)) {
+			inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO);
+			return;
+		}
+		if (slash == dir)
+			return;
+	}
+}
+
+static bool wait_path(int ifd, const char *path, int64_t deadline) {
+	char buf[4096];
+
+	while (!exists(path)) {
+		int64_t left = deadline - monotonic_ms();
+		if (left <= 0)
+			return false;
+
+		if (ifd >= 0)
+			watch_ancestor(ifd, path);
+
+		struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+		int rv = poll(&pfd, ifd >= 0 ? 1 : 0,
+				left < WAIT_RECHECK_MS ? left : WAIT_RECHECK_MS);
+		if (rv > 0 && read(ifd, buf, sizeof(buf)) < 0 && errno != EAGAIN)
+			perror("read(inotify)");
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int timeout_ms = WAIT_TIMEOUT_MS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			timeout_ms = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t <timeout_ms>] <path>...\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-t <timeout_ms>] <path>...\n", argv[0]);
+		return 2;
+	}
+
+	// Without inotify, the periodic check still works.
+	int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	int64_t deadline = monotonic_ms() + timeout_ms;
+
+	for (int i = optind; i < argc; i++) {
+		if (!wait_path(ifd, argv[i], deadline)) {
+			fprintf(stderr, "%s: timeout waiting for %s\n",
+				argv[0], argv[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Keyboard, mouse and printer functions in one device.
+# usbhid and usblp probe the interfaces concurrently, so the order of
+# their requests varies from run to run. Only the lines that don't
+# depend on it (the interface numbers, the endpoints each function gets
+# on SET_CONFIGURATION and its threads) go to result. The full output is
+# kept in log.
+
+# Get the absolute path of the script directory
+script_dir="$(dirname "$(readlink -e "$0")")"
+pushd "$script_dir" >/dev/null || exit 1
+
+executable="../../src/composite/composite"
+wait_ready="../../src/wait-ready/wait-ready"
+
+# Check if the executable exists and is runnable
+if [[ ! -x "$executable" ]]; then
+    echo "Error: $executable is missing or not executable."
+    exit 1
+fi
+
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+# usblp built-in or already loaded ?
+if [[ ! -d "/sys/bus/usb/drivers/usblp" ]]; then
+    if modinfo usblp >/dev/null 2>&1; then
+        if modprobe usblp; then
+            "$wait_ready" "/sys/bus/usb/drivers/usblp" || sleep 1
+        else
+            echo -e "${YELLOW}Error: Failed to load usblp${NC}"
+            exit 70
+        fi
+    else
+            echo -e "${YELLOW}Warning: usblp module is not available (not built-in or loadable).${NC}"
+            exit 70
+    fi
+fi
+
+# Run the test and save the output. The interleaved output can't be
+# checked line by line, so the --fail-fast matcher is left out.
+USB_GADGET_EXPECT= "$executable" --functions=keyboard,mouse,printer &> log
+grep "^composite: \|^ep0: [a-z]*: " log > result
+
+popd >/dev/null
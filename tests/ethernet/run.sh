@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/ethernet/ethernet"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -20,7 +21,7 @@ if [[ ! -d "/sys/bus/usb/drivers/rtl8150" ]]; then
     # Check if the rtl8150 module is available for loading
     if modinfo rtl8150 >/dev/null 2>&1; then
         if modprobe rtl8150; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/rtl8150" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load rtl8150${NC}"
             exit 70
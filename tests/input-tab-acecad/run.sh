@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/input-tab-acecad/input-tab-acecad"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -19,7 +20,7 @@ NC='\033[0m'
 if [[ ! -d "/sys/bus/usb/drivers/acecad" ]]; then
     if modinfo acecad >/dev/null 2>&1; then
         if modprobe acecad; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/acecad" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load acecad${NC}"
             exit 70
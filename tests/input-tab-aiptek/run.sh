@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/input-tab-aiptek/input-tab-aiptek"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -19,7 +20,7 @@ NC='\033[0m'
 if [[ ! -d "/sys/bus/usb/drivers/aiptek" ]]; then
     if modinfo aiptek >/dev/null 2>&1; then
         if modprobe aiptek; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/aiptek" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load aiptek${NC}"
             exit 70
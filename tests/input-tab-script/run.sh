@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Get the absolute path of the script directory
+script_dir="$(dirname "$(readlink -e "$0")")"
+pushd "$script_dir" >/dev/null || exit 1
+
+executable="../../src/input-tab-script/input-tab-script"
+wait_ready="../../src/wait-ready/wait-ready"
+
+# Ace Cad tablet from a script: 4 packets and a 2000 report stroke
+script="../../src/input-tab-script/scripts/acecad.tab"
+
+# Check if the executable exists and is runnable
+if [[ ! -x "$executable" ]]; then
+    echo "Error: $executable is missing or not executable."
+    exit 1
+fi
+
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+# acecad built-in or already loaded ?
+if [[ ! -d "/sys/bus/usb/drivers/acecad" ]]; then
+    if modinfo acecad >/dev/null 2>&1; then
+        if modprobe acecad; then
+            "$wait_ready" "/sys/bus/usb/drivers/acecad" || sleep 1
+        else
+            echo -e "${YELLOW}Error: Failed to load acecad${NC}"
+            exit 70
+        fi
+    else
+            echo -e "${YELLOW}Warning: acecad module is not available (not built-in or loadable).${NC}"
+            exit 70
+    fi
+fi
+
+# Run the test and save the output. The packet rate at exit varies from
+# run to run, so it is cut from result (the full output is kept in log)
+# and the --fail-fast matcher is left out.
+USB_GADGET_EXPECT= "$executable" "$script" &> log
+sed -E 's/ in [0-9.]+ s \([0-9]+ packets\/s\)$//' log > result
+
+popd >/dev/null
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Two CH341 adapters from one process (--instances=2) on dummy_udc.0 and
+# dummy_udc.1. dummy_hcd is reloaded with num=2 for the run and with its
+# default single instance afterwards.
+# Both adapters enumerate at the same time, so their lines interleave
+# differently from run to run. Each enumerates the same way, so the
+# sorted output is stable and goes to result. The full output is kept
+# in log.
+
+# Get the absolute path of the script directory
+script_dir="$(dirname "$(readlink -e "$0")")"
+pushd "$script_dir" >/dev/null || exit 1
+
+executable="../../src/serial-ch341/serial-ch341"
+wait_ready="../../src/wait-ready/wait-ready"
+
+# Check if the executable exists and is runnable
+if [[ ! -x "$executable" ]]; then
+    echo "Error: $executable is missing or not executable."
+    exit 1
+fi
+
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+# usbserial built-in or already loaded ?
+if [[ ! -d "/sys/bus/usb-serial" ]]; then
+    if modinfo usbserial >/dev/null 2>&1; then
+        if modprobe usbserial; then
+            "$wait_ready" "/sys/bus/usb-serial" || sleep 1
+        else
+            echo -e "${YELLOW}Error: Failed to load usbserial${NC}"
+            exit 70
+        fi
+    else
+            echo -e "${YELLOW}Warning: usbserial module is not available (not built-in or loadable).${NC}"
+            exit 70
+    fi
+fi
+
+# ch341 built-in or already loaded ?
+if [[ ! -d "/sys/bus/usb/drivers/ch341" ]]; then
+    if modinfo ch341 >/dev/null 2>&1; then
+        if modprobe ch341; then
+            "$wait_ready" "/sys/bus/usb/drivers/ch341" || sleep 1
+        else
+            echo -e "${YELLOW}Error: Failed to load ch341${NC}"
+            exit 70
+        fi
+    else
+            echo -e "${YELLOW}Warning: ch341 module is not available (not built-in or loadable).${NC}"
+            exit 70
+    fi
+fi
+
+# dummy_hcd with two instances
+reloaded=false
+if [[ ! -d "/sys/class/udc/dummy_udc.1" ]]; then
+    if modprobe -r dummy_hcd && modprobe dummy_hcd num=2; then
+        "$wait_ready" "/sys/class/udc/dummy_udc.1" || sleep 1
+        reloaded=true
+    else
+        echo -e "${YELLOW}Warning: can't reload dummy_hcd with num=2.${NC}"
+        exit 70
+    fi
+fi
+
+# Run the test and save the output. The interleaved output can't be
+# checked line by line, so the --fail-fast matcher is left out.
+USB_GADGET_EXPECT= "$executable" --instances=2 &> log
+LC_ALL=C sort log > result
+
+if $reloaded; then
+    modprobe -r dummy_hcd && modprobe dummy_hcd
+    "$wait_ready" "/sys/class/udc/dummy_udc.0" || sleep 1
+fi
+
+popd >/dev/null
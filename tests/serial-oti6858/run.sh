@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/serial-oti6858/serial-oti6858"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -19,7 +20,7 @@ NC='\033[0m'
 if [[ ! -d "/sys/bus/usb-serial" ]]; then
     if modinfo usbserial >/dev/null 2>&1; then
         if modprobe usbserial; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb-serial" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load usbserial${NC}"
             exit 70
@@ -34,7 +35,7 @@ fi
 if [[ ! -d "/sys/bus/usb/drivers/oti6858" ]]; then
     if modinfo oti6858 >/dev/null 2>&1; then
         if modprobe oti6858; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/oti6858" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load oti6858${NC}"
             exit 70
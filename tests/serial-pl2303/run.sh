@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/serial-pl2303/serial-pl2303"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -19,7 +20,7 @@ NC='\033[0m'
 if [[ ! -d "/sys/bus/usb-serial" ]]; then
     if modinfo usbserial >/dev/null 2>&1; then
         if modprobe usbserial; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb-serial" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load usbserial${NC}"
             exit 70
@@ -34,7 +35,7 @@ fi
 if [[ ! -d "/sys/bus/usb/drivers/pl2303" ]]; then
     if modinfo pl2303 >/dev/null 2>&1; then
         if modprobe pl2303; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/pl2303" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load pl2303${NC}"
             exit 70
@@ -4,9 +4,9 @@
 script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
-test_name="sisusbvga-FULL_SPEED"
-
-executable="../../src/${test_name}/${test_name}"
+# sisusbvga-init-gfx-dev connected at full speed
+executable="../../src/sisusbvga-init-gfx-dev/sisusbvga-init-gfx-dev"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -23,7 +23,7 @@ driver_sys_dir="/sys/bus/usb/drivers/sisusb"
 if [[ ! -d "${driver_sys_dir}" ]]; then
     if modinfo ${driver_name} >/dev/null 2>&1; then
         if modprobe ${driver_name}; then
-            sleep 1
+            "$wait_ready" "${driver_sys_dir}" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load ${driver_name}${NC}"
             exit 70
@@ -35,6 +35,6 @@ if [[ ! -d "${driver_sys_dir}" ]]; then
 fi
 
 # Run the test and save the output
-"$executable" &> result
+"$executable" --speed=full &> result
 
 popd >/dev/null
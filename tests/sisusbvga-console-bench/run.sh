@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# sisusbcon throughput benchmark, manual-only (see README.md). Not part of
+# tests/list.txt: the output contains timings, so there is no golden result
+# to compare against, and sisusbvga is loaded with console parameters.
+
+# Get the absolute path of the script directory
+script_dir="$(dirname "$(readlink -e "$0")")"
+pushd "$script_dir" >/dev/null || exit 1
+
+test_name="sisusbvga-fops-read_write"
+
+executable="../../src/${test_name}/${test_name}"
+wait_ready="../../src/wait-ready/wait-ready"
+
+# Check if the executable exists and is runnable
+if [[ ! -x "$executable" ]]; then
+    echo "Error: $executable is missing or not executable."
+    exit 1
+fi
+
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+# Virtual terminal handed over to sisusbcon
+vt="${VT:-7}"
+
+driver_name="sisusbvga"
+driver_sys_dir="/sys/bus/usb/drivers/sisusb"
+# The console VT range is a module parameter, so the driver has to be
+# loaded here (or built in and booted with sisusbvga.first=/last=).
+if [[ ! -d "${driver_sys_dir}" ]]; then
+    if ! modinfo -p ${driver_name} 2>/dev/null | grep -q "^first:"; then
+        echo -e "${YELLOW}Warning: ${driver_name} is not available or built without CONFIG_USB_SISUSBVGA_CON.${NC}"
+        exit 70
+    fi
+    if modprobe ${driver_name} first=${vt} last=${vt}; then
+        "$wait_ready" "${driver_sys_dir}" || sleep 1
+    else
+        echo -e "${YELLOW}Error: Failed to load ${driver_name}${NC}"
+        exit 70
+    fi
+else
+    echo -e "${YELLOW}Warning: ${driver_name} already loaded, assuming its console covers tty${vt}.${NC}"
+fi
+
+# Run the benchmark and save the output
+"$executable" --console-bench=/dev/tty${vt} "$@" &> result
+grep "^\[CONSOLE\]" result
+
+popd >/dev/null
@@ -7,6 +7,7 @@ pushd "$script_dir" >/dev/null || exit 1
 test_name="sisusbvga-fops-read_write"
 
 executable="../../src/${test_name}/${test_name}"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -23,7 +24,7 @@ driver_sys_dir="/sys/bus/usb/drivers/sisusb"
 if [[ ! -d "${driver_sys_dir}" ]]; then
     if modinfo ${driver_name} >/dev/null 2>&1; then
         if modprobe ${driver_name}; then
-            sleep 1
+            "$wait_ready" "${driver_sys_dir}" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load ${driver_name}${NC}"
             exit 70
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Parallel file operations stress.
+# Usage: run.sh [seconds] [threads]
+# The rates and latencies vary from run to run, so only the [STRESS] lines
+# without timings (the start line, any error or mismatch report and the
+# final count) go to result. The full output is kept in log.
+
+# Get the absolute path of the script directory
+script_dir="$(dirname "$(readlink -e "$0")")"
+pushd "$script_dir" >/dev/null || exit 1
+
+test_name="sisusbvga-fops-read_write"
+
+executable="../../src/${test_name}/${test_name}"
+wait_ready="../../src/wait-ready/wait-ready"
+
+# Check if the executable exists and is runnable
+if [[ ! -x "$executable" ]]; then
+    echo "Error: $executable is missing or not executable."
+    exit 1
+fi
+
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+driver_name="sisusbvga"
+driver_sys_dir="/sys/bus/usb/drivers/sisusb"
+# Driver built-in or already loaded ?
+if [[ ! -d "${driver_sys_dir}" ]]; then
+    if modinfo ${driver_name} >/dev/null 2>&1; then
+        if modprobe ${driver_name}; then
+            "$wait_ready" "${driver_sys_dir}" || sleep 1
+        else
+            echo -e "${YELLOW}Error: Failed to load ${driver_name}${NC}"
+            exit 70
+        fi
+    else
+            echo -e "${YELLOW}Warning: ${driver_name} module is not available (not built-in or loadable).${NC}"
+            exit 70
+    fi
+fi
+
+# Run the stress and save the output. The output with timings can't be
+# checked line by line, so the --fail-fast matcher is left out.
+USB_GADGET_EXPECT= "$executable" --fops-stress=${1:-10},${2:-4} &> log
+grep "^\[STRESS\]" log
+grep "^\[STRESS\]" log | grep -v " ops/s" > result
+
+# Any error or mismatch fails the run
+grep -q "^\[STRESS\] 0 errors, 0 mismatches" result
+rv=$?
+
+popd >/dev/null
+exit $rv
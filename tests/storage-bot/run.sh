@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/storage-bot/storage-bot"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -20,7 +21,7 @@ if [[ ! -d "/sys/bus/usb/drivers/usb-storage" ]]; then
     # Check if the usb-storage module is available for loading
     if modinfo usb-storage >/dev/null 2>&1; then
         if modprobe usb-storage; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/usb-storage" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load usb-storage${NC}"
             exit 70
@@ -5,6 +5,7 @@ script_dir="$(dirname "$(readlink -e "$0")")"
 pushd "$script_dir" >/dev/null || exit 1
 
 executable="../../src/usbtmc/usbtmc"
+wait_ready="../../src/wait-ready/wait-ready"
 
 # Check if the executable exists and is runnable
 if [[ ! -x "$executable" ]]; then
@@ -19,7 +20,7 @@ NC='\033[0m'
 if [[ ! -d "/sys/bus/usb/drivers/usbtmc" ]]; then
     if modinfo usbtmc >/dev/null 2>&1; then
         if modprobe usbtmc; then
-            sleep 1
+            "$wait_ready" "/sys/bus/usb/drivers/usbtmc" || sleep 1
         else
             echo -e "${YELLOW}Error: Failed to load usbtmc${NC}"
             exit 70